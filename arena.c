@@ -0,0 +1,47 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "nc_error.h"
+
+typedef struct Arena Arena_t;
+typedef struct ArenaBlock Block_t;
+
+#define ALIGN (sizeof(max_align_t))
+
+void* arena_alloc(Arena_t* arena, size_t size) {
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+
+    Block_t* block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(Block_t) + block_size);
+        if (block == NULL) {
+            error("out of memory\n");
+        }
+        block->size = block_size;
+        block->used = 0;
+
+        // keep filling the current block if the new one is a one-off
+        if (arena->head != NULL && block_size > ARENA_BLOCK_SIZE) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+
+    void* ptr = (char*)block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void arena_free(Arena_t* arena) {
+    Block_t* block = arena->head;
+    while (block != NULL) {
+        Block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+// Bump allocator: allocations are never freed one by one, arena_free
+// releases all of them at once. Requests larger than a block get a block
+// of their own.
+struct Arena {
+    struct ArenaBlock* head;
+};
+
+void* arena_alloc(struct Arena* arena, size_t size);
+void arena_free(struct Arena* arena);
+
+#endif
+
+// vim: ft=c
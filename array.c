@@ -0,0 +1,844 @@
+#include "array.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heap.h"
+#include "pool.h"
+#include "vmath.h"
+
+typedef struct AstValue Value_t;
+
+bool is_array(Value_t value) {
+    return value.type == V_INT_ARRAY || value.type == V_FLOAT_ARRAY;
+}
+
+bool is_int_kind(Value_t value) {
+    return value.type == V_INT || value.type == V_INT_ARRAY;
+}
+
+bool is_numeric(Value_t value) {
+    return value.type == V_INT || value.type == V_FLOAT || is_array(value);
+}
+
+// A scalar operand is passed as a pointer to its value and selects the
+// broadcasting variant of a kernel, so it is never copied out to a list.
+enum Shape {
+    SHAPE_VV,  // out[i] = a[i] op b[i]
+    SHAPE_VS,  // out[i] = a[i] op b[0]
+    SHAPE_SV,  // out[i] = a[0] op b[i]
+    SHAPE_COUNT,
+};
+
+typedef void (*Kernel_t)(size_t n, const void* a, const void* b, void* out);
+
+#define E_ADD(x, y) ((x) + (y))
+#define E_SUB(x, y) ((x) - (y))
+#define E_MUL(x, y) ((x) * (y))
+#define E_DIV(x, y) ((x) / (y))
+// a true comparison is -1 in a vector lane but 1 in a scalar
+#define E_LT(x, y) (((x) < (y)) & 1)
+#define E_GT(x, y) (((x) > (y)) & 1)
+#define E_LEQ(x, y) (((x) <= (y)) & 1)
+#define E_GEQ(x, y) (((x) >= (y)) & 1)
+#define E_EEQ(x, y) (((x) == (y)) & 1)
+#define E_NEQ(x, y) (((x) != (y)) & 1)
+#define E_FMOD(x, y) fmod((x), (y))
+#define E_FPOW(x, y) pow((x), (y))
+#define E_IMOD(x, y) ((x) % (y))
+#define E_IPOW(x, y) ((long long)pow((double)(x), (double)(y)))
+
+// Plain loops, for every ISA where no vector instruction computes the same
+// result (fmod, pow, integer division) and as the portable fallback. Like
+// the vector loops, they read each element before writing it, so out may
+// be a or b itself (see array_update).
+#define C_KERNELS(name, T, R, E)                                                     \
+    void name##_vv(size_t n, const void* a, const void* b, void* out) {              \
+        const T* x = a;                                                              \
+        const T* y = b;                                                              \
+        R* r = out;                                                                  \
+        for (size_t i = 0; i < n; ++i) {                                             \
+            r[i] = E(x[i], y[i]);                                                    \
+        }                                                                            \
+    }                                                                                \
+    void name##_vs(size_t n, const void* a, const void* b, void* out) {              \
+        const T* x = a;                                                              \
+        const T y = *(const T*)b;                                                    \
+        R* r = out;                                                                  \
+        for (size_t i = 0; i < n; ++i) {                                             \
+            r[i] = E(x[i], y);                                                       \
+        }                                                                            \
+    }                                                                                \
+    void name##_sv(size_t n, const void* a, const void* b, void* out) {              \
+        const T x = *(const T*)a;                                                    \
+        const T* y = b;                                                              \
+        R* r = out;                                                                  \
+        for (size_t i = 0; i < n; ++i) {                                             \
+            r[i] = E(x, y[i]);                                                       \
+        }                                                                            \
+    }
+
+#define LANES(V, T) (sizeof(V) / sizeof(T))
+
+// The same loops written over GCC vector types of the ISA's register width,
+// compiled for that ISA only. The remainder runs one element at a time.
+#define SIMD_KERNELS(isa, name, V, T, R, E)                                          \
+    __attribute__((target(isa))) void name##_vv(size_t n, const void* a, const void* b, void* out) { \
+        const T* x = a;                                                              \
+        const T* y = b;                                                              \
+        R* r = out;                                                                  \
+        size_t i = 0;                                                                \
+        for (; i + LANES(V, T) <= n; i += LANES(V, T)) {                             \
+            V vx, vy;                                                                \
+            memcpy(&vx, x + i, sizeof(V));                                           \
+            memcpy(&vy, y + i, sizeof(V));                                           \
+            __typeof__(E(vx, vy)) vr = E(vx, vy);                                    \
+            memcpy(r + i, &vr, sizeof(V));                                           \
+        }                                                                            \
+        for (; i < n; ++i) {                                                         \
+            r[i] = E(x[i], y[i]);                                                    \
+        }                                                                            \
+    }                                                                                \
+    __attribute__((target(isa))) void name##_vs(size_t n, const void* a, const void* b, void* out) { \
+        const T* x = a;                                                              \
+        const T s = *(const T*)b;                                                    \
+        R* r = out;                                                                  \
+        V vy;                                                                        \
+        for (size_t k = 0; k < LANES(V, T); ++k) {                                   \
+            vy[k] = s;                                                               \
+        }                                                                            \
+        size_t i = 0;                                                                \
+        for (; i + LANES(V, T) <= n; i += LANES(V, T)) {                             \
+            V vx;                                                                    \
+            memcpy(&vx, x + i, sizeof(V));                                           \
+            __typeof__(E(vx, vy)) vr = E(vx, vy);                                    \
+            memcpy(r + i, &vr, sizeof(V));                                           \
+        }                                                                            \
+        for (; i < n; ++i) {                                                         \
+            r[i] = E(x[i], s);                                                       \
+        }                                                                            \
+    }                                                                                \
+    __attribute__((target(isa))) void name##_sv(size_t n, const void* a, const void* b, void* out) { \
+        const T s = *(const T*)a;                                                    \
+        const T* y = b;                                                              \
+        R* r = out;                                                                  \
+        V vx;                                                                        \
+        for (size_t k = 0; k < LANES(V, T); ++k) {                                   \
+            vx[k] = s;                                                               \
+        }                                                                            \
+        size_t i = 0;                                                                \
+        for (; i + LANES(V, T) <= n; i += LANES(V, T)) {                             \
+            V vy;                                                                    \
+            memcpy(&vy, y + i, sizeof(V));                                           \
+            __typeof__(E(vx, vy)) vr = E(vx, vy);                                    \
+            memcpy(r + i, &vr, sizeof(V));                                           \
+        }                                                                            \
+        for (; i < n; ++i) {                                                         \
+            r[i] = E(s, y[i]);                                                       \
+        }                                                                            \
+    }
+
+// Everything but the libm operators and integer division, for one kernel
+// generator. Its arguments are the kernel name, the lane type suffix, the
+// element type and the result type, and the expression.
+#define VECTOR_KERNELS(GEN, prefix)                                   \
+    GEN(prefix##_f64_add, f64, double, double, E_ADD)                 \
+    GEN(prefix##_f64_sub, f64, double, double, E_SUB)                 \
+    GEN(prefix##_f64_mul, f64, double, double, E_MUL)                 \
+    GEN(prefix##_f64_div, f64, double, double, E_DIV)                 \
+    GEN(prefix##_f64_lt, f64, double, long long, E_LT)                \
+    GEN(prefix##_f64_gt, f64, double, long long, E_GT)                \
+    GEN(prefix##_f64_leq, f64, double, long long, E_LEQ)              \
+    GEN(prefix##_f64_geq, f64, double, long long, E_GEQ)              \
+    GEN(prefix##_f64_eeq, f64, double, long long, E_EEQ)              \
+    GEN(prefix##_f64_neq, f64, double, long long, E_NEQ)              \
+    GEN(prefix##_i64_add, i64, long long, long long, E_ADD)           \
+    GEN(prefix##_i64_sub, i64, long long, long long, E_SUB)           \
+    GEN(prefix##_i64_mul, i64, long long, long long, E_MUL)           \
+    GEN(prefix##_i64_lt, i64, long long, long long, E_LT)             \
+    GEN(prefix##_i64_gt, i64, long long, long long, E_GT)             \
+    GEN(prefix##_i64_leq, i64, long long, long long, E_LEQ)           \
+    GEN(prefix##_i64_geq, i64, long long, long long, E_GEQ)           \
+    GEN(prefix##_i64_eeq, i64, long long, long long, E_EEQ)           \
+    GEN(prefix##_i64_neq, i64, long long, long long, E_NEQ)
+
+#define C_GEN(name, lane, T, R, E) C_KERNELS(name, T, R, E)
+VECTOR_KERNELS(C_GEN, c)
+C_KERNELS(c_f64_mod, double, double, E_FMOD)
+C_KERNELS(c_f64_pow, double, double, E_FPOW)
+C_KERNELS(c_i64_div, long long, long long, E_DIV)
+C_KERNELS(c_i64_mod, long long, long long, E_IMOD)
+C_KERNELS(c_i64_pow, long long, long long, E_IPOW)
+
+#define KERNEL_SET(name) {name##_vv, name##_vs, name##_sv}
+
+// Division, % and ^ on ints and % and ^ on floats use the C loops in
+// every set.
+#define KERNEL_TABLE(prefix)                                \
+    .f64 = {                                                \
+        [ARRAY_ADD] = KERNEL_SET(prefix##_f64_add),         \
+        [ARRAY_SUB] = KERNEL_SET(prefix##_f64_sub),         \
+        [ARRAY_MUL] = KERNEL_SET(prefix##_f64_mul),         \
+        [ARRAY_DIV] = KERNEL_SET(prefix##_f64_div),         \
+        [ARRAY_MOD] = KERNEL_SET(c_f64_mod),                \
+        [ARRAY_POW] = KERNEL_SET(c_f64_pow),                \
+        [ARRAY_LT] = KERNEL_SET(prefix##_f64_lt),           \
+        [ARRAY_GT] = KERNEL_SET(prefix##_f64_gt),           \
+        [ARRAY_LEQ] = KERNEL_SET(prefix##_f64_leq),         \
+        [ARRAY_GEQ] = KERNEL_SET(prefix##_f64_geq),         \
+        [ARRAY_EEQ] = KERNEL_SET(prefix##_f64_eeq),         \
+        [ARRAY_NEQ] = KERNEL_SET(prefix##_f64_neq),         \
+    },                                                      \
+    .i64 = {                                                \
+        [ARRAY_ADD] = KERNEL_SET(prefix##_i64_add),         \
+        [ARRAY_SUB] = KERNEL_SET(prefix##_i64_sub),         \
+        [ARRAY_MUL] = KERNEL_SET(prefix##_i64_mul),         \
+        [ARRAY_DIV] = KERNEL_SET(c_i64_div),                \
+        [ARRAY_MOD] = KERNEL_SET(c_i64_mod),                \
+        [ARRAY_POW] = KERNEL_SET(c_i64_pow),                \
+        [ARRAY_LT] = KERNEL_SET(prefix##_i64_lt),           \
+        [ARRAY_GT] = KERNEL_SET(prefix##_i64_gt),           \
+        [ARRAY_LEQ] = KERNEL_SET(prefix##_i64_leq),         \
+        [ARRAY_GEQ] = KERNEL_SET(prefix##_i64_geq),         \
+        [ARRAY_EEQ] = KERNEL_SET(prefix##_i64_eeq),         \
+        [ARRAY_NEQ] = KERNEL_SET(prefix##_i64_neq),         \
+    },                                                      \
+    .math = {                                               \
+        [ARRAY_SIN] = prefix##_vmath_sin,                   \
+        [ARRAY_COS] = prefix##_vmath_cos,                   \
+        [ARRAY_TAN] = prefix##_vmath_tan,                   \
+        [ARRAY_ASIN] = prefix##_vmath_asin,                 \
+        [ARRAY_ACOS] = prefix##_vmath_acos,                 \
+        [ARRAY_ATAN] = prefix##_vmath_atan,                 \
+        [ARRAY_EXP] = prefix##_vmath_exp,                   \
+        [ARRAY_LOG] = prefix##_vmath_log,                   \
+        [ARRAY_SQRT] = prefix##_vmath_sqrt,                 \
+    }
+
+struct Isa {
+    const char* name;
+    bool (*supported)(void);
+    Kernel_t f64[ARRAY_OP_COUNT][SHAPE_COUNT];  // double operands
+    Kernel_t i64[ARRAY_OP_COUNT][SHAPE_COUNT];  // long long operands
+    MathKernel_t math[ARRAY_FUNC_COUNT];
+};
+
+bool c_supported(void) {
+    return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+typedef double sse2_f64 __attribute__((vector_size(16)));
+typedef long long sse2_i64 __attribute__((vector_size(16)));
+typedef double avx2_f64 __attribute__((vector_size(32)));
+typedef long long avx2_i64 __attribute__((vector_size(32)));
+typedef double avx512_f64 __attribute__((vector_size(64)));
+typedef long long avx512_i64 __attribute__((vector_size(64)));
+
+#define SSE2_GEN(name, lane, T, R, E) SIMD_KERNELS("sse2", name, sse2_##lane, T, R, E)
+#define AVX2_GEN(name, lane, T, R, E) SIMD_KERNELS("avx2", name, avx2_##lane, T, R, E)
+#define AVX512_GEN(name, lane, T, R, E) SIMD_KERNELS("avx512f,avx512dq", name, avx512_##lane, T, R, E)
+
+VECTOR_KERNELS(SSE2_GEN, sse2)
+VECTOR_KERNELS(AVX2_GEN, avx2)
+VECTOR_KERNELS(AVX512_GEN, avx512)
+
+bool sse2_supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+bool avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+bool avx512_supported(void) {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+}
+
+#endif
+
+// ordered from narrowest to widest
+const struct Isa isas[] = {
+    {.name = "c", .supported = c_supported, KERNEL_TABLE(c)},
+#if defined(__x86_64__) || defined(__i386__)
+    {.name = "sse2", .supported = sse2_supported, KERNEL_TABLE(sse2)},
+    {.name = "avx2", .supported = avx2_supported, KERNEL_TABLE(avx2)},
+    {.name = "avx512", .supported = avx512_supported, KERNEL_TABLE(avx512)},
+#endif
+};
+
+#define ISA_COUNT (sizeof(isas) / sizeof(isas[0]))
+
+const struct Isa* current_isa = NULL;
+
+bool array_use_isa(const char* name) {
+    for (size_t i = 0; i < ISA_COUNT; ++i) {
+        if (strcmp(isas[i].name, name) == 0 && isas[i].supported()) {
+            current_isa = &isas[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const struct Isa* get_isa(void) {
+    if (current_isa != NULL) {
+        return current_isa;
+    }
+
+    const char* name = getenv("NC_SIMD");
+    if (name != NULL && array_use_isa(name)) {
+        return current_isa;
+    }
+
+    for (size_t i = ISA_COUNT; i-- > 0;) {
+        if (isas[i].supported()) {
+            current_isa = &isas[i];
+            break;
+        }
+    }
+    return current_isa;
+}
+
+const char* array_isa(void) {
+    return get_isa()->name;
+}
+
+#define ARRAY_CHUNK 16384  // elements per task, 128 KB of each operand
+#define ARRAY_THREAD_MIN (1 << 16)
+
+size_t thread_min = 0;
+
+void array_set_thread_min(size_t n) {
+    thread_min = n > 0 ? n : 1;
+}
+
+size_t get_thread_min(void) {
+    if (thread_min == 0) {
+        const char* env = getenv("NC_THREAD_MIN");
+        long n = env != NULL ? strtol(env, NULL, 10) : ARRAY_THREAD_MIN;
+        thread_min = n > 0 ? (size_t)n : 1;
+    }
+    return thread_min;
+}
+
+struct Split {
+    void (*body)(void* arg, size_t start, size_t end);
+    void* arg;
+    size_t n;
+};
+
+void split_task(void* arg, size_t i) {
+    struct Split* split = arg;
+    size_t start = i * ARRAY_CHUNK;
+    size_t end = split->n - start < ARRAY_CHUNK ? split->n : start + ARRAY_CHUNK;
+    split->body(split->arg, start, end);
+}
+
+// Runs body over the elements [0, n), in one call or, from the threshold
+// on, in chunks spread over the pool. Chunks start at multiples of every
+// vector width, so each element goes through the same instructions as in
+// one call and the result does not depend on the number of threads.
+void array_split(size_t n, void (*body)(void* arg, size_t start, size_t end), void* arg) {
+    if (n < get_thread_min() || pool_threads() == 1) {
+        body(arg, 0, n);
+        return;
+    }
+
+    struct Split split = {.body = body, .arg = arg, .n = n};
+    pool_run((n + ARRAY_CHUNK - 1) / ARRAY_CHUNK, split_task, &split);
+}
+
+void array_init(void) {
+    get_isa();
+    get_thread_min();
+}
+
+bool contains_int(Value_t value, long long x) {
+    if (value.type == V_INT) {
+        return value.int_value == x;
+    }
+
+    for (size_t i = 0; i < value.list_size; ++i) {
+        if (value.int_array[i] == x) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Where the kernel finds an int operand: the array itself, or the scalar.
+const void* int_operand(const Value_t* value) {
+    return value->type == V_INT_ARRAY ? (const void*)value->int_array : (const void*)&value->int_value;
+}
+
+// Where the kernel finds a float operand. Ints are converted up front, into
+// *buf for arrays, just like binop_impl converts the int side.
+const void* float_operand(const Value_t* value, double** buf, double* scalar) {
+    switch (value->type) {
+        case V_FLOAT_ARRAY:
+            return value->float_array;
+        case V_FLOAT:
+            return &value->float_value;
+        case V_INT:
+            *scalar = (double)value->int_value;
+            return scalar;
+        default:
+            *buf = malloc(value->list_size * sizeof(double));
+            for (size_t i = 0; i < value->list_size; ++i) {
+                (*buf)[i] = (double)value->int_array[i];
+            }
+            return *buf;
+    }
+}
+
+// A kernel call over part of the operands. Ints and doubles are both 8
+// bytes, so an element offset is the same for either.
+struct BinopTask {
+    Kernel_t kernel;
+    enum Shape shape;
+    const double* a;
+    const double* b;
+    double* out;
+};
+
+void binop_range(void* arg, size_t start, size_t end) {
+    struct BinopTask* task = arg;
+    const double* a = task->shape == SHAPE_SV ? task->a : task->a + start;
+    const double* b = task->shape == SHAPE_VS ? task->b : task->b + start;
+    task->kernel(end - start, a, b, task->out + start);
+}
+
+// The type of the list array_binop makes of lhs and rhs, or V_NIL where it
+// leaves them to the caller.
+enum ValueType binop_type(enum ArrayOp op, Value_t lhs, Value_t rhs) {
+    if (op == ARRAY_NONE || !is_numeric(lhs) || !is_numeric(rhs) || (!is_array(lhs) && !is_array(rhs))) {
+        return V_NIL;
+    }
+
+    if (is_array(lhs) && is_array(rhs) && lhs.list_size != rhs.list_size) {
+        return V_NIL;
+    }
+
+    bool ints = is_int_kind(lhs) && is_int_kind(rhs);
+
+    // leave the trap on x / 0 and on the smallest integer / -1 to the scalar operator
+    if (ints && (op == ARRAY_DIV || op == ARRAY_MOD) && (contains_int(rhs, 0) || contains_int(rhs, -1))) {
+        return V_NIL;
+    }
+
+    return ints || op >= ARRAY_LT ? V_INT_ARRAY : V_FLOAT_ARRAY;
+}
+
+void binop_run(enum ArrayOp op, Value_t lhs, Value_t rhs, double* out) {
+    size_t n = is_array(lhs) ? lhs.list_size : rhs.list_size;
+    enum Shape shape = !is_array(rhs) ? SHAPE_VS : !is_array(lhs) ? SHAPE_SV : SHAPE_VV;
+
+    const struct Isa* isa = get_isa();
+    struct BinopTask task = {.shape = shape, .out = out};
+
+    if (is_int_kind(lhs) && is_int_kind(rhs)) {
+        task.kernel = isa->i64[op][shape];
+        task.a = int_operand(&lhs);
+        task.b = int_operand(&rhs);
+        array_split(n, binop_range, &task);
+    } else {
+        double* lbuf = NULL;
+        double* rbuf = NULL;
+        double lscalar;
+        double rscalar;
+        task.kernel = isa->f64[op][shape];
+        task.a = float_operand(&lhs, &lbuf, &lscalar);
+        task.b = float_operand(&rhs, &rbuf, &rscalar);
+        array_split(n, binop_range, &task);
+        free(lbuf);
+        free(rbuf);
+    }
+}
+
+bool array_binop(enum ArrayOp op, Value_t lhs, Value_t rhs, Value_t* result) {
+    enum ValueType type = binop_type(op, lhs, rhs);
+    if (type == V_NIL) {
+        return false;
+    }
+
+    *result = heap_array(type, is_array(lhs) ? lhs.list_size : rhs.list_size);
+    binop_run(op, lhs, rhs, result->float_array);
+    return true;
+}
+
+bool array_update(enum ArrayOp op, Value_t lhs, Value_t rhs) {
+    if (!is_array(lhs) || binop_type(op, lhs, rhs) != lhs.type) {
+        return false;
+    }
+
+    binop_run(op, lhs, rhs, lhs.float_array);
+    return true;
+}
+
+double (*const libm_funcs[ARRAY_FUNC_COUNT])(double) = {
+#define X(x, f) [x] = f,
+    ARRAY_FUNCS
+#undef X
+};
+
+bool use_libm = false;
+
+void array_use_libm(bool libm) {
+    use_libm = libm;
+}
+
+struct FuncTask {
+    MathKernel_t kernel;  // NULL for libm
+    double (*libm)(double);
+    const double* x;
+    double* out;
+};
+
+void func_range(void* arg, size_t start, size_t end) {
+    struct FuncTask* task = arg;
+    if (task->kernel == NULL) {
+        for (size_t i = start; i < end; ++i) {
+            task->out[i] = task->libm(task->x[i]);
+        }
+    } else {
+        task->kernel(end - start, task->x + start, task->out + start);
+    }
+}
+
+bool array_func(enum ArrayFunc f, Value_t arg, Value_t* result) {
+    if (!is_array(arg)) {
+        return false;
+    }
+
+    double* buf = NULL;
+    const double* x = float_operand(&arg, &buf, NULL);
+    size_t n = arg.list_size;
+
+    *result = heap_array(V_FLOAT_ARRAY, n);
+
+    struct FuncTask task = {
+        .kernel = use_libm ? NULL : get_isa()->math[f],
+        .libm = libm_funcs[f],
+        .x = x,
+        .out = result->float_array,
+    };
+    array_split(n, func_range, &task);
+
+    free(buf);
+    return true;
+}
+
+#define FUSE_BLOCK 256
+
+// What array_fused tracks of a node: the type of its elements, whether it
+// is a number, and where the kernels find its values in the current block.
+struct FuseSlot {
+    bool ints;
+    bool scalar;
+    long long i;
+    double f;
+    const void* data;
+    double* floats;  // the current block of an int node converted to floats
+};
+
+const void* fuse_int(const struct FuseSlot* slot) {
+    return slot->scalar ? (const void*)&slot->i : slot->data;
+}
+
+const void* fuse_float(struct FuseSlot* slot, size_t len) {
+    if (slot->scalar) {
+        return &slot->f;
+    }
+    if (!slot->ints) {
+        return slot->data;
+    }
+
+    const long long* x = slot->data;
+    for (size_t k = 0; k < len; ++k) {
+        slot->floats[k] = (double)x[k];
+    }
+    return slot->floats;
+}
+
+// Fills in the slots of nodes and the length of the lists, or returns false
+// if the expression cannot be fused.
+bool fuse_check(const struct FuseNode* nodes, size_t count, struct FuseSlot* slots, size_t* n) {
+    bool found = false;
+
+    for (size_t i = 0; i < count; ++i) {
+        const struct FuseNode* node = &nodes[i];
+        struct FuseSlot* slot = &slots[i];
+        const struct FuseSlot* lhs = &slots[node->lhs];
+        const struct FuseSlot* rhs = &slots[node->rhs];
+        Value_t value = node->value;
+
+        slot->scalar = false;
+        switch (node->kind) {
+            case FUSE_LEAF:
+                if (!is_numeric(value)) {
+                    return false;
+                }
+                slot->ints = is_int_kind(value);
+                slot->scalar = !is_array(value);
+                if (!slot->scalar) {
+                    if (found && value.list_size != *n) {
+                        return false;
+                    }
+                    *n = value.list_size;
+                    found = true;
+                }
+                slot->i = value.type == V_INT ? value.int_value : 0;
+                slot->f = value.type == V_FLOAT ? value.float_value : (double)slot->i;
+                break;
+            case FUSE_BINOP: {
+                if (node->op == ARRAY_NONE || (lhs->scalar && rhs->scalar)) {
+                    return false;
+                }
+                bool ints = lhs->ints && rhs->ints;
+                if (ints && (node->op == ARRAY_DIV || node->op == ARRAY_MOD) &&
+                    (nodes[node->rhs].kind != FUSE_LEAF || contains_int(nodes[node->rhs].value, 0) ||
+                     contains_int(nodes[node->rhs].value, -1))) {
+                    return false;
+                }
+                slot->ints = ints || node->op >= ARRAY_LT;
+            } break;
+            case FUSE_NEG:
+            case FUSE_NOT:
+            case FUSE_FUNC:
+                if (lhs->scalar) {
+                    return false;
+                }
+                slot->ints = node->kind == FUSE_NEG ? lhs->ints : node->kind == FUSE_NOT;
+                break;
+        }
+    }
+
+    return found && *n > 0 && !slots[count - 1].scalar;
+}
+
+struct FuseTask {
+    const struct FuseNode* nodes;
+    size_t count;
+    const struct FuseSlot* slots;
+    const struct Isa* isa;
+    double* out;
+};
+
+// Runs the plan over the elements [start, end), with slots and scratch
+// blocks of its own.
+void fuse_range(void* arg, size_t start, size_t end) {
+    const struct FuseTask* task = arg;
+    const struct FuseNode* nodes = task->nodes;
+    size_t count = task->count;
+    const struct Isa* isa = task->isa;
+
+    struct FuseSlot slots[FUSE_MAX];
+    memcpy(slots, task->slots, count * sizeof(slots[0]));
+    // a block of values and a block of converted floats per node
+    double* scratch = malloc(2 * count * FUSE_BLOCK * sizeof(double));
+
+    for (size_t first = start; first < end; first += FUSE_BLOCK) {
+        size_t len = end - first < FUSE_BLOCK ? end - first : FUSE_BLOCK;
+
+        for (size_t i = 0; i < count; ++i) {
+            const struct FuseNode* node = &nodes[i];
+            struct FuseSlot* slot = &slots[i];
+            struct FuseSlot* lhs = &slots[node->lhs];
+            struct FuseSlot* rhs = &slots[node->rhs];
+            // the last node writes straight into the result
+            void* out = i == count - 1 ? task->out + first : scratch + 2 * i * FUSE_BLOCK;
+            slot->floats = scratch + (2 * i + 1) * FUSE_BLOCK;
+
+            switch (node->kind) {
+                case FUSE_LEAF:
+                    if (!slot->scalar) {
+                        slot->data = node->value.float_array + first;
+                    }
+                    continue;
+                case FUSE_BINOP: {
+                    enum Shape shape = lhs->scalar ? SHAPE_SV : rhs->scalar ? SHAPE_VS : SHAPE_VV;
+                    if (lhs->ints && rhs->ints) {
+                        isa->i64[node->op][shape](len, fuse_int(lhs), fuse_int(rhs), out);
+                    } else {
+                        isa->f64[node->op][shape](len, fuse_float(lhs, len), fuse_float(rhs, len), out);
+                    }
+                } break;
+                case FUSE_NEG:
+                    if (lhs->ints) {
+                        const long long* x = lhs->data;
+                        long long* r = out;
+                        for (size_t k = 0; k < len; ++k) {
+                            r[k] = -x[k];
+                        }
+                    } else {
+                        const double* x = lhs->data;
+                        double* r = out;
+                        for (size_t k = 0; k < len; ++k) {
+                            r[k] = -x[k];
+                        }
+                    }
+                    break;
+                case FUSE_NOT:
+                    if (lhs->ints) {
+                        const long long* x = lhs->data;
+                        long long* r = out;
+                        for (size_t k = 0; k < len; ++k) {
+                            r[k] = x[k] == 0;
+                        }
+                    } else {
+                        const double* x = lhs->data;
+                        long long* r = out;
+                        for (size_t k = 0; k < len; ++k) {
+                            r[k] = x[k] == 0.0;
+                        }
+                    }
+                    break;
+                case FUSE_FUNC: {
+                    const double* x = fuse_float(lhs, len);
+                    if (use_libm) {
+                        double* r = out;
+                        for (size_t k = 0; k < len; ++k) {
+                            r[k] = libm_funcs[node->func](x[k]);
+                        }
+                    } else {
+                        isa->math[node->func](len, x, out);
+                    }
+                } break;
+            }
+            slot->data = out;
+        }
+    }
+
+    free(scratch);
+}
+
+bool array_fused(const struct FuseNode* nodes, size_t count, Value_t* result) {
+    struct FuseSlot slots[FUSE_MAX];
+    size_t n = 0;
+
+    if (count == 0 || count > FUSE_MAX || !fuse_check(nodes, count, slots, &n)) {
+        return false;
+    }
+
+    // ints and doubles are both 8 bytes
+    *result = heap_array(slots[count - 1].ints ? V_INT_ARRAY : V_FLOAT_ARRAY, n);
+
+    struct FuseTask task = {
+        .nodes = nodes,
+        .count = count,
+        .slots = slots,
+        .isa = get_isa(),
+        .out = result->float_array,
+    };
+    array_split(n, fuse_range, &task);
+
+    return true;
+}
+
+#define REDUCE_LANES 8
+#define REDUCE_BLOCK 128  // pairwise sums split down to this many elements
+
+// Sum of x[0..n) as a tree of halves down to blocks, each added up in
+// REDUCE_LANES interleaved sums. The error grows with log n instead of n.
+double pairwise_sum(const double* x, size_t n) {
+    if (n > REDUCE_BLOCK) {
+        size_t half = n / 2;
+        return pairwise_sum(x, half) + pairwise_sum(x + half, n - half);
+    }
+
+    double lanes[REDUCE_LANES] = {};
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES) {
+        for (size_t k = 0; k < REDUCE_LANES; ++k) {
+            lanes[k] += x[i + k];
+        }
+    }
+    for (size_t k = 0; i < n; ++i, ++k) {
+        lanes[k] += x[i];
+    }
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+double float_product(const double* x, size_t n) {
+    double lanes[REDUCE_LANES] = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES) {
+        for (size_t k = 0; k < REDUCE_LANES; ++k) {
+            lanes[k] *= x[i + k];
+        }
+    }
+    for (size_t k = 0; i < n; ++i, ++k) {
+        lanes[k] *= x[i];
+    }
+    return ((lanes[0] * lanes[1]) * (lanes[2] * lanes[3])) * ((lanes[4] * lanes[5]) * (lanes[6] * lanes[7]));
+}
+
+// ints wrap around, as the operators do on most machines
+unsigned long long int_reduce(bool prod, const long long* x, size_t n) {
+    unsigned long long acc = prod ? 1 : 0;
+    for (size_t i = 0; i < n; ++i) {
+        acc = prod ? acc * (unsigned long long)x[i] : acc + (unsigned long long)x[i];
+    }
+    return acc;
+}
+
+// One partial result per chunk, in the same chunks whether or not the pool
+// is used.
+struct ReduceTask {
+    bool prod;
+    Value_t list;
+    Value_t* partials;
+};
+
+void reduce_chunk(void* arg, size_t i) {
+    struct ReduceTask* task = arg;
+    size_t start = i * ARRAY_CHUNK;
+    size_t end = task->list.list_size - start < ARRAY_CHUNK ? task->list.list_size : start + ARRAY_CHUNK;
+
+    Value_t* partial = &task->partials[i];
+    if (task->list.type == V_INT_ARRAY) {
+        partial->int_value = (long long)int_reduce(task->prod, task->list.int_array + start, end - start);
+    } else if (task->prod) {
+        partial->float_value = float_product(task->list.float_array + start, end - start);
+    } else {
+        partial->float_value = pairwise_sum(task->list.float_array + start, end - start);
+    }
+}
+
+bool array_reduce(enum ArrayOp op, Value_t list, Value_t* result) {
+    if ((list.type != V_INT_ARRAY && list.type != V_FLOAT_ARRAY) || (op != ARRAY_ADD && op != ARRAY_MUL)) {
+        return false;
+    }
+
+    bool prod = op == ARRAY_MUL;
+    size_t chunks = (list.list_size + ARRAY_CHUNK - 1) / ARRAY_CHUNK;
+    struct ReduceTask task = {.prod = prod, .list = list, .partials = malloc((chunks + 1) * sizeof(Value_t))};
+    if (list.list_size < get_thread_min() || pool_threads() == 1) {
+        for (size_t i = 0; i < chunks; ++i) {
+            reduce_chunk(&task, i);
+        }
+    } else {
+        pool_run(chunks, reduce_chunk, &task);
+    }
+
+    if (list.type == V_INT_ARRAY) {
+        unsigned long long acc = prod ? 1 : 0;
+        for (size_t i = 0; i < chunks; ++i) {
+            unsigned long long x = (unsigned long long)task.partials[i].int_value;
+            acc = prod ? acc * x : acc + x;
+        }
+        *result = (Value_t){.type = V_INT, .int_value = (long long)acc};
+    } else {
+        double* xs = malloc((chunks + 1) * sizeof(double));
+        for (size_t i = 0; i < chunks; ++i) {
+            xs[i] = task.partials[i].float_value;
+        }
+        double x = prod ? float_product(xs, chunks) : pairwise_sum(xs, chunks);
+        *result = (Value_t){.type = V_FLOAT, .float_value = x};
+        free(xs);
+    }
+
+    free(task.partials);
+    return true;
+}
@@ -0,0 +1,133 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include "nc.h"
+
+// Element-wise operators with a typed loop over packed lists.
+#define ARRAY_OPS    \
+    X(ARRAY_NONE)    \
+    X(ARRAY_ADD)     \
+    X(ARRAY_SUB)     \
+    X(ARRAY_MUL)     \
+    X(ARRAY_DIV)     \
+    X(ARRAY_MOD)     \
+    X(ARRAY_POW)     \
+    X(ARRAY_LT)      \
+    X(ARRAY_GT)      \
+    X(ARRAY_LEQ)     \
+    X(ARRAY_GEQ)     \
+    X(ARRAY_EEQ)     \
+    X(ARRAY_NEQ)
+
+enum ArrayOp {
+#define X(x) x,
+    ARRAY_OPS
+#undef X
+    ARRAY_OP_COUNT
+};
+
+// Math builtins with a kernel over packed lists, and the libm function each
+// one stands in for.
+#define ARRAY_FUNCS      \
+    X(ARRAY_SIN, sin)    \
+    X(ARRAY_COS, cos)    \
+    X(ARRAY_TAN, tan)    \
+    X(ARRAY_ASIN, asin)  \
+    X(ARRAY_ACOS, acos)  \
+    X(ARRAY_ATAN, atan)  \
+    X(ARRAY_EXP, exp)    \
+    X(ARRAY_LOG, log)    \
+    X(ARRAY_SQRT, sqrt)
+
+enum ArrayFunc {
+#define X(x, f) x,
+    ARRAY_FUNCS
+#undef X
+    ARRAY_FUNC_COUNT
+};
+
+// Kernel sets, from plain C loops up to AVX-512. The widest one the CPU
+// supports is picked on first use, unless the NC_SIMD environment variable
+// names another.
+#define ARRAY_ISAS \
+    X(c)           \
+    X(sse2)        \
+    X(avx2)        \
+    X(avx512)
+
+bool is_array(struct AstValue value);
+
+// Lists of at least n elements are split into chunks for the threads of
+// pool.h. The threshold is taken from the NC_THREAD_MIN environment
+// variable unless set here.
+void array_set_thread_min(size_t n);
+
+// Settles the kernel set and the thread threshold, which are otherwise
+// picked on first use, before the evaluator runs on several threads.
+void array_init(void);
+
+const char* array_isa(void);
+// Returns false if name is unknown or not supported by this CPU.
+bool array_use_isa(const char* name);
+
+// Applies op to two packed lists of the same length, or to a packed list and
+// a number, writing a new packed list to result, which the caller owns (see
+// heap.h), as it does the results of array_func and array_fused. Returns
+// false, leaving the work to the caller, for any other operands and where the
+// loop would behave differently from the scalar operator (integer division by
+// 0 or -1).
+bool array_binop(enum ArrayOp op, struct AstValue lhs, struct AstValue rhs, struct AstValue* result);
+
+// Applies op like array_binop but writes the result over the packed list
+// lhs, which the caller must be free to change. Returns false where
+// array_binop would, and where the result would not have the type of lhs.
+bool array_update(enum ArrayOp op, struct AstValue lhs, struct AstValue rhs);
+
+// Makes array_func call libm for every element instead of the polynomial
+// kernels of vmath.h, for results that match the scalar builtins exactly.
+void array_use_libm(bool libm);
+
+// Applies f to every element of a packed list, writing a new list of floats
+// to result. Returns false for any other argument.
+bool array_func(enum ArrayFunc f, struct AstValue arg, struct AstValue* result);
+
+// Adds up the elements of a packed list for ARRAY_ADD, or multiplies them
+// for ARRAY_MUL, into an int or a float. Floats are summed pairwise. The
+// list is cut into the same chunks for any number of threads and the chunk
+// results are combined in the same order, so the result never depends on
+// it. Returns false for any other list or op.
+bool array_reduce(enum ArrayOp op, struct AstValue list, struct AstValue* result);
+
+// One operation of a fused list expression. Every node comes after its
+// operands, and the last node is the result of the expression.
+enum FuseKind {
+    FUSE_LEAF,   // value
+    FUSE_BINOP,  // op applied to nodes lhs and rhs
+    FUSE_NEG,    // -lhs
+    FUSE_NOT,    // !lhs
+    FUSE_FUNC,   // func(lhs)
+};
+
+struct FuseNode {
+    enum FuseKind kind;
+    union {
+        enum ArrayOp op;
+        enum ArrayFunc func;
+    };
+    unsigned char lhs;
+    unsigned char rhs;
+    struct AstValue value;
+};
+
+#define FUSE_MAX 32
+
+// Computes a whole expression of packed lists and numbers in one pass over
+// blocks of elements that stay in cache, allocating only the result.
+// Returns false under the same conditions as array_binop, for any operation
+// whose operands are all numbers, and for integer division by anything but
+// a list or number that is known not to contain 0 or -1.
+bool array_fused(const struct FuseNode* nodes, size_t count, struct AstValue* result);
+
+#endif
+
+// vim: ft=c
@@ -0,0 +1,3 @@
+memo off
+fib(n) = { n if n < 2; fib(n - 1) + fib(n - 2) }
+fib(25)
@@ -0,0 +1,3 @@
+s = 0
+for i in 1..3000000 s = s + i
+s
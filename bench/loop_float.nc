@@ -0,0 +1,3 @@
+x = 0.0
+for i in 1..3000000 x = x + 0.5 * i - i / 3.0
+x
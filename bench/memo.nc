@@ -0,0 +1,4 @@
+f(x) = { y = 0; for k in 0..19..+1 { y = y + x * k }; y }
+s = 0
+for i in 0..499..+1 { for j in 0..99..+1 { s = s + f(j) } }
+s
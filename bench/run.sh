@@ -0,0 +1,13 @@
+#!/usr/bin/env bash
+# Times every bench script under the tree walker and the VM.
+
+cd "$(dirname "$0")/.." || exit 1
+
+TIMEFORMAT="%R s"
+for script in bench/*.nc; do
+    for engine in "" --vm; do
+        label=${engine:---tree}
+        printf "%-24s %-6s " "$script" "${label#--}"
+        { time ./nc $engine < "$script" > /dev/null 2>&1; } 2>&1
+    done
+done
@@ -0,0 +1,811 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include "lexer.h"
+#include "utils.h"
+
+typedef struct AstNode Node_t;
+typedef struct Chunk Chunk_t;
+typedef struct Instr Instr_t;
+
+// list literals larger than this are left to the tree walker rather than
+// spilling every item into its own register
+#define MAX_LIST_REGS 256
+
+struct Compiler {
+    Chunk_t* chunk;
+    uint16_t free_reg;
+};
+typedef struct Compiler Compiler_t;
+
+void compile_node(Compiler_t* c, Node_t* node, uint16_t dst);
+
+const char* opcode_to_str(enum OpCode op) {
+    switch (op) {
+#define X(x) \
+    case x:  \
+        return #x;
+        OPCODES
+#undef X
+        default:
+            error("unknown opcode: %d\n", op);
+    }
+}
+
+Chunk_t* chunk_new() {
+    Chunk_t* chunk = calloc(1, sizeof(Chunk_t));
+    return chunk;
+}
+
+size_t emit(Compiler_t* c, enum OpCode op, uint16_t a, uint16_t b, uint16_t cc) {
+    Chunk_t* chunk = c->chunk;
+    if (chunk->code_count >= chunk->code_capacity) {
+        chunk->code_capacity = chunk->code_capacity ? 2 * chunk->code_capacity : 64;
+        chunk->code = realloc(chunk->code, chunk->code_capacity * sizeof(Instr_t));
+    }
+    Instr_t instr = {.op = op, .a = a, .b = b, .c = cc};
+    chunk->code[chunk->code_count] = instr;
+    return chunk->code_count++;
+}
+
+size_t emit_jump(Compiler_t* c, enum OpCode op, uint16_t a) {
+    return emit(c, op, a, 0, 0);
+}
+
+void patch_jump(Compiler_t* c, size_t pc, size_t target) {
+    c->chunk->code[pc].b = (uint16_t)(target & 0xffff);
+    c->chunk->code[pc].c = (uint16_t)(target >> 16);
+}
+
+void patch_here(Compiler_t* c, size_t pc) {
+    patch_jump(c, pc, c->chunk->code_count);
+}
+
+uint16_t add_const(Compiler_t* c, struct AstValue value) {
+    Chunk_t* chunk = c->chunk;
+    for (size_t i = 0; i < chunk->const_count; ++i) {
+        struct AstValue* k = chunk->consts + i;
+        if (k->type != value.type) {
+            continue;
+        }
+        if ((k->type == V_INT && k->int_value == value.int_value) ||
+            (k->type == V_FLOAT && memcmp(&k->float_value, &value.float_value, sizeof(double)) == 0)) {
+            return (uint16_t)i;
+        }
+    }
+
+    if (chunk->const_count > RK_MAX) {
+        error("too many constants in chunk\n");
+    }
+
+    if (chunk->const_count >= chunk->const_capacity) {
+        chunk->const_capacity = chunk->const_capacity ? 2 * chunk->const_capacity : 16;
+        chunk->consts = realloc(chunk->consts, chunk->const_capacity * sizeof(struct AstValue));
+    }
+    chunk->consts[chunk->const_count] = value;
+    return (uint16_t)chunk->const_count++;
+}
+
+uint16_t add_name(Compiler_t* c, const char* name, struct SlotRef ref) {
+    Chunk_t* chunk = c->chunk;
+    for (size_t i = 0; i < chunk->name_count; ++i) {
+        if (strcmp(chunk->names[i], name) == 0) {
+            return (uint16_t)i;
+        }
+    }
+
+    if (chunk->name_count >= UINT16_MAX) {
+        error("too many names in chunk\n");
+    }
+
+    if (chunk->name_count >= chunk->name_capacity) {
+        chunk->name_capacity = chunk->name_capacity ? 2 * chunk->name_capacity : 16;
+        chunk->names = realloc(chunk->names, chunk->name_capacity * sizeof(const char*));
+        chunk->refs = realloc(chunk->refs, chunk->name_capacity * sizeof(struct SlotRef));
+    }
+    chunk->names[chunk->name_count] = name;
+    chunk->refs[chunk->name_count] = ref;
+    return (uint16_t)chunk->name_count++;
+}
+
+size_t add_node(Compiler_t* c, Node_t* node) {
+    Chunk_t* chunk = c->chunk;
+    if (chunk->node_count >= chunk->node_capacity) {
+        chunk->node_capacity = chunk->node_capacity ? 2 * chunk->node_capacity : 16;
+        chunk->nodes = realloc(chunk->nodes, chunk->node_capacity * sizeof(Node_t*));
+    }
+    chunk->nodes[chunk->node_count] = node;
+    return chunk->node_count++;
+}
+
+uint16_t alloc_regs(Compiler_t* c, size_t count) {
+    if ((size_t)c->free_reg + count > RK_MAX) {
+        error("expression too complex: out of registers\n");
+    }
+    uint16_t reg = c->free_reg;
+    c->free_reg += count;
+    if (c->free_reg > c->chunk->reg_count) {
+        c->chunk->reg_count = c->free_reg;
+    }
+    return reg;
+}
+
+void free_regs(Compiler_t* c, uint16_t reg) {
+    c->free_reg = reg;
+}
+
+struct VarUse {
+    const char* name;
+    struct SlotRef ref;
+    bool assigned;
+    size_t weight;
+};
+
+struct VarUses {
+    size_t size;
+    size_t capacity;
+    struct VarUse* data;
+};
+
+void var_use(struct VarUses* uses, const char* name, struct SlotRef ref, bool assigned, size_t weight) {
+    for (size_t i = 0; i < uses->size; ++i) {
+        if (strcmp(uses->data[i].name, name) == 0) {
+            uses->data[i].assigned |= assigned;
+            uses->data[i].weight += weight;
+            return;
+        }
+    }
+
+    if (uses->size >= uses->capacity) {
+        uses->capacity = uses->capacity ? 2 * uses->capacity : 16;
+        uses->data = realloc(uses->data, uses->capacity * sizeof(struct VarUse));
+    }
+    struct VarUse use = {.name = name, .ref = ref, .assigned = assigned, .weight = weight};
+    uses->data[uses->size++] = use;
+}
+
+// Collects the names a chunk reads or writes itself. Function bodies get
+// their own chunk, and nodes left to the tree walker see the context instead
+// of the registers, so neither is descended into. References inside loops
+// weigh more so that they win a register when there are too many names.
+void collect_vars(struct VarUses* uses, Node_t* node, size_t weight) {
+    switch (node->type) {
+        case AST_IDENTIFIER:
+            var_use(uses, node->name, node->ref, false, weight);
+            break;
+        case AST_ASSIGNMENT: {
+            Node_t* ident = NODE(node->ident);
+            if (ident->type == AST_IDENTIFIER) {
+                var_use(uses, ident->name, ident->ref, true, weight);
+            } else {
+                var_use(uses, ident->lname, ident->lref, true, weight);
+                collect_vars(uses, NODE(ident->iexpr), weight);
+            }
+            collect_vars(uses, NODE(node->rvalue), weight);
+        } break;
+        case AST_IDX:
+            var_use(uses, node->lname, node->lref, false, weight);
+            collect_vars(uses, NODE(node->iexpr), weight);
+            break;
+        case AST_BINOP:
+            collect_vars(uses, NODE(node->lhs), weight);
+            collect_vars(uses, NODE(node->rhs), weight);
+            break;
+        case AST_UNOP:
+            collect_vars(uses, NODE(node->node), weight);
+            break;
+        case AST_PROGRAM:
+        case AST_BLOCK:
+        case AST_CASES:
+            for (size_t i = 0; i < node->stmnt_count; ++i) {
+                collect_vars(uses, CHILD(node->stmnts, i), weight);
+            }
+            break;
+        case AST_ITEMS:
+            if (node->item_count <= MAX_LIST_REGS) {
+                for (size_t i = 0; i < node->item_count; ++i) {
+                    collect_vars(uses, CHILD(node->items, i), weight);
+                }
+            }
+            break;
+        case AST_FCALL:
+            if (node->param_count <= MAX_LIST_REGS) {
+                for (size_t i = 0; i < node->param_count; ++i) {
+                    collect_vars(uses, CHILD(node->params, i), weight);
+                }
+            }
+            break;
+        case AST_FOR: {
+            size_t inner = weight < SIZE_MAX / 16 ? 16 * weight : weight;
+            collect_vars(uses, NODE(node->lexpr), weight);
+            var_use(uses, node->lvar, node->vref, true, inner);
+            collect_vars(uses, NODE(node->lbody), inner);
+        } break;
+        case AST_CASE:
+            collect_vars(uses, NODE(node->cexpr), weight);
+            collect_vars(uses, NODE(node->pred), weight);
+            break;
+        default:
+            break;
+    }
+}
+
+int var_use_cmp(const void* a, const void* b) {
+    size_t wa = ((const struct VarUse*)a)->weight;
+    size_t wb = ((const struct VarUse*)b)->weight;
+    return wa < wb ? 1 : wa > wb ? -1 : 0;
+}
+
+void promote_vars(Compiler_t* c, Node_t* root) {
+    struct VarUses uses = {};
+    collect_vars(&uses, root, 1);
+
+    if (uses.size > MAX_VARS) {
+        qsort(uses.data, uses.size, sizeof(struct VarUse), var_use_cmp);
+        uses.size = MAX_VARS;
+    }
+
+    Chunk_t* chunk = c->chunk;
+    chunk->var_count = uses.size;
+    chunk->vars = malloc(uses.size * sizeof(struct Var));
+    for (size_t i = 0; i < uses.size; ++i) {
+        struct Var var = {.name = uses.data[i].name, .ref = uses.data[i].ref, .assigned = uses.data[i].assigned};
+        chunk->vars[i] = var;
+    }
+    alloc_regs(c, uses.size);
+
+    free(uses.data);
+}
+
+// Returns the home register of a promoted variable, or NO_REG.
+uint16_t find_var(Compiler_t* c, const char* name) {
+    for (size_t i = 0; i < c->chunk->var_count; ++i) {
+        if (strcmp(c->chunk->vars[i].name, name) == 0) {
+            return (uint16_t)i;
+        }
+    }
+    return NO_REG;
+}
+
+// Returns an RK operand: literal numbers are referenced straight from the
+// constant table, promoted variables from their home register, and
+// everything else is evaluated into a fresh register.
+uint16_t compile_operand(Compiler_t* c, Node_t* node) {
+    if (node->type == AST_LITERAL && (node->value.type == V_INT || node->value.type == V_FLOAT)) {
+        return add_const(c, node->value) | RK_CONST;
+    }
+
+    if (node->type == AST_IDENTIFIER) {
+        uint16_t home = find_var(c, node->name);
+        if (home != NO_REG) {
+            return home;
+        }
+    }
+
+    uint16_t reg = alloc_regs(c, 1);
+    compile_node(c, node, reg);
+    return reg;
+}
+
+void compile_fallback(Compiler_t* c, Node_t* node, uint16_t dst) {
+    size_t idx = add_node(c, node);
+    size_t pc = emit(c, OP_EVAL, dst, 0, 0);
+    patch_jump(c, pc, idx);
+}
+
+enum OpCode binop_to_opcode(enum TokenType binop_type) {
+    switch (binop_type) {
+        case TOK_PLUS:
+            return OP_ADD;
+        case TOK_MINUS:
+            return OP_SUB;
+        case TOK_STAR:
+            return OP_MUL;
+        case TOK_FSLASH:
+            return OP_DIV;
+        case TOK_PERC:
+            return OP_MOD;
+        case TOK_POWER:
+            return OP_POW;
+        case TOK_LT:
+            return OP_LT;
+        case TOK_GT:
+            return OP_GT;
+        case TOK_LEQ:
+            return OP_LEQ;
+        case TOK_GEQ:
+            return OP_GEQ;
+        case TOK_EEQ:
+            return OP_EEQ;
+        case TOK_NEQ:
+            return OP_NEQ;
+        default:
+            error("unknown binop type: %s\n", tok_type_to_str(binop_type));
+    }
+}
+
+void compile_binop(Compiler_t* c, Node_t* node, uint16_t dst) {
+    uint16_t mark = c->free_reg;
+
+    if (node->binop_type == TOK_PIPE || node->binop_type == TOK_AMP) {
+        // the lhs is evaluated straight into dst so that the short-circuit
+        // test can leave its result there
+        enum OpCode test = node->binop_type == TOK_PIPE ? OP_TESTOR : OP_TESTAND;
+        enum OpCode op = node->binop_type == TOK_PIPE ? OP_OR : OP_AND;
+
+        compile_node(c, NODE(node->lhs), dst);
+        size_t jump = emit_jump(c, test, dst);
+        uint16_t rhs = compile_operand(c, NODE(node->rhs));
+        emit(c, op, dst, dst, rhs);
+        patch_here(c, jump);
+        free_regs(c, mark);
+        return;
+    }
+
+    uint16_t lhs = compile_operand(c, NODE(node->lhs));
+    uint16_t rhs = compile_operand(c, NODE(node->rhs));
+    emit(c, binop_to_opcode(node->binop_type), dst, lhs, rhs);
+    free_regs(c, mark);
+}
+
+void compile_unop(Compiler_t* c, Node_t* node, uint16_t dst) {
+    uint16_t mark = c->free_reg;
+    uint16_t src = compile_operand(c, NODE(node->node));
+
+    switch (node->unop_type) {
+        case TOK_MINUS:
+            emit(c, OP_NEG, dst, src, 0);
+            break;
+        case TOK_BANG:
+            emit(c, OP_NOT, dst, src, 0);
+            break;
+        case TOK_HASH:
+            emit(c, OP_LEN, dst, src, 0);
+            break;
+        default:
+            error("unknown unop type: %s\n", tok_type_to_str(node->unop_type));
+    }
+
+    free_regs(c, mark);
+}
+
+void compile_identifier(Compiler_t* c, Node_t* node, uint16_t dst) {
+    uint16_t home = find_var(c, node->name);
+    if (home == NO_REG) {
+        emit(c, OP_GETVAR, dst, add_name(c, node->name, node->ref), 0);
+    } else if (home != dst) {
+        emit(c, OP_MOVE, dst, home, 0);
+    }
+}
+
+void compile_tail(Compiler_t* c, Node_t* node, uint16_t dst);
+
+// tail: the value of the last statement is the value the chunk returns
+void compile_stmnts(Compiler_t* c, size_t stmnt_count, NodeIdx_t* stmnts, uint16_t dst, bool tail) {
+    if (stmnt_count == 0) {
+        if (dst != NO_REG) {
+            emit(c, OP_LOADNIL, dst, 0, 0);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i + 1 < stmnt_count; ++i) {
+        compile_node(c, NODE(stmnts[i]), NO_REG);
+    }
+    if (tail) {
+        compile_tail(c, NODE(stmnts[stmnt_count - 1]), dst);
+    } else {
+        compile_node(c, NODE(stmnts[stmnt_count - 1]), dst);
+    }
+}
+
+// Nodes that only write their destination after all of their operands have
+// been read, and can therefore target a variable's home register directly.
+bool writes_dst_last(Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+        case AST_UNOP:
+        case AST_ITEMS:
+        case AST_FCALL:
+            return true;
+        case AST_BINOP:
+            return node->binop_type != TOK_PIPE && node->binop_type != TOK_AMP;
+        default:
+            return false;
+    }
+}
+
+void compile_idx(Compiler_t* c, Node_t* node, uint16_t dst) {
+    uint16_t home = find_var(c, node->lname);
+    if (home == NO_REG) {
+        compile_fallback(c, node, dst);
+        return;
+    }
+
+    uint16_t mark = c->free_reg;
+    uint16_t idx = compile_operand(c, NODE(node->iexpr));
+    emit(c, OP_GETIDX, dst, home, idx);
+    free_regs(c, mark);
+}
+
+// name[i] = value and name[i] op= value, with the value evaluated before
+// the index as in the tree walker.
+void compile_idx_assignment(Compiler_t* c, Node_t* node, uint16_t dst) {
+    Node_t* ident = NODE(node->ident);
+    uint16_t home = find_var(c, ident->lname);
+    if (home == NO_REG) {
+        compile_fallback(c, node, dst != NO_REG ? dst : alloc_regs(c, 1));
+        return;
+    }
+
+    uint16_t mark = c->free_reg;
+    uint16_t value = compile_operand(c, NODE(node->rvalue));
+    uint16_t idx = compile_operand(c, NODE(ident->iexpr));
+
+    if (node->assign_op != TOK_EQ) {
+        uint16_t elem = alloc_regs(c, 1);
+        emit(c, OP_GETIDX, elem, home, idx);
+        emit(c, binop_to_opcode(node->assign_op), elem, elem, value);
+        value = elem;
+    }
+
+    emit(c, OP_SETIDX, home, idx, value);
+    if (dst != NO_REG) {
+        emit(c, OP_MOVE, dst, value, 0);
+    }
+    free_regs(c, mark);
+}
+
+void compile_assignment(Compiler_t* c, Node_t* node, uint16_t dst) {
+    Node_t* ident = NODE(node->ident);
+    Node_t* rvalue = NODE(node->rvalue);
+    if (ident->type == AST_IDX) {
+        compile_idx_assignment(c, node, dst);
+        return;
+    }
+    if (ident->type != AST_IDENTIFIER) {
+        compile_fallback(c, node, dst != NO_REG ? dst : alloc_regs(c, 1));
+        return;
+    }
+
+    uint16_t mark = c->free_reg;
+    uint16_t home = find_var(c, ident->name);
+
+    if (home == NO_REG && node->assign_op != TOK_EQ) {
+        compile_fallback(c, node, dst != NO_REG ? dst : alloc_regs(c, 1));
+        return;
+    }
+
+    if (home == NO_REG) {
+        uint16_t src = dst != NO_REG ? dst : alloc_regs(c, 1);
+        compile_node(c, rvalue, src);
+        emit(c, OP_SETVAR, src, add_name(c, ident->name, ident->ref), 0);
+    } else {
+        if (node->assign_op != TOK_EQ) {
+            uint16_t rhs = compile_operand(c, rvalue);
+            emit(c, OP_CHECKVAR, home, 0, 0);
+            emit(c, binop_to_opcode(node->assign_op), home, home, rhs);
+        } else if (writes_dst_last(rvalue)) {
+            compile_node(c, rvalue, home);
+        } else {
+            uint16_t tmp = alloc_regs(c, 1);
+            compile_node(c, rvalue, tmp);
+            emit(c, OP_MOVE, home, tmp, 0);
+        }
+
+        if (dst != NO_REG && dst != home) {
+            emit(c, OP_MOVE, dst, home, 0);
+        }
+    }
+
+    free_regs(c, mark);
+}
+
+void compile_items(Compiler_t* c, Node_t* node, uint16_t dst) {
+    if (node->item_count > MAX_LIST_REGS) {
+        compile_fallback(c, node, dst);
+        return;
+    }
+
+    uint16_t mark = c->free_reg;
+    uint16_t base = alloc_regs(c, node->item_count);
+    for (size_t i = 0; i < node->item_count; ++i) {
+        compile_node(c, CHILD(node->items, i), base + i);
+    }
+    emit(c, OP_NEWLIST, dst, base, node->item_count);
+    free_regs(c, mark);
+}
+
+// op: OP_CALL, or OP_TAILCALL for a call in tail position
+void compile_fcall(Compiler_t* c, Node_t* node, uint16_t dst, enum OpCode op) {
+    if (node->param_count > MAX_LIST_REGS) {
+        compile_fallback(c, node, dst);
+        return;
+    }
+
+    uint16_t mark = c->free_reg;
+    uint16_t base = alloc_regs(c, node->param_count > 0 ? node->param_count : 1);
+    for (size_t i = 0; i < node->param_count; ++i) {
+        compile_node(c, CHILD(node->params, i), base + i);
+    }
+    emit(c, op, base, add_name(c, node->fname, node->fref), node->param_count);
+    if (base != dst) {
+        emit(c, OP_MOVE, dst, base, 0);
+    }
+    free_regs(c, mark);
+}
+
+// Loop state lives in five consecutive registers: the iterable, the
+// iteration mode chosen by OP_FORPREP, a raw counter, the register that
+// receives each element and a scratch element register used when the loop
+// variable is not promoted. The condition sits at the bottom of the loop so
+// that each iteration costs a single OP_FORLOOP.
+void compile_for(Compiler_t* c, Node_t* node, uint16_t dst) {
+    uint16_t mark = c->free_reg;
+    uint16_t it = alloc_regs(c, 5);
+    uint16_t home = find_var(c, node->lvar);
+
+    compile_node(c, NODE(node->lexpr), it);
+    if (dst != NO_REG) {
+        emit(c, OP_LOADNIL, dst, 0, 0);
+    }
+    emit(c, OP_FORPREP, it, home != NO_REG ? home : it + 4, 0);
+    size_t test = emit_jump(c, OP_JMP, 0);
+
+    size_t body = c->chunk->code_count;
+    if (home == NO_REG) {
+        emit(c, OP_SETVAR, it + 4, add_name(c, node->lvar, node->vref), 0);
+    }
+    compile_node(c, NODE(node->lbody), dst);
+
+    patch_here(c, test);
+    size_t loop = emit_jump(c, OP_FORLOOP, it);
+    patch_jump(c, loop, body);
+
+    free_regs(c, mark);
+}
+
+void compile_case(Compiler_t* c, Node_t* node, uint16_t dst, bool tail) {
+    uint16_t mark = c->free_reg;
+    uint16_t pred = alloc_regs(c, 1);
+
+    compile_node(c, NODE(node->pred), pred);
+    size_t skip = emit_jump(c, OP_JMPF, pred);
+    free_regs(c, mark);
+
+    if (tail) {
+        compile_tail(c, NODE(node->cexpr), dst);
+    } else {
+        compile_node(c, NODE(node->cexpr), dst);
+    }
+
+    if (dst == NO_REG) {
+        patch_here(c, skip);
+        return;
+    }
+
+    size_t end = emit_jump(c, OP_JMP, 0);
+    patch_here(c, skip);
+    emit(c, OP_LOADNIL, dst, 0, 0);
+    patch_here(c, end);
+}
+
+// Only the last case is in tail position: a call in any other might yield
+// nil and go on to the next case.
+void compile_cases(Compiler_t* c, Node_t* node, uint16_t dst, bool tail) {
+    PtrArr exits = {};
+
+    for (size_t i = 0; i < node->stmnt_count; ++i) {
+        if (tail && i + 1 == node->stmnt_count) {
+            compile_tail(c, CHILD(node->stmnts, i), dst);
+            break;
+        }
+        compile_node(c, CHILD(node->stmnts, i), dst);
+        ptrarr_append(&exits, (void*)emit_jump(c, OP_JMPNN, dst));
+    }
+
+    for (size_t i = 0; i < exits.size; ++i) {
+        patch_here(c, (size_t)exits.data[i]);
+    }
+    free(exits.data);
+}
+
+void compile_node(Compiler_t* c, Node_t* node, uint16_t dst) {
+    uint16_t mark = c->free_reg;
+
+    // only statements know how to drop their value, everything else gets a
+    // scratch register
+    if (dst == NO_REG) {
+        switch (node->type) {
+            case AST_LITERAL:
+            case AST_IDENTIFIER:
+                return;
+            case AST_ASSIGNMENT:
+            case AST_PROGRAM:
+            case AST_BLOCK:
+            case AST_FOR:
+            case AST_CASE:
+                break;
+            default:
+                dst = alloc_regs(c, 1);
+                break;
+        }
+    }
+
+    switch (node->type) {
+        case AST_LITERAL:
+            if (node->value.type == V_NIL) {
+                emit(c, OP_LOADNIL, dst, 0, 0);
+            } else {
+                emit(c, OP_LOADK, dst, add_const(c, node->value), 0);
+            }
+            break;
+        case AST_BINOP:
+            compile_binop(c, node, dst);
+            break;
+        case AST_UNOP:
+            compile_unop(c, node, dst);
+            break;
+        case AST_IDENTIFIER:
+            compile_identifier(c, node, dst);
+            break;
+        case AST_ASSIGNMENT:
+            compile_assignment(c, node, dst);
+            break;
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            compile_stmnts(c, node->stmnt_count, LIST(node->stmnts), dst, false);
+            break;
+        case AST_ITEMS:
+            compile_items(c, node, dst);
+            break;
+        case AST_FCALL:
+            compile_fcall(c, node, dst, OP_CALL);
+            break;
+        case AST_FOR:
+            compile_for(c, node, dst);
+            break;
+        case AST_CASE:
+            compile_case(c, node, dst, false);
+            break;
+        case AST_CASES:
+            compile_cases(c, node, dst, false);
+            break;
+        case AST_IDX:
+            compile_idx(c, node, dst);
+            break;
+        case AST_FDEF:
+        case AST_RANGE:
+        case AST_CMD:
+            compile_fallback(c, node, dst);
+            break;
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+
+    free_regs(c, mark);
+}
+
+// Compiles node, whose value the chunk returns, so that the call its value
+// comes from, if any, is a tail call.
+void compile_tail(Compiler_t* c, Node_t* node, uint16_t dst) {
+    switch (node->type) {
+        case AST_BLOCK:
+            compile_stmnts(c, node->stmnt_count, LIST(node->stmnts), dst, true);
+            break;
+        case AST_CASE:
+            compile_case(c, node, dst, true);
+            break;
+        case AST_CASES:
+            compile_cases(c, node, dst, true);
+            break;
+        case AST_FCALL:
+            compile_fcall(c, node, dst, OP_TAILCALL);
+            break;
+        default:
+            compile_node(c, node, dst);
+            break;
+    }
+}
+
+Chunk_t* compile(Node_t* root, bool function) {
+    Compiler_t c = {.chunk = chunk_new(), .free_reg = 0};
+
+    promote_vars(&c, root);
+
+    uint16_t dst = alloc_regs(&c, 1);
+    if (function) {
+        compile_tail(&c, root, dst);
+    } else {
+        compile_node(&c, root, dst);
+    }
+    emit(&c, OP_RET, dst, 0, 0);
+
+    return c.chunk;
+}
+
+void print_operand(uint16_t operand) {
+    if (operand & RK_CONST) {
+        printf(" k%u", operand & RK_MAX);
+    } else {
+        printf(" r%u", operand);
+    }
+}
+
+void print_ref(struct SlotRef ref) {
+    if (ref.slot < 0) {
+        printf(" (dynamic)");
+    } else {
+        printf(" @%d:%d", ref.depth, ref.slot);
+    }
+}
+
+void disassemble(Chunk_t* chunk) {
+    for (size_t i = 0; i < chunk->var_count; ++i) {
+        printf("r%zu = %s", i, chunk->vars[i].name);
+        print_ref(chunk->vars[i].ref);
+        printf("%s\n", chunk->vars[i].assigned ? "" : " (read only)");
+    }
+
+    for (size_t pc = 0; pc < chunk->code_count; ++pc) {
+        Instr_t instr = chunk->code[pc];
+        printf("%04zu %-12s", pc, opcode_to_str(instr.op));
+        switch (instr.op) {
+            case OP_LOADK: {
+                char* value = ast_value_to_str(chunk->consts + instr.b);
+                printf(" r%u %s", instr.a, value);
+                free(value);
+            } break;
+            case OP_GETVAR:
+            case OP_SETVAR:
+                printf(" r%u %s", instr.a, chunk->names[instr.b]);
+                print_ref(chunk->refs[instr.b]);
+                break;
+            case OP_CALL:
+            case OP_TAILCALL:
+                printf(" r%u %s/%u", instr.a, chunk->names[instr.b], instr.c);
+                print_ref(chunk->refs[instr.b]);
+                break;
+            case OP_NEWLIST:
+                printf(" r%u r%u #%u", instr.a, instr.b, instr.c);
+                break;
+            case OP_JMP:
+                printf(" -> %04u", INSTR_TARGET(instr));
+                break;
+            case OP_JMPF:
+            case OP_JMPNN:
+            case OP_TESTOR:
+            case OP_TESTAND:
+            case OP_FORLOOP:
+                printf(" r%u -> %04u", instr.a, INSTR_TARGET(instr));
+                break;
+            case OP_EVAL:
+                printf(" r%u <%s>", instr.a, node_type_to_str(chunk->nodes[INSTR_TARGET(instr)]->type));
+                break;
+            case OP_FORPREP:
+                printf(" r%u r%u", instr.a, instr.b);
+                break;
+            case OP_MOVE:
+            case OP_NEG:
+            case OP_NOT:
+            case OP_LEN:
+                printf(" r%u", instr.a);
+                print_operand(instr.b);
+                break;
+            case OP_LOADNIL:
+            case OP_CHECKVAR:
+            case OP_RET:
+                printf(" r%u", instr.a);
+                break;
+            case OP_NOP:
+                break;
+            default:
+                printf(" r%u", instr.a);
+                print_operand(instr.b);
+                print_operand(instr.c);
+                break;
+        }
+        printf("\n");
+    }
+}
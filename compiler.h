@@ -0,0 +1,134 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stdint.h>
+#include "parser.h"
+
+// a: destination register
+// b, c: register or constant (RK) operands unless noted otherwise
+// jump targets are stored as a 32-bit absolute pc split across b (low) and c (high)
+//
+// Variables referenced by a chunk are promoted to the first registers of its
+// frame. They are loaded from the context on entry and written back before
+// anything that can observe the context (scripted calls and OP_EVAL) runs.
+// Names that did not fit in the register file go through OP_GETVAR/OP_SETVAR.
+//
+// Lists in promoted variables are indexed in their home registers: OP_GETIDX
+// reads R(b)[RK(c)] and OP_SETIDX writes RK(c) to R(a)[RK(b)], on a copy of
+// the list unless nothing else refers to it. An arithmetic op whose
+// destination is the home register of its lhs, which is what x += y
+// compiles to, updates such a list in place under the same condition.
+// OP_CHECKVAR a, put before it, raises the tree walker's error for a name
+// that holds nothing.
+//
+// OP_CALL a b c calls the function named b with the c arguments from R(a) up
+// and leaves its value in R(a). OP_TAILCALL does the same for a call whose
+// value the chunk returns, but a scripted function takes over the frame.
+#define OPCODES     \
+    X(OP_NOP)       \
+    X(OP_LOADK)     \
+    X(OP_LOADNIL)   \
+    X(OP_MOVE)      \
+    X(OP_GETVAR)    \
+    X(OP_SETVAR)    \
+    X(OP_CHECKVAR)  \
+    X(OP_ADD)       \
+    X(OP_SUB)       \
+    X(OP_MUL)       \
+    X(OP_DIV)       \
+    X(OP_MOD)       \
+    X(OP_POW)       \
+    X(OP_LT)        \
+    X(OP_GT)        \
+    X(OP_LEQ)       \
+    X(OP_GEQ)       \
+    X(OP_EEQ)       \
+    X(OP_NEQ)       \
+    X(OP_TESTOR)    \
+    X(OP_TESTAND)   \
+    X(OP_OR)        \
+    X(OP_AND)       \
+    X(OP_NEG)       \
+    X(OP_NOT)       \
+    X(OP_LEN)       \
+    X(OP_GETIDX)    \
+    X(OP_SETIDX)    \
+    X(OP_NEWLIST)   \
+    X(OP_CALL)      \
+    X(OP_TAILCALL)  \
+    X(OP_JMP)       \
+    X(OP_JMPF)      \
+    X(OP_JMPNN)     \
+    X(OP_FORPREP)   \
+    X(OP_FORLOOP)   \
+    X(OP_EVAL)      \
+    X(OP_RET)
+
+enum OpCode {
+#define X(x) x,
+    OPCODES
+#undef X
+};
+
+// operands with this bit set index the constant table instead of the register file
+#define RK_CONST 0x8000
+#define RK_MAX 0x7fff
+
+// destination for statements whose value is never read
+#define NO_REG 0xffff
+
+// upper bound on the number of variables promoted to registers per chunk
+#define MAX_VARS 256
+
+struct Instr {
+    uint8_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+#define INSTR_TARGET(instr) ((uint32_t)(instr).b | ((uint32_t)(instr).c << 16))
+
+struct Var {
+    const char* name;
+    struct SlotRef ref;
+    bool assigned;
+};
+
+struct Chunk {
+    size_t code_count;
+    size_t code_capacity;
+    struct Instr* code;
+
+    size_t const_count;
+    size_t const_capacity;
+    struct AstValue* consts;
+
+    // names and where the resolver placed them, indexed alike
+    size_t name_count;
+    size_t name_capacity;
+    const char** names;
+    struct SlotRef* refs;
+
+    // nodes that are not compiled but handed back to the tree walker by OP_EVAL
+    size_t node_count;
+    size_t node_capacity;
+    struct AstNode** nodes;
+
+    // variable i lives in register i
+    size_t var_count;
+    struct Var* vars;
+
+    size_t reg_count;
+};
+
+const char* opcode_to_str(enum OpCode op);
+
+// function tells that root is the body of a function, where calls in tail
+// position compile to OP_TAILCALL.
+struct Chunk* compile(struct AstNode* root, bool function);
+void disassemble(struct Chunk* chunk);
+
+#endif
+
+// vim: ft=c
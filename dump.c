@@ -0,0 +1,254 @@
+#include "dump.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "heap.h"
+#include "map.h"
+#include "parser.h"
+#include "utils.h"
+
+#define DUMP_MAGIC "ncdump1\n"  // names the format and its version
+#define DUMP_MAX_DEPTH 1024     // lists in lists that a file may hold
+
+static_assert(sizeof(long long) == 8 && sizeof(double) == 8, "packed lists are stored as 8-byte words");
+
+// every value starts with its type and one word: the number itself, or the
+// length of what follows
+struct DumpValue {
+    uint64_t type;
+    uint64_t word;
+};
+
+const char zeros[8] = {};
+
+void put_padded(FILE* out, const void* data, size_t n) {
+    fwrite(data, 1, n, out);
+    fwrite(zeros, 1, (8 - n % 8) % 8, out);
+}
+
+void put_value(FILE* out, struct AstValue value, size_t depth) {
+    if (depth > DUMP_MAX_DEPTH) {
+        eval_error("cannot dump lists nested more than %d deep\n", DUMP_MAX_DEPTH);
+    }
+
+    struct DumpValue head = {.type = value.type};
+    switch (value.type) {
+        case V_NIL:
+        case V_INF:
+            fwrite(&head, sizeof(head), 1, out);
+            break;
+        case V_INT:
+        case V_FLOAT:
+            memcpy(&head.word, &value.int_value, sizeof(head.word));
+            fwrite(&head, sizeof(head), 1, out);
+            break;
+        case V_STRING:
+            head.word = strlen(value.string_value);
+            fwrite(&head, sizeof(head), 1, out);
+            put_padded(out, value.string_value, head.word + 1);
+            break;
+        case V_INT_ARRAY:
+        case V_FLOAT_ARRAY:
+            head.word = value.list_size;
+            fwrite(&head, sizeof(head), 1, out);
+            fwrite(value.list_value, 8, value.list_size, out);
+            break;
+        case V_LIST:
+            head.word = value.list_size;
+            fwrite(&head, sizeof(head), 1, out);
+            for (size_t i = 0; i < value.list_size; ++i) {
+                put_value(out, value.list_value[i], depth + 1);
+            }
+            break;
+        case V_RANGE:
+            head.word = value.range_value->length;
+            fwrite(&head, sizeof(head), 1, out);
+            put_value(out, value.range_value->start, depth + 1);
+            put_value(out, value.range_value->stop, depth + 1);
+            put_value(out, value.range_value->step, depth + 1);
+            break;
+        default:
+            eval_error("cannot dump value type: %s\n", value_type_to_str(value.type));
+    }
+}
+
+void dump_write(const char* path, size_t count, const struct DumpEntry* entries) {
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        eval_error("could not open '%s' for writing\n", path);
+    }
+
+    uint64_t n = count;
+    fwrite(DUMP_MAGIC, 1, 8, out);
+    fwrite(&n, sizeof(n), 1, out);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t length = strlen(entries[i].name);
+        fwrite(&length, sizeof(length), 1, out);
+        put_padded(out, entries[i].name, length + 1);
+        put_value(out, entries[i].value, 0);
+    }
+
+    if (ferror(out) || fclose(out) != 0) {
+        eval_error("could not write '%s'\n", path);
+    }
+}
+
+struct Reader {
+    const char* path;
+    char* data;
+    size_t size;
+    size_t pos;
+};
+
+// the next n bytes, with pos moved past their padding
+void* take(struct Reader* reader, size_t n) {
+    size_t left = reader->size - reader->pos;
+    if (n > left || n + (8 - n % 8) % 8 > left) {
+        eval_error("'%s' is truncated\n", reader->path);
+    }
+
+    void* p = reader->data + reader->pos;
+    reader->pos += n + (8 - n % 8) % 8;
+    return p;
+}
+
+// a count of 8-byte words, checked against what is left of the file
+size_t take_count(struct Reader* reader, uint64_t count) {
+    if (count > (reader->size - reader->pos) / 8) {
+        eval_error("'%s' is truncated\n", reader->path);
+    }
+    return count;
+}
+
+// a string of length bytes and its terminating zero
+const char* take_string(struct Reader* reader, uint64_t length) {
+    if (length >= reader->size) {
+        eval_error("'%s' is truncated\n", reader->path);
+    }
+
+    const char* str = take(reader, length + 1);
+    if (str[length] != '\0') {
+        eval_error("'%s' is corrupt\n", reader->path);
+    }
+    return str;
+}
+
+// Whether a loaded range is one the range constructors could have made:
+// numbers of one type, a stop of infinity for an endless range alone, and
+// for ints a stop that start reaches in length - 1 steps.
+bool range_valid(const struct RangeValue* range) {
+    enum ValueType type = range->start.type;
+    if ((type != V_INT && type != V_FLOAT) || range->step.type != type) {
+        return false;
+    }
+    if (range->length == UNDEF_SIZE) {
+        return range->stop.type == V_INF;
+    }
+    if (range->stop.type != type) {
+        return false;
+    }
+    if (type != V_INT || range->length == 0) {
+        return true;
+    }
+
+    long long last;
+    return range->length - 1 <= (size_t)LLONG_MAX &&
+           !__builtin_mul_overflow((long long)(range->length - 1), range->step.int_value, &last) &&
+           !__builtin_add_overflow(range->start.int_value, last, &last) && last == range->stop.int_value;
+}
+
+struct AstValue take_value(struct Reader* reader, size_t depth) {
+    if (depth > DUMP_MAX_DEPTH) {
+        eval_error("'%s' nests lists too deeply\n", reader->path);
+    }
+
+    struct DumpValue head;
+    memcpy(&head, take(reader, sizeof(head)), sizeof(head));
+
+    struct AstValue value = {.type = (enum ValueType)head.type};
+    switch (head.type) {
+        case V_NIL:
+        case V_INF:
+            value.int_value = value.type == V_INF;
+            break;
+        case V_INT:
+        case V_FLOAT:
+            memcpy(&value.int_value, &head.word, sizeof(head.word));
+            break;
+        case V_STRING:
+            value.string_value = take_string(reader, head.word);
+            break;
+        case V_INT_ARRAY:
+        case V_FLOAT_ARRAY:
+            value.list_size = take_count(reader, head.word);
+            value.list_value = take(reader, value.list_size * 8);
+            break;
+        case V_LIST:
+            // tagged values hold pointers, so they are built anew
+            value.list_size = take_count(reader, head.word);
+            value.counted = true;
+            value.list_value = heap_alloc(value.list_size * sizeof(struct AstValue));
+            heap_set_values(value.list_value, value.list_size);
+            for (size_t i = 0; i < value.list_size; ++i) {
+                value.list_value[i] = take_value(reader, depth + 1);
+            }
+            break;
+        case V_RANGE:
+            value.counted = true;
+            value.range_value = heap_alloc(sizeof(struct RangeValue));
+            value.range_value->length = head.word;
+            value.range_value->start = take_value(reader, depth + 1);
+            value.range_value->stop = take_value(reader, depth + 1);
+            value.range_value->step = take_value(reader, depth + 1);
+            if (!range_valid(value.range_value)) {
+                eval_error("'%s' is corrupt\n", reader->path);
+            }
+            break;
+        default:
+            eval_error("'%s' is corrupt\n", reader->path);
+    }
+    return value;
+}
+
+size_t dump_read(const char* path, struct DumpEntry** entries) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        eval_error("could not open '%s'\n", path);
+    }
+
+    struct Reader reader = {.path = path, .size = st.st_size};
+    if (reader.size < 16) {
+        eval_error("'%s' is not a dump\n", path);
+    }
+
+    // private, so that assigning to an element copies its page instead of
+    // changing the file
+    reader.data = mmap(NULL, reader.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (reader.data == MAP_FAILED) {
+        eval_error("could not map '%s'\n", path);
+    }
+
+    if (memcmp(take(&reader, 8), DUMP_MAGIC, 8) != 0) {
+        eval_error("'%s' is not a dump\n", path);
+    }
+
+    uint64_t count;
+    memcpy(&count, take(&reader, 8), 8);
+    *entries = malloc(take_count(&reader, count) * sizeof(struct DumpEntry));
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t length;
+        memcpy(&length, take(&reader, 8), 8);
+        (*entries)[i].name = intern_n(take_string(&reader, length), length);
+        (*entries)[i].value = take_value(&reader, 0);
+    }
+
+    return count;
+}
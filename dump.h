@@ -0,0 +1,27 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "nc.h"
+
+// Named values in a binary file that loads back without parsing or copying.
+// After a small header every name is followed by its value, and the
+// elements of packed lists are stored as raw 8-byte words, aligned like
+// everything else in the file to 8 bytes. Reading maps the file into
+// memory, and packed lists and strings point straight into the mapping, so
+// pages are read only once they are touched. The file uses the byte order
+// of the machine that wrote it.
+struct DumpEntry {
+    const char* name;
+    struct AstValue value;
+};
+
+// Writes the entries to path. Functions cannot be written.
+void dump_write(const char* path, size_t count, const struct DumpEntry* entries);
+
+// Maps path and returns its entries in a new array, owning their values.
+// The mapping stays for the rest of the run.
+size_t dump_read(const char* path, struct DumpEntry** entries);
+
+#endif
+
+// vim: ft=c
@@ -4,8 +4,15 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include "array.h"
+#include "dump.h"
+#include "heap.h"
 #include "lexer.h"
+#include "memo.h"
+#include "pool.h"
+#include "resolver.h"
 #include "utils.h"
+#include "writer.h"
 #include "nc.h"
 
 typedef enum TokenType Binop_t;
@@ -14,40 +21,45 @@ typedef struct AstNode Node_t;
 typedef struct Context Context_t;
 typedef struct RangeValue Range_t;
 typedef struct EvalFunc EvalFunc_t;
-typedef Value_t (*Cmd_t)(Context_t*, size_t, Node_t**);
+typedef Value_t (*Cmd_t)(Context_t*, size_t, NodeIdx_t*);
 
 const Value_t NIL = {.type = V_NIL};
 const Value_t INF = {.type = V_INF, .int_value = 1};
 const Value_t TRUE = {.type = V_INT, .int_value = 1};
 const Value_t FALSE = {.type = V_INT, .int_value = 0};
 
-Value_t range_next(Range_t*);
+// What a slot holds until it is first assigned: a nil that reads through to
+// the enclosing contexts, where a slot assigned nil reads as nil.
+char unset_mark;
+const Value_t UNSET = {.type = V_NIL, .data = &unset_mark};
 
-Value_t cmd_print(Context_t* context, size_t nargs, Node_t** args) {
+bool is_unset(Value_t value) {
+    return value.type == V_NIL && value.data == &unset_mark;
+}
+
+
+Value_t cmd_print(Context_t* context, size_t nargs, NodeIdx_t* args) {
     for (size_t i = 0; i < nargs; ++i) {
-        Value_t value = eval(args[i], context);
+        Value_t value = eval(NODE(args[i]), context);
+        struct Writer* out = writer_acquire_stdout();
+        writer_put(out, " ", i > 0 ? 1 : 0);
         if (value.type == V_RANGE) {
+            struct RangeCursor cursor = range_cursor(value.range_value);
+            writer_put(out, "[", 1);
             bool first = true;
-            Range_t* range = value.range_value;
-            printf("[");
-            for (Value_t val = range_next(range); !range->done; val = range_next(range)) {
-                if (!first) {
-                    printf(", ");
-                }
-                const char* out = ast_value_to_str(&val);
-                printf("%s", out);
-                first = false;
+            for (Value_t val; range_next(&cursor, &val); first = false) {
+                writer_put(out, ", ", first ? 0 : 2);
+                writer_value(out, val);
             }
-            printf("]");
+            writer_put(out, "]", 1);
         } else {
-            if (i > 0) {
-                printf(" ");
-            }
-            const char* out = ast_value_to_str(&value);
-            printf("%s", out);
+            writer_value(out, value);
         }
+        writer_release_stdout(out);
     }
-    printf("\n");
+    struct Writer* out = writer_acquire_stdout();
+    writer_put(out, "\n", 1);
+    writer_release_stdout(out);
 
     return NIL;
 };
@@ -71,20 +83,96 @@ EvalFunc_t* evalfunc_new(Context_t* context, size_t param_count, const char** pa
     ef->params = params;
     ef->param_count = param_count;
     ef->body = body;
+    ef->scope = NULL;
     ef->func = func;
+    ef->pure = false;
+    ef->chunk = NULL;
+    ef->memo = NULL;
 
     return ef;
 }
 
-Value_t cmd_load(Context_t* context, size_t nargs, Node_t** args) {
+Value_t eval_path(Context_t* context, Node_t* arg) {
+    Value_t path = eval(arg, context);
+    if (path.type != V_STRING) {
+        eval_error("expected a file name but got: %s\n", value_type_to_str(path.type));
+    }
+    return path;
+}
+
+// dump name... "file" writes the values of the names to file, which load
+// "file" binds again.
+Value_t cmd_dump(Context_t* context, size_t nargs, NodeIdx_t* args) {
+    if (nargs < 2) {
+        eval_error("expected names and a file name but got %zu arguments\n", nargs);
+    }
+
+    struct DumpEntry* entries = malloc((nargs - 1) * sizeof(struct DumpEntry));
+    for (size_t i = 0; i + 1 < nargs; ++i) {
+        Node_t* arg = NODE(args[i]);
+        if (arg->type != AST_IDENTIFIER) {
+            eval_error("expected arg to be of type %s but got: %s\n", node_type_to_str(AST_IDENTIFIER),
+                       node_type_to_str(arg->type));
+        }
+        entries[i].name = arg->name;
+        entries[i].value = get_ref(context, arg->ref, arg->name);
+        if (entries[i].value.type == V_NIL) {
+            eval_error("did not find name in current context: %s\n", arg->name);
+        }
+    }
+
+    dump_write(eval_path(context, NODE(args[nargs - 1])).string_value, nargs - 1, entries);
+    free(entries);
+    return NIL;
+}
+
+// write "file" dumps every variable of the current context, functions aside,
+// for load "file" to restore.
+Value_t cmd_write(Context_t* context, size_t nargs, NodeIdx_t* args) {
     check_nargs(1);
 
-    if (args[0]->type != AST_IDENTIFIER) {
-        eval_error("expected arg to be of type %s but got: %s\n", node_type_to_str(AST_IDENTIFIER),
-                   node_type_to_str(args[0]->type));
+    size_t slot_count = context->scope != NULL ? context->scope->slot_count : 0;
+    size_t item_count;
+    struct Item* items = map_items(&context->map, &item_count);
+
+    struct DumpEntry* entries = malloc((slot_count + item_count) * sizeof(struct DumpEntry));
+    size_t count = 0;
+    for (size_t i = 0; i < slot_count; ++i) {
+        Value_t value = context->slots[i];
+        // the inliner's temporaries are not the program's
+        if (value.type != V_NIL && value.type != V_CALLABLE && context->scope->names[i][0] != '$') {
+            entries[count++] = (struct DumpEntry){.name = context->scope->names[i], .value = value};
+        }
     }
+    for (size_t i = 0; i < item_count; ++i) {
+        if (items[i].key != NULL && items[i].value.type != V_NIL && items[i].value.type != V_CALLABLE) {
+            entries[count++] = (struct DumpEntry){.name = items[i].key, .value = items[i].value};
+        }
+    }
+
+    dump_write(eval_path(context, NODE(args[0])).string_value, count, entries);
+    free(entries);
+    return NIL;
+}
+
+// load name loads the plugin ./plug/name.so, load "file" the values of a
+// dump.
+Value_t cmd_load(Context_t* context, size_t nargs, NodeIdx_t* args) {
+    check_nargs(1);
 
-    const char* name = args[0]->name;
+    Node_t* arg = NODE(args[0]);
+    if (arg->type != AST_IDENTIFIER) {
+        struct DumpEntry* entries;
+        size_t count = dump_read(eval_path(context, arg).string_value, &entries);
+        for (size_t i = 0; i < count; ++i) {
+            set_symbol(context, entries[i].name, entries[i].value);
+            value_release(entries[i].value);
+        }
+        free(entries);
+        return NIL;
+    }
+
+    const char* name = arg->name;
     char filename[256];
     sprintf(filename, "./plug/%s.so", name);
 
@@ -132,6 +220,350 @@ Value_t cmd_load(Context_t* context, size_t nargs, Node_t** args) {
     return NIL;
 };
 
+// memo on and memo off switch caching of pure functions on and off, memo
+// name on and memo name off for the function name alone.
+Value_t cmd_memo(Context_t* context, size_t nargs, NodeIdx_t* args) {
+    if (nargs != 1 && nargs != 2) {
+        eval_error("expected on or off, and optionally a function before it, but got %zu arguments\n", nargs);
+    }
+
+    Node_t* arg = NODE(args[nargs - 1]);
+    bool on = arg->type == AST_IDENTIFIER && strcmp(arg->name, "on") == 0;
+    if (!on && (arg->type != AST_IDENTIFIER || strcmp(arg->name, "off") != 0)) {
+        eval_error("expected on or off but got: %s\n", node_type_to_str(arg->type));
+    }
+    if (nargs == 1) {
+        memo_use(on);
+        return NIL;
+    }
+
+    Node_t* name = NODE(args[0]);
+    if (name->type != AST_IDENTIFIER) {
+        eval_error("expected arg to be of type %s but got: %s\n", node_type_to_str(AST_IDENTIFIER),
+                   node_type_to_str(name->type));
+    }
+    Value_t callable = get_ref(context, name->ref, name->name);
+    if (callable.type != V_CALLABLE || ((EvalFunc_t*)callable.data)->memo == NULL) {
+        eval_error("not a scripted function: %s\n", name->name);
+    }
+    struct Memo* memo = ((EvalFunc_t*)callable.data)->memo;
+    __atomic_store_n(&memo->off, !on, __ATOMIC_RELAXED);
+    return NIL;
+}
+
+double as_float(Value_t value) {
+    return nc_as_float(value);
+}
+
+Value_t make_int(long long x) {
+    Value_t value = NC_INT(x);
+    return value;
+}
+
+Value_t make_float(double x) {
+    Value_t value = NC_FLOAT(x);
+    return value;
+}
+
+// Running sum or product of the numbers pushed into it. Ints are kept
+// apart, wrapping around like the operators do, and floats are summed with
+// Kahan's compensation.
+struct Reduction {
+    bool prod;
+    bool floats;  // a float was pushed, so the result is one
+    unsigned long long ints;
+    double total;
+    double error;
+};
+
+struct Reduction reduction(bool prod) {
+    struct Reduction r = {.prod = prod, .ints = prod ? 1 : 0, .total = prod ? 1.0 : 0.0};
+    return r;
+}
+
+void reduce_float(struct Reduction* r, double x) {
+    r->floats = true;
+    if (r->prod) {
+        r->total *= x;
+        return;
+    }
+
+    double y = x - r->error;
+    double t = r->total + y;
+    r->error = (t - r->total) - y;
+    r->total = t;
+}
+
+// Lists and ranges are reduced element by element, packed lists in parallel
+// chunks and ranges in closed form where possible. The elements of a list
+// must be numbers.
+void reduce_push(struct Reduction* r, Value_t value) {
+    Value_t partial;
+    switch (value.type) {
+        case V_INT:
+            r->ints = r->prod ? r->ints * (unsigned long long)value.int_value
+                              : r->ints + (unsigned long long)value.int_value;
+            break;
+        case V_FLOAT:
+            reduce_float(r, value.float_value);
+            break;
+        case V_INT_ARRAY:
+        case V_FLOAT_ARRAY:
+            array_reduce(r->prod ? ARRAY_MUL : ARRAY_ADD, value, &partial);
+            reduce_push(r, partial);
+            break;
+        case V_LIST:
+            for (size_t i = 0; i < value.list_size; ++i) {
+                Value_t elem = list_get(value, i);
+                if (elem.type != V_INT && elem.type != V_FLOAT) {
+                    eval_error("cannot %s list element type: %s\n", r->prod ? "multiply" : "sum",
+                               value_type_to_str(elem.type));
+                }
+                reduce_push(r, elem);
+            }
+            break;
+        case V_RANGE: {
+            if (!r->prod) {
+                reduce_push(r, range_sum(value.range_value));
+                break;
+            }
+            if (value.range_value->length == UNDEF_SIZE) {
+                eval_error("cannot multiply infinite range\n");
+            }
+            struct RangeCursor cursor = range_cursor(value.range_value);
+            for (Value_t x; range_next(&cursor, &x);) {
+                reduce_push(r, x);
+            }
+        } break;
+        default:
+            eval_error("cannot %s value type: %s\n", r->prod ? "multiply" : "sum", value_type_to_str(value.type));
+    }
+}
+
+Value_t reduction_result(const struct Reduction* r) {
+    if (!r->floats) {
+        return make_int((long long)r->ints);
+    }
+
+    double ints = (double)(long long)r->ints;
+    return make_float(r->prod ? ints * r->total : ints + r->total);
+}
+
+// body for each element of `body for name in expr`, one at a time, without
+// building the list of them
+void reduce_for(Context_t* context, struct Reduction* r, Node_t* node) {
+    Value_t values = eval(NODE(node->lexpr), context);
+    Node_t* body = NODE(node->lbody);
+    size_t mark = temps_mark();
+
+    if (is_list(values)) {
+        for (size_t i = 0; i < values.list_size; ++i) {
+            temps_drain(mark);
+            set_ref(context, node->vref, node->lvar, list_get(values, i));
+            reduce_push(r, eval(body, context));
+        }
+    } else if (values.type == V_RANGE) {
+        if (values.range_value->length == UNDEF_SIZE) {
+            eval_error("cannot enumerate infinite range\n");
+        }
+        struct RangeCursor cursor = range_cursor(values.range_value);
+        for (Value_t x; range_next(&cursor, &x);) {
+            temps_drain(mark);
+            set_ref(context, node->vref, node->lvar, x);
+            reduce_push(r, eval(body, context));
+        }
+    } else {
+        set_ref(context, node->vref, node->lvar, values);
+        reduce_push(r, eval(body, context));
+    }
+}
+
+Value_t reduce_args(Context_t* context, size_t nargs, NodeIdx_t* args, bool prod) {
+    struct Reduction r = reduction(prod);
+    for (size_t i = 0; i < nargs; ++i) {
+        Node_t* arg = NODE(args[i]);
+        if (arg->type == AST_FOR) {
+            reduce_for(context, &r, arg);
+        } else {
+            reduce_push(&r, eval(arg, context));
+        }
+    }
+    return reduction_result(&r);
+}
+
+Value_t cmd_sum(Context_t* context, size_t nargs, NodeIdx_t* args) {
+    return reduce_args(context, nargs, args, false);
+}
+
+Value_t cmd_prod(Context_t* context, size_t nargs, NodeIdx_t* args) {
+    return reduce_args(context, nargs, args, true);
+}
+
+#define TABLE_ROWS 256  // rows per task
+
+bool table_csv = false;
+
+void table_use_csv(bool csv) {
+    table_csv = csv;
+}
+
+// The rows of one task, evaluated in a copy of the variables of the table's
+// context, so that tasks running at the same time bind x each for
+// themselves. Cells are formatted right away, one after the other.
+struct TableTask {
+    Context_t* context;
+    Node_t* node;
+    Value_t rows;
+    size_t row_count;
+    size_t col_count;
+    struct Writer* text;   // per task
+    uint32_t* lengths;     // per cell
+};
+
+void table_rows(void* arg, size_t t) {
+    struct TableTask* task = arg;
+    Node_t* node = task->node;
+    Node_t* columns = NODE(node->lbody);
+
+    Context_t local = *task->context;
+    size_t slot_count = local.scope != NULL ? local.scope->slot_count : 0;
+    if (slot_count > 0) {
+        local.slots = malloc(slot_count * sizeof(Value_t));
+        for (size_t i = 0; i < slot_count; ++i) {
+            local.slots[i] = value_retain(task->context->slots[i]);
+        }
+    }
+    size_t mark = temps_mark();
+
+    struct Writer* text = &task->text[t];
+    *text = writer_new(NULL);
+    size_t end = (t + 1) * TABLE_ROWS < task->row_count ? (t + 1) * TABLE_ROWS : task->row_count;
+    for (size_t i = t * TABLE_ROWS; i < end; ++i) {
+        temps_drain(mark);
+        Value_t x = is_list(task->rows) ? list_get(task->rows, i)
+                    : task->rows.type == V_RANGE ? range_get(task->rows.range_value, i)
+                                                 : task->rows;
+        set_ref(&local, node->vref, node->lvar, x);
+
+        uint32_t* lengths = &task->lengths[i * task->col_count];
+        for (size_t j = 0; j < task->col_count; ++j) {
+            size_t before = text->size;
+            writer_value(text, j == 0 ? x : eval(CHILD(columns->items, j - 1), &local));
+            lengths[j] = text->size - before;
+        }
+    }
+
+    temps_drain(mark);
+    for (size_t i = 0; i < slot_count; ++i) {
+        value_release(local.slots[i]);
+    }
+    if (slot_count > 0) {
+        free(local.slots);
+    }
+}
+
+// a CSV field is quoted if it holds a separator, quote or line break
+void table_cell(struct Writer* out, const char* cell, size_t length, size_t width) {
+    if (!table_csv) {
+        writer_fill(out, ' ', width - length);
+        writer_put(out, cell, length);
+        return;
+    }
+
+    if (strcspn(cell, ",\"\n") >= length) {
+        writer_put(out, cell, length);
+        return;
+    }
+    writer_put(out, "\"", 1);
+    for (size_t i = 0; i < length; ++i) {
+        writer_put(out, cell + i, 1);
+        if (cell[i] == '"') {
+            writer_put(out, "\"", 1);
+        }
+    }
+    writer_put(out, "\"", 1);
+}
+
+// table x in xs, f(x), g(x), ...: a heading, then a row for every element
+// of xs, as aligned columns or as CSV. Rows are evaluated in parallel.
+Value_t cmd_table(Context_t* context, size_t nargs, NodeIdx_t* args) {
+    check_nargs(2);
+
+    Node_t* node = NODE(args[0]);
+    Value_t headings = eval(NODE(args[1]), context);
+    Value_t rows = eval(NODE(node->lexpr), context);
+
+    size_t row_count = 1;
+    if (is_list(rows)) {
+        row_count = rows.list_size;
+    } else if (rows.type == V_RANGE) {
+        row_count = rows.range_value->length;
+        if (row_count == UNDEF_SIZE) {
+            eval_error("cannot tabulate infinite range\n");
+        }
+    }
+
+    size_t col_count = headings.list_size;
+    size_t task_count = (row_count + TABLE_ROWS - 1) / TABLE_ROWS;
+    struct TableTask task = {
+        .context = context,
+        .node = node,
+        .rows = rows,
+        .row_count = row_count,
+        .col_count = col_count,
+        .text = malloc(task_count * sizeof(struct Writer)),
+        .lengths = malloc(row_count * col_count * sizeof(uint32_t)),
+    };
+    // x has to live in a slot for every task to have its own
+    if (node->vref.slot >= 0 && node->vref.depth == 0) {
+        pool_run(task_count, table_rows, &task);
+    } else {
+        for (size_t t = 0; t < task_count; ++t) {
+            table_rows(&task, t);
+        }
+    }
+
+    size_t* widths = calloc(col_count, sizeof(size_t));
+    for (size_t j = 0; j < col_count; ++j) {
+        widths[j] = strlen(list_get(headings, j).string_value);
+    }
+    for (size_t i = 0; i < row_count * col_count; ++i) {
+        if (task.lengths[i] > widths[i % col_count]) {
+            widths[i % col_count] = task.lengths[i];
+        }
+    }
+
+    const char* separator = table_csv ? "," : "  ";
+    struct Writer* out = writer_acquire_stdout();
+    for (size_t j = 0; j < col_count; ++j) {
+        const char* heading = list_get(headings, j).string_value;
+        writer_put(out, separator, j > 0 ? strlen(separator) : 0);
+        table_cell(out, heading, strlen(heading), widths[j]);
+    }
+    writer_put(out, "\n", 1);
+
+    for (size_t t = 0; t < task_count; ++t) {
+        const char* cell = task.text[t].data;
+        size_t end = (t + 1) * TABLE_ROWS < row_count ? (t + 1) * TABLE_ROWS : row_count;
+        for (size_t i = t * TABLE_ROWS; i < end; ++i) {
+            for (size_t j = 0; j < col_count; ++j) {
+                size_t length = task.lengths[i * col_count + j];
+                writer_put(out, separator, j > 0 ? strlen(separator) : 0);
+                table_cell(out, cell, length, widths[j]);
+                cell += length;
+            }
+            writer_put(out, "\n", 1);
+        }
+        writer_free(&task.text[t]);
+    }
+
+    writer_release_stdout(out);
+    free(widths);
+    free(task.lengths);
+    free(task.text);
+    return NIL;
+}
+
 struct CmdItem {
     const char* name;
     Cmd_t cmd;
@@ -140,7 +572,13 @@ typedef struct CmdItem CmdItem_t;
 
 const CmdItem_t commands[] = {
     {"print", cmd_print},
+    {"sum", cmd_sum},
+    {"prod", cmd_prod},
+    {"table", cmd_table},
     {"load", cmd_load},
+    {"dump", cmd_dump},
+    {"write", cmd_write},
+    {"memo", cmd_memo},
 };
 
 Cmd_t get_cmd(const char* name) {
@@ -154,62 +592,445 @@ Cmd_t get_cmd(const char* name) {
     return NULL;
 };
 
-double as_float(Value_t value) {
-    return nc_as_float(value);
+size_t distance(long long a, long long b) {
+    return a < b ? (size_t)(b - a) : (size_t)(a - b);
 }
 
-Value_t make_int(long long x) {
-    Value_t value = NC_INT(x);
-    return value;
+Context_t context_new(Context_t* parent, struct Scope* scope) {
+    Context_t context = {
+        .parent = parent,
+        .map = map_new(),
+        .read_only = false,
+        .defines = false,
+        .scope = scope,
+        .slots = NULL,
+    };
+    if (scope != NULL && scope->slot_count > 0) {
+        context.slots = malloc(scope->slot_count * sizeof(Value_t));
+        for (size_t i = 0; i < scope->slot_count; ++i) {
+            context.slots[i] = UNSET;
+        }
+    }
+    return context;
 }
 
-Value_t make_float(double x) {
-    Value_t value = NC_FLOAT(x);
-    return value;
+void context_release(Context_t* context) {
+    size_t slot_count = context->scope != NULL ? context->scope->slot_count : 0;
+    for (size_t i = 0; i < slot_count; ++i) {
+        value_release(context->slots[i]);
+    }
+
+    if (context->map.size == 0) {
+        return;
+    }
+    size_t item_count;
+    struct Item* items = map_items(&context->map, &item_count);
+    for (size_t i = 0; i < item_count; ++i) {
+        if (items[i].key != NULL) {
+            value_release(items[i].value);
+        }
+    }
+    map_free(&context->map);
 }
 
-size_t distance(long long a, long long b) {
-    return a < b ? (size_t)(b - a) : (size_t)(a - b);
+void context_free(Context_t* context) {
+    context_release(context);
+    free(context->slots);
+}
+
+// Each thread allocates its frame stack at its first call. It never moves,
+// as contexts of functions defined inside a call point into it.
+_Thread_local Value_t* frame_stack = NULL;
+_Thread_local size_t frame_top = 0;
+
+Value_t* frame_alloc(size_t count) {
+    if (frame_stack == NULL) {
+        frame_stack = malloc(FRAME_STACK_SIZE * sizeof(Value_t));
+        if (frame_stack == NULL) {
+            error("out of memory\n");
+        }
+    }
+    if (count > FRAME_STACK_SIZE - frame_top) {
+        eval_error("stack overflow\n");
+    }
+    Value_t* values = frame_stack + frame_top;
+    frame_top += count;
+    return values;
+}
+
+void frame_free(Value_t* base) {
+    frame_top = (size_t)(base - frame_stack);
+}
+
+// Whether f was defined in context or in a call nested in it.
+bool defined_in(struct EvalFunc* f, Context_t* context) {
+    for (Context_t* c = f->context; c != NULL; c = c->parent) {
+        if (c == context) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether value is such a function, or a list holding one.
+bool in_frame(Value_t value, Context_t* context) {
+    if (value.type == V_CALLABLE) {
+        return defined_in(value.data, context);
+    }
+    if (value.type == V_LIST) {
+        for (size_t i = 0; i < value.list_size; ++i) {
+            if (in_frame(value.list_value[i], context)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool frame_replaceable(Context_t* context, struct EvalFunc* f, size_t nargs, Value_t* args) {
+    if (defined_in(f, context)) {
+        return false;
+    }
+    for (size_t i = 0; i < nargs; ++i) {
+        if (in_frame(args[i], context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Value_t frame_result(Context_t* context, Value_t result) {
+    if (context->defines && in_frame(result, context)) {
+        eval_error("cannot return a function defined in the call\n");
+    }
+    return result;
+}
+
+// The functions whose purity is being decided, innermost first. A call of
+// one of them counts as pure: if none of them does anything impure, none
+// of them is.
+struct PureCheck {
+    struct EvalFunc* f;
+    struct PureCheck* outer;
+};
+
+bool is_pure(struct EvalFunc* f, struct PureCheck* outer);
+
+// Whether a name of f's own scope is read there alone. A local that holds
+// nothing reads through to the enclosing contexts, so only parameters that
+// a cached call has bound to numbers, and names nothing outside binds,
+// qualify; a parameter that is assigned could come to hold nothing.
+bool pure_local(struct EvalFunc* f, struct SlotRef ref, const char* name, bool assigned) {
+    if (ref.depth != 0 || ref.slot < 0) {
+        return false;
+    }
+    if (!assigned && (size_t)ref.slot < f->param_count) {
+        return true;
+    }
+    for (Context_t* c = f->context; c != NULL; c = c->parent) {
+        if (scope_find(c->scope, name) >= 0 || map_get(&c->map, name) != NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The callee is looked up as it is bound now; binding another function to
+// a name starts a new memo epoch, which decides again.
+bool pure_callee(struct PureCheck* check, Node_t* call) {
+    struct EvalFunc* f = check->f;
+    if (call->fref.depth == 0 && call->fref.slot >= 0) {
+        return false;
+    }
+
+    Value_t callable = NIL;
+    if (call->fref.slot < 0) {
+        callable = get_symbol(f->context, call->fname);
+    } else {
+        struct SlotRef ref = {.depth = call->fref.depth - 1, .slot = call->fref.slot};
+        callable = get_ref(f->context, ref, call->fname);
+    }
+    if (callable.type != V_CALLABLE) {
+        return false;
+    }
+
+    struct EvalFunc* g = callable.data;
+    if (g->body == NULL) {
+        return g->pure;
+    }
+    for (struct PureCheck* c = check; c != NULL; c = c->outer) {
+        if (c->f == g) {
+            return true;
+        }
+    }
+    return is_pure(g, check);
+}
+
+bool pure_nodes(struct PureCheck* check, size_t count, NodeIdx_t* nodes);
+
+bool pure_node(struct PureCheck* check, Node_t* node) {
+    struct EvalFunc* f = check->f;
+    switch (node->type) {
+        case AST_LITERAL:
+            return true;
+        case AST_IDENTIFIER:
+            return pure_local(f, node->ref, node->name, false);
+        case AST_BINOP:
+            return pure_node(check, NODE(node->lhs)) && pure_node(check, NODE(node->rhs));
+        case AST_UNOP:
+            return pure_node(check, NODE(node->node));
+        case AST_IDX:
+            return pure_local(f, node->lref, node->lname, false) && pure_node(check, NODE(node->iexpr));
+        case AST_ASSIGNMENT: {
+            Node_t* target = NODE(node->ident);
+            if (target->type == AST_IDX) {
+                return pure_local(f, target->lref, target->lname, true) && pure_node(check, NODE(target->iexpr)) &&
+                       pure_node(check, NODE(node->rvalue));
+            }
+            return target->type == AST_IDENTIFIER && pure_local(f, target->ref, target->name, true) &&
+                   pure_node(check, NODE(node->rvalue));
+        }
+        case AST_ITEMS:
+            return pure_nodes(check, node->item_count, LIST(node->items));
+        case AST_BLOCK:
+        case AST_CASES:
+            return pure_nodes(check, node->stmnt_count, LIST(node->stmnts));
+        case AST_CASE:
+            return pure_node(check, NODE(node->pred)) && pure_node(check, NODE(node->cexpr));
+        case AST_FOR:
+            return pure_local(f, node->vref, node->lvar, true) && pure_node(check, NODE(node->lexpr)) &&
+                   pure_node(check, NODE(node->lbody));
+        case AST_RANGE:
+            return pure_node(check, NODE(node->rstart)) && pure_node(check, NODE(node->rstop)) &&
+                   (node->rcount == NO_NODE || pure_node(check, NODE(node->rcount))) &&
+                   (node->rstep == NO_NODE || pure_node(check, NODE(node->rstep)));
+        case AST_FCALL:
+            return pure_nodes(check, node->param_count, LIST(node->params)) && pure_callee(check, node);
+        default:
+            // commands and function definitions
+            return false;
+    }
 }
 
-struct Map new_map() {
-    struct Map map;
-    map.capacity = 128;
-    map.size = 0;
-    map.items = malloc(map.capacity * sizeof(struct Item));
-    return map;
+bool pure_nodes(struct PureCheck* check, size_t count, NodeIdx_t* nodes) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!pure_node(check, NODE(nodes[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether a call of f computes its value from its arguments alone: it reads
+// and assigns no variable of an enclosing scope, runs no command, defines
+// no function and calls only pure builtins and pure scripted functions.
+// Plugins count as impure.
+bool is_pure(struct EvalFunc* f, struct PureCheck* outer) {
+    struct PureCheck check = {.f = f, .outer = outer};
+    return pure_node(&check, f->body);
+}
+
+bool memo_pure(void* f) {
+    return is_pure(f, NULL);
+}
+
+struct Memo* func_memo(struct EvalFunc* f) {
+    struct Memo* memo = f->memo;
+    return memo != NULL && memo_active(memo, memo_pure, f) ? memo : NULL;
+}
+
+// Calls of the tree walker nest on the C stack, which gets an error rather
+// than a crash once they take up more than this. Threads have 8 MiB.
+#define CALL_STACK_MAX (6 << 20)
+
+_Thread_local uintptr_t stack_base = 0;
+
+void check_stack(void) {
+    char here;
+    uintptr_t top = (uintptr_t)&here;
+    if (stack_base == 0) {
+        stack_base = top;
+    } else if (stack_base > top && stack_base - top > CALL_STACK_MAX) {
+        eval_error("stack overflow\n");
+    }
+}
+
+void context_push(Context_t* context, Context_t* parent, struct Scope* scope, size_t nargs, Value_t* args) {
+    size_t slot_count = scope->slot_count;
+    // the inline items of the map are left as they are, it being empty
+    context->parent = parent;
+    context->map.size = 0;
+    context->map.capacity = 0;
+    context->map.items = NULL;
+    context->read_only = false;
+    context->defines = false;
+    context->scope = scope;
+    context->slots = frame_alloc(slot_count);
+    memmove(context->slots, args, nargs * sizeof(Value_t));
+    for (size_t i = nargs; i < slot_count; ++i) {
+        context->slots[i] = UNSET;
+    }
+}
+
+void context_pop(Context_t* context) {
+    context_release(context);
+    frame_free(context->slots);
+}
+
+bool is_list(Value_t value) {
+    return nc_is_list(value);
+}
+
+Value_t list_get(Value_t list, size_t i) {
+    return nc_list_get(list, i);
+}
+
+size_t list_elem_size(enum ValueType type) {
+    return type == V_LIST ? sizeof(Value_t) : sizeof(double);
+}
+
+// Turns a packed list into tagged values in a new block, with room for
+// capacity of them. The packed block is left to the caller.
+void list_unpack(Value_t* list, size_t capacity) {
+    Value_t* values = heap_alloc(capacity * sizeof(Value_t));
+    for (size_t i = 0; i < list->list_size; ++i) {
+        values[i] = list_get(*list, i);
+    }
+    heap_set_values(values, list->list_size);
+    list->type = V_LIST;
+    list->counted = true;
+    list->list_value = values;
+}
+
+struct ListBuilder list_builder(size_t capacity) {
+    struct ListBuilder builder = {
+        .list = {.type = V_LIST, .list_size = 0, .list_value = NULL},
+        .capacity = capacity > 0 ? capacity : 1,
+    };
+    return builder;
+}
+
+void list_push(struct ListBuilder* builder, Value_t value) {
+    Value_t* list = &builder->list;
+
+    if (list->list_value == NULL) {
+        list->type = value.type == V_INT ? V_INT_ARRAY : value.type == V_FLOAT ? V_FLOAT_ARRAY : V_LIST;
+        list->counted = true;
+        list->list_value = heap_alloc(builder->capacity * list_elem_size(list->type));
+    } else if ((list->type == V_INT_ARRAY && value.type != V_INT) ||
+               (list->type == V_FLOAT_ARRAY && value.type != V_FLOAT)) {
+        Value_t packed = *list;
+        list_unpack(list, builder->capacity);
+        value_release(packed);
+    }
+
+    if (list->list_size == builder->capacity) {
+        builder->capacity *= 2;
+        list->list_value = heap_realloc(list->list_value, builder->capacity * list_elem_size(list->type));
+    }
+
+    switch (list->type) {
+        case V_INT_ARRAY:
+            list->int_array[list->list_size++] = value.int_value;
+            break;
+        case V_FLOAT_ARRAY:
+            list->float_array[list->list_size++] = value.float_value;
+            break;
+        default:
+            list->list_value[list->list_size++] = value_retain(value);
+    }
+}
+
+Value_t list_build(struct ListBuilder* builder) {
+    if (builder->list.type == V_LIST && builder->list.list_value != NULL) {
+        heap_set_values(builder->list.list_value, builder->list.list_size);
+    }
+    return value_temp(builder->list);
+}
+
+bool list_set(Value_t* list, size_t i, Value_t value) {
+    bool unpacked = false;
+    if ((list->type == V_INT_ARRAY && value.type != V_INT) || (list->type == V_FLOAT_ARRAY && value.type != V_FLOAT)) {
+        list_unpack(list, list->list_size);
+        value_temp(*list);
+        unpacked = true;
+    }
+
+    switch (list->type) {
+        case V_INT_ARRAY:
+            list->int_array[i] = value.int_value;
+            break;
+        case V_FLOAT_ARRAY:
+            list->float_array[i] = value.float_value;
+            break;
+        default:
+            value_release(list->list_value[i]);
+            list->list_value[i] = value_retain(value);
+    }
+
+    return unpacked;
 }
 
-Context_t context_new(Context_t* parent) {
-    Context_t context = {
-        .parent = parent,
-        .map = new_map(),
-        .read_only = false,
-    };
-    return context;
+// Points *list at a copy of its elements in a new block, a temporary.
+void list_copy(Value_t* list) {
+    size_t size = list->list_size * list_elem_size(list->type);
+    void* data = heap_alloc(size);
+    memcpy(data, list->list_value, size);
+    if (list->type == V_LIST) {
+        for (size_t i = 0; i < list->list_size; ++i) {
+            value_retain(list->list_value[i]);
+        }
+        heap_set_values(data, list->list_size);
+    }
+    list->counted = true;
+    list->list_value = data;
+    value_temp(*list);
 }
 
-Value_t value_repeat(Value_t value, size_t count) {
-    Value_t list = {.type = V_LIST, .list_size = count};
-    list.list_value = malloc(count * sizeof(Value_t));
+bool list_owned(Value_t list, const Value_t* home, size_t holders) {
+    void* data = value_block(list);
+    if (data == NULL || !is_list(list)) {
+        return false;
+    }
+    if (home != NULL && value_block(*home) == data) {
+        ++holders;
+    }
+    return heap_refs(data) == holders;
+}
 
-    for (size_t i = 0; i < count; ++i) {
-        list.list_value[i] = value;
+bool list_assign(Value_t* list, Value_t idx, Value_t value, bool owned) {
+    if (!is_list(*list)) {
+        eval_error("cannot assign to an element of value type: %s\n", value_type_to_str(list->type));
+    }
+    if (idx.type != V_INT) {
+        eval_error("cannot index using value type: %s\n", value_type_to_str(idx.type));
+    }
+    if (idx.int_value < 0 || (size_t)idx.int_value >= list->list_size) {
+        eval_error("index out of range: %lld\n", idx.int_value);
     }
 
-    return list;
+    if (!owned) {
+        list_copy(list);
+    }
+    return list_set(list, idx.int_value, value) || !owned;
 }
 
 Value_t broadcast_func1(Value_t (*func)(Value_t), Value_t value) {
     Value_t result = NIL;
 
-    if (value.type == V_LIST) {
-        result.type = V_LIST;
-        result.list_size = value.list_size;
-        result.list_value = malloc(result.list_size * sizeof(Value_t));
-        for (size_t i = 0; i < result.list_size; ++i) {
-            result.list_value[i] = func(value.list_value[i]);
+    if (value.type == V_RANGE) {
+        if (func == op_unary_minus) {
+            return range_affine(op_times, value.range_value, make_int(-1), true);
         }
+        value = range_to_list(value.range_value);
+    }
+
+    if (is_list(value)) {
+        struct ListBuilder builder = list_builder(value.list_size);
+        for (size_t i = 0; i < value.list_size; ++i) {
+            list_push(&builder, func(list_get(value, i)));
+        }
+        result = list_build(&builder);
     } else {
         result = func(value);
     }
@@ -217,25 +1038,83 @@ Value_t broadcast_func1(Value_t (*func)(Value_t), Value_t value) {
     return result;
 }
 
+// element functions that have a typed loop over packed lists
+struct {
+    Value_t (*func)(Value_t, Value_t);
+    enum ArrayOp op;
+} array_ops[] = {
+    {op_plus, ARRAY_ADD}, {op_minus, ARRAY_SUB}, {op_times, ARRAY_MUL}, {op_divide, ARRAY_DIV},
+    {op_mod, ARRAY_MOD},  {op_power, ARRAY_POW}, {op_lt, ARRAY_LT},     {op_gt, ARRAY_GT},
+    {op_leq, ARRAY_LEQ},  {op_geq, ARRAY_GEQ},   {op_eeq, ARRAY_EEQ},   {op_neq, ARRAY_NEQ},
+};
+
+enum ArrayOp array_op(Value_t (*func)(Value_t, Value_t)) {
+    for (size_t i = 0; i < sizeof(array_ops) / sizeof(array_ops[0]); ++i) {
+        if (array_ops[i].func == func) {
+            return array_ops[i].op;
+        }
+    }
+    return ARRAY_NONE;
+}
+
+bool list_update(Value_t list, Value_t (*func)(Value_t, Value_t), Value_t value) {
+    return array_update(array_op(func), list, value);
+}
+
+// A range and a number make another range where the operation allows it,
+// anything else is done on the elements of the range as a list.
+Value_t broadcast_range(Value_t (*func)(Value_t, Value_t), Value_t lhs, Value_t rhs) {
+    Value_t result = NIL;
+    if (lhs.type == V_RANGE && rhs.type != V_RANGE) {
+        result = range_affine(func, lhs.range_value, rhs, true);
+    } else if (rhs.type == V_RANGE && lhs.type != V_RANGE) {
+        result = range_affine(func, rhs.range_value, lhs, false);
+    }
+    if (result.type != V_NIL) {
+        return result;
+    }
+
+    if (lhs.type == V_RANGE) {
+        lhs = range_to_list(lhs.range_value);
+    }
+    if (rhs.type == V_RANGE) {
+        rhs = range_to_list(rhs.range_value);
+    }
+    return broadcast_func2(func, lhs, rhs);
+}
+
 Value_t broadcast_func2(Value_t (*func)(Value_t, Value_t), Value_t lhs, Value_t rhs) {
     Value_t result = NIL;
 
-    if (lhs.type == V_LIST && rhs.type == V_LIST) {
+    if (lhs.type == V_RANGE || rhs.type == V_RANGE) {
+        return broadcast_range(func, lhs, rhs);
+    }
+
+    if ((is_array(lhs) || is_array(rhs)) && array_binop(array_op(func), lhs, rhs, &result)) {
+        return value_temp(result);
+    }
+
+    if (is_list(lhs) && is_list(rhs)) {
         if (lhs.list_size != rhs.list_size) {
             eval_error("expected lists to be of same length: %zu and %zu\n", lhs.list_size, rhs.list_size);
         }
-        result.type = V_LIST;
-        result.list_size = lhs.list_size;
-        result.list_value = malloc(result.list_size * sizeof(Value_t));
-        for (size_t i = 0; i < result.list_size; ++i) {
-            result.list_value[i] = func(lhs.list_value[i], rhs.list_value[i]);
-        }
-    } else if (lhs.type == V_LIST) {
-        rhs = value_repeat(rhs, lhs.list_size);
-        result = broadcast_func2(func, lhs, rhs);
-    } else if (rhs.type == V_LIST) {
-        lhs = value_repeat(lhs, rhs.list_size);
-        result = broadcast_func2(func, lhs, rhs);
+        struct ListBuilder builder = list_builder(lhs.list_size);
+        for (size_t i = 0; i < lhs.list_size; ++i) {
+            list_push(&builder, func(list_get(lhs, i), list_get(rhs, i)));
+        }
+        result = list_build(&builder);
+    } else if (is_list(lhs)) {
+        struct ListBuilder builder = list_builder(lhs.list_size);
+        for (size_t i = 0; i < lhs.list_size; ++i) {
+            list_push(&builder, func(list_get(lhs, i), rhs));
+        }
+        result = list_build(&builder);
+    } else if (is_list(rhs)) {
+        struct ListBuilder builder = list_builder(rhs.list_size);
+        for (size_t i = 0; i < rhs.list_size; ++i) {
+            list_push(&builder, func(lhs, list_get(rhs, i)));
+        }
+        result = list_build(&builder);
     } else {
         result = func(lhs, rhs);
     }
@@ -285,94 +1164,250 @@ Value_t c_sqrt_impl(Value_t value) {
     return wrap_float_float1(sqrt, value);
 }
 
+// Packed lists go through the array kernels in one call, anything else
+// through func one element at a time.
+Value_t broadcast_math(enum ArrayFunc f, Value_t (*func)(Value_t), Value_t value) {
+    Value_t result;
+    if (value.type == V_RANGE) {
+        value = range_to_list(value.range_value);
+    }
+    if (array_func(f, value, &result)) {
+        return value_temp(result);
+    }
+
+    return broadcast_func1(func, value);
+}
+
 Value_t c_sin(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_sin_impl, args[0]);
+    return broadcast_math(ARRAY_SIN, c_sin_impl, args[0]);
 }
 
 Value_t c_cos(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_cos_impl, args[0]);
+    return broadcast_math(ARRAY_COS, c_cos_impl, args[0]);
 }
 
 Value_t c_tan(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_tan_impl, args[0]);
+    return broadcast_math(ARRAY_TAN, c_tan_impl, args[0]);
 }
 
 Value_t c_asin(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_asin_impl, args[0]);
+    return broadcast_math(ARRAY_ASIN, c_asin_impl, args[0]);
 }
 
 Value_t c_acos(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_acos_impl, args[0]);
+    return broadcast_math(ARRAY_ACOS, c_acos_impl, args[0]);
 }
 
 Value_t c_atan(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_atan_impl, args[0]);
+    return broadcast_math(ARRAY_ATAN, c_atan_impl, args[0]);
 }
 
 Value_t c_exp(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_exp_impl, args[0]);
+    return broadcast_math(ARRAY_EXP, c_exp_impl, args[0]);
 }
 
 Value_t c_log(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_exp_impl, args[0]);
+    return broadcast_math(ARRAY_LOG, c_log_impl, args[0]);
 }
 
 Value_t c_sqrt(size_t nargs, Value_t* args) {
     check_nargs(1);
-    return broadcast_func1(c_sqrt_impl, args[0]);
+    return broadcast_math(ARRAY_SQRT, c_sqrt_impl, args[0]);
+}
+
+// The element of a list or range that no other element is better than.
+Value_t extreme(Value_t value, Value_t (*better)(Value_t, Value_t), const char* what) {
+    if (value.type == V_RANGE) {
+        return better == op_lt ? range_min(value.range_value) : range_max(value.range_value);
+    }
+    if (!is_list(value)) {
+        return value;
+    }
+    if (value.list_size == 0) {
+        eval_error("empty list has no %s\n", what);
+    }
+
+    Value_t result = list_get(value, 0);
+    for (size_t i = 1; i < value.list_size; ++i) {
+        Value_t item = list_get(value, i);
+        if (is_truthy(better(item, result))) {
+            result = item;
+        }
+    }
+    return result;
+}
+
+Value_t c_min(size_t nargs, Value_t* args) {
+    check_nargs(1);
+    return extreme(args[0], op_lt, "minimum");
+}
+
+Value_t c_max(size_t nargs, Value_t* args) {
+    check_nargs(1);
+    return extreme(args[0], op_gt, "maximum");
+}
+
+EvalFunc_t* builtin_new(Context_t* context, size_t param_count, Func_t func) {
+    EvalFunc_t* ef = evalfunc_new(context, param_count, NULL, NULL, func);
+    ef->pure = true;
+    return ef;
 }
 
 void setup_builtin_context(Context_t* context) {
     context->read_only = true;
 
-    set_value(context, "sin", make_callable(evalfunc_new(context, 1, NULL, NULL, c_sin)));
-    set_value(context, "cos", make_callable(evalfunc_new(context, 1, NULL, NULL, c_cos)));
-    set_value(context, "tan", make_callable(evalfunc_new(context, 1, NULL, NULL, c_tan)));
-    set_value(context, "asin", make_callable(evalfunc_new(context, 1, NULL, NULL, c_asin)));
-    set_value(context, "acos", make_callable(evalfunc_new(context, 1, NULL, NULL, c_acos)));
-    set_value(context, "atan", make_callable(evalfunc_new(context, 1, NULL, NULL, c_atan)));
-    set_value(context, "exp", make_callable(evalfunc_new(context, 1, NULL, NULL, c_exp)));
-    set_value(context, "log", make_callable(evalfunc_new(context, 1, NULL, NULL, c_log)));
-    set_value(context, "sqrt", make_callable(evalfunc_new(context, 1, NULL, NULL, c_sqrt)));
+    set_value(context, "sin", make_callable(builtin_new(context, 1, c_sin)));
+    set_value(context, "cos", make_callable(builtin_new(context, 1, c_cos)));
+    set_value(context, "tan", make_callable(builtin_new(context, 1, c_tan)));
+    set_value(context, "asin", make_callable(builtin_new(context, 1, c_asin)));
+    set_value(context, "acos", make_callable(builtin_new(context, 1, c_acos)));
+    set_value(context, "atan", make_callable(builtin_new(context, 1, c_atan)));
+    set_value(context, "exp", make_callable(builtin_new(context, 1, c_exp)));
+    set_value(context, "log", make_callable(builtin_new(context, 1, c_log)));
+    set_value(context, "sqrt", make_callable(builtin_new(context, 1, c_sqrt)));
+    set_value(context, "min", make_callable(builtin_new(context, 1, c_min)));
+    set_value(context, "max", make_callable(builtin_new(context, 1, c_max)));
+}
+
+// The builtin each call whose name the resolver could not place found, by
+// the index of its node, and the epoch of the caches it found it in. The
+// builtins are bound once and for all, so entries of the same epoch agree
+// and threads may fill them in at once. Names bound in a call's own context
+// differ from one call to the next, and switch the cache off for good.
+struct CallSite {
+    EvalFunc_t* f;
+    size_t epoch;
+};
+
+struct CallSite* call_sites = NULL;
+size_t call_site_count = 0;
+bool call_sites_off = false;
+
+void call_sites_init(void) {
+    call_sites = calloc(ast.size, sizeof(struct CallSite));
+    call_site_count = ast.size;
 }
 
-Value_t get_value(Context_t* context, const char* name) {
-    for (size_t i = 0; i < context->map.size; ++i) {
-        if (strcmp(name, context->map.items[i].key) == 0) {
-            return context->map.items[i].value;
+void call_sites_free(void) {
+    free(call_sites);
+    call_sites = NULL;
+    call_site_count = 0;
+}
+
+void call_sites_stop(void) {
+    __atomic_store_n(&call_sites_off, true, __ATOMIC_RELAXED);
+}
+
+// Lookups by symbol are the slow path: they serve names the resolver could
+// not place (builtins, plugins) and callers outside of the evaluator.
+Value_t get_symbol(Context_t* context, const char* sym) {
+    for (; context != NULL; context = context->parent) {
+        int slot = scope_find(context->scope, sym);
+        if (slot >= 0 && !is_unset(context->slots[slot])) {
+            return context->slots[slot];
         }
-    }
 
-    if (context->parent) {
-        return get_value(context->parent, name);
+        Value_t* value = map_get(&context->map, sym);
+        if (value != NULL) {
+            return *value;
+        }
     }
 
     return NIL;
 }
 
-void set_value(Context_t* context, const char* name, struct AstValue value) {
-    for (size_t i = 0; i < context->map.size; ++i) {
-        if (strcmp(name, context->map.items[i].key) == 0) {
-            context->map.items[i].value = value;
-            return;
+// Stores value into a variable. Binding a function where there was none, or
+// another one, may change what a pure function calls, so the caches decide
+// again.
+static inline void bind(Value_t* dst, Value_t value) {
+    if ((dst->type == V_CALLABLE || value.type == V_CALLABLE) && (dst->type != value.type || dst->data != value.data)) {
+        memo_invalidate();
+    }
+    value_store(dst, value);
+}
+
+void set_symbol(Context_t* context, const char* sym, struct AstValue value) {
+    int slot = scope_find(context->scope, sym);
+    if (slot >= 0) {
+        bind(&context->slots[slot], value);
+        return;
+    }
+
+    // a new name may be one a pure function took to be bound nowhere
+    size_t size = context->map.size;
+    Value_t* dst = map_put(&context->map, sym);
+    if (context->map.size != size) {
+        memo_invalidate();
+        if (context->parent != NULL && context->parent->parent != NULL) {
+            call_sites_stop();
         }
     }
+    bind(dst, value);
+}
+
+Value_t get_value(Context_t* context, const char* name) {
+    return get_symbol(context, intern(name));
+}
+
+void set_value(Context_t* context, const char* name, struct AstValue value) {
+    set_symbol(context, intern(name), value);
+}
+
+// A slot that has not been assigned yet reads through to the enclosing
+// contexts, like a missing map entry does. name must be interned, which the
+// lexer does for every name in the tree.
+Value_t get_ref(Context_t* context, struct SlotRef ref, const char* name) {
+    if (ref.slot < 0) {
+        return get_symbol(context, name);
+    }
+
+    for (int i = 0; i < ref.depth; ++i) {
+        context = context->parent;
+    }
+
+    Value_t value = context->slots[ref.slot];
+    if (is_unset(value) && context->parent != NULL) {
+        return get_symbol(context->parent, name);
+    }
 
-    if (context->map.size >= context->map.capacity) {
-        context->map.capacity *= 2;
-        context->map.items = realloc(context->map.items, context->map.capacity * sizeof(struct Item));
+    return value;
+}
+
+_Thread_local size_t outer_stores = 0;
+
+void set_ref(Context_t* context, struct SlotRef ref, const char* name, Value_t value) {
+    if (ref.slot < 0) {
+        set_symbol(context, name, value);
+        return;
+    }
+
+    outer_stores += ref.depth > 0;
+    for (int i = 0; i < ref.depth; ++i) {
+        context = context->parent;
+    }
+
+    bind(&context->slots[ref.slot], value);
+}
+
+Value_t* ref_home(Context_t* context, struct SlotRef ref, const char* name) {
+    if (ref.slot < 0) {
+        int slot = scope_find(context->scope, name);
+        return slot >= 0 ? &context->slots[slot] : map_get(&context->map, name);
+    }
+
+    for (int i = 0; i < ref.depth; ++i) {
+        context = context->parent;
     }
 
-    struct Item item = {.key = name, .value = value};
-    context->map.items[context->map.size++] = item;
+    return &context->slots[ref.slot];
 }
 
 bool is_negative(Value_t value) {
@@ -395,6 +1430,8 @@ bool is_truthy(Value_t value) {
         case V_STRING:
             return strlen(value.string_value) > 0;
         case V_LIST:
+        case V_INT_ARRAY:
+        case V_FLOAT_ARRAY:
             return value.list_size > 0;
         default:
             return false;
@@ -559,6 +1596,8 @@ Value_t op_unary_minus(Value_t val) {
     } else if (val.type == V_FLOAT) {
         result.type = V_FLOAT;
         result.float_value = -val.float_value;
+    } else {
+        eval_error("cannot negate value type: %s\n", value_type_to_str(val.type));
     }
     return result;
 }
@@ -571,111 +1610,215 @@ Value_t op_unary_not(Value_t val) {
     return TRUE;
 }
 
-bool in_range(Value_t value, Value_t begin, Value_t end) {
-    if (end.type == V_INF) {
-        return true;
+// A range holds no iteration state: element i is computed from start and
+// step, so a range can be printed, measured and walked any number of times,
+// by any number of cursors at once. length is UNDEF_SIZE for an infinite
+// range, and stop is its last element otherwise.
+Value_t range_new(Value_t start, Value_t stop, Value_t step, size_t length) {
+    Value_t value = {.type = V_RANGE, .counted = true};
+    value.range_value = heap_alloc(sizeof(Range_t));
+    value.range_value->start = start;
+    value.range_value->stop = stop;
+    value.range_value->step = step;
+    value.range_value->length = length;
+    return value_temp(value);
+}
+
+// The last element is stop itself, so that a counted float range ends
+// exactly where it was asked to instead of at start + i * step rounded.
+Value_t range_get(const Range_t* range, size_t i) {
+    if (i + 1 == range->length) {
+        return range->stop;
     }
 
-    Value_t diff = op_minus(end, begin);
-    if (is_negative(diff)) {
-        Value_t tmp = begin;
-        begin = end;
-        end = tmp;
+    if (range->start.type == V_INT) {
+        return make_int(range->start.int_value + (long long)i * range->step.int_value);
     }
-    Value_t diff1 = op_minus(value, begin);
-    Value_t diff2 = op_minus(end, value);
+    return make_float(range->start.float_value + (double)i * range->step.float_value);
+}
+
+struct RangeCursor range_cursor(const Range_t* range) {
+    struct RangeCursor cursor = {.range = range, .index = 0};
+    return cursor;
+}
 
-    if (is_negative(diff1) || is_negative(diff2)) {
+bool range_next(struct RangeCursor* cursor, Value_t* value) {
+    if (cursor->index >= cursor->range->length) {
         return false;
     }
 
+    *value = range_get(cursor->range, cursor->index++);
     return true;
 }
 
-Range_t* range_new(Value_t start, Value_t stop, Value_t step, size_t length) {
-    Range_t* range = malloc(sizeof(Range_t));
-    range->start = start;
-    range->stop = stop;
-    range->step = step;
-    range->value = NIL;
-    range->count = 0;
-    range->length = length;
-    range->done = false;
-    range->started = false;
-    return range;
+Value_t range_to_list(const Range_t* range) {
+    if (range->length == UNDEF_SIZE) {
+        eval_error("cannot enumerate infinite range\n");
+    }
+
+    struct ListBuilder builder = list_builder(range->length);
+    for (size_t i = 0; i < range->length; ++i) {
+        list_push(&builder, range_get(range, i));
+    }
+
+    return list_build(&builder);
 }
 
-Value_t range_next(Range_t* range) {
-    if (range->done) {
-        eval_error("attempt to call next on an exhausted range\n");
+Value_t range_affine(Value_t (*func)(Value_t, Value_t), const Range_t* range, Value_t c, bool range_lhs) {
+    if (c.type != V_INT && c.type != V_FLOAT) {
+        return NIL;
     }
 
-    if (range->length != UNDEF_SIZE) {
-        if (range->count == range->length) {
-            range->value = NIL;
-            range->done = true;
-        } else if (range->count + 1 == range->length) {
-            range->value = range->stop;
-        } else if (range->started) {
-            range->value = op_plus(range->value, range->step);
-        } else {
-            range->value = range->start;
-            range->started = true;
-        }
-        range->count++;
-    } else {
-        if (range->started) {
-            range->value = op_plus(range->value, range->step);
-        } else {
-            range->value = range->start;
-            range->started = true;
+    Value_t step = range->step;
+    if (func == op_minus && !range_lhs) {
+        step = op_unary_minus(step);
+    } else if (func == op_times) {
+        step = op_times(step, c);
+    } else if (func == op_divide && range_lhs) {
+        // int division is affine only where it divides every element
+        if (c.type == V_INT && step.type == V_INT &&
+            (c.int_value == 0 || range->start.int_value % c.int_value != 0 || step.int_value % c.int_value != 0)) {
+            return NIL;
         }
+        step = op_divide(step, c);
+    } else if (func != op_plus && func != op_minus) {
+        return NIL;
+    }
+
+    Value_t start = range_lhs ? func(range->start, c) : func(c, range->start);
+    Value_t stop = INF;
+    if (range->length != UNDEF_SIZE) {
+        stop = range_lhs ? func(range->stop, c) : func(c, range->stop);
+    }
+    if (start.type == V_FLOAT) {
+        step = make_float(as_float(step));
+    }
 
-        if (!in_range(range->value, range->start, range->stop)) {
-            range->value = NIL;
-            range->done = true;
+    return range_new(start, stop, step, range->length);
+}
+
+bool range_ascending(const Range_t* range) {
+    return range->step.type == V_INT ? range->step.int_value >= 0 : range->step.float_value >= 0.0;
+}
+
+// n start + step n (n - 1) / 2 for ints, wrapping around the same way as
+// adding the elements one by one would. For floats the last element is
+// stop, which is added as such.
+Value_t range_sum(const Range_t* range) {
+    size_t n = range->length;
+    if (n == UNDEF_SIZE) {
+        eval_error("cannot sum infinite range\n");
+    }
+    if (n == 0) {
+        return make_int(0);
+    }
+
+    if (range->start.type == V_INT) {
+        unsigned long long a = n;
+        unsigned long long b = n - 1;
+        if (a % 2 == 0) {
+            a /= 2;
+        } else {
+            b /= 2;
         }
+        unsigned long long sum = (unsigned long long)range->start.int_value * n +
+                                 (unsigned long long)range->step.int_value * (a * b);
+        return make_int((long long)sum);
     }
 
-    return range->value;
+    // in this order a sum that a double holds exactly comes out exact
+    return make_float((double)n * (range->start.float_value + range->stop.float_value) / 2.0);
 }
 
-Value_t range_to_list(Range_t* range) {
-    Value_t* values;
-    size_t cap;
-    size_t len = 0;
+Value_t range_min(const Range_t* range) {
+    if (range->length == 0) {
+        eval_error("empty range has no minimum\n");
+    }
+    if (range_ascending(range)) {
+        return range->start;
+    }
+    if (range->length == UNDEF_SIZE) {
+        eval_error("infinite range has no minimum\n");
+    }
+    return range->stop;
+}
 
-    if (range->length != UNDEF_SIZE) {
-        cap = range->length;
-    } else if (range->start.type == V_INF || range->stop.type == V_INF) {
-        eval_error("cannot enumerate infinite range\n");
-    } else {
-        cap = 1;
+Value_t range_max(const Range_t* range) {
+    if (range->length == 0) {
+        eval_error("empty range has no maximum\n");
+    }
+    if (!range_ascending(range)) {
+        return range->start;
+    }
+    if (range->length == UNDEF_SIZE) {
+        eval_error("infinite range has no maximum\n");
+    }
+    return range->stop;
+}
+
+// The number of elements that the int range idx picks from a sequence of
+// length elements, checking that all of them are in bounds. An infinite idx
+// stops at the end of a finite sequence.
+size_t slice_length(const Range_t* idx, size_t length) {
+    if (idx->start.type != V_INT) {
+        eval_error("cannot index using value type: float range\n");
     }
-    values = malloc(cap * sizeof(Value_t));
 
-    for (Value_t val = range_next(range); !range->done; val = range_next(range)) {
-        if (len >= cap) {
-            cap *= 2;
-            values = realloc(values, cap * sizeof(Value_t));
+    long long first = idx->start.int_value;
+    long long step = idx->step.int_value;
+    size_t count = idx->length;
+    if (count == UNDEF_SIZE && length != UNDEF_SIZE) {
+        if (step <= 0) {
+            eval_error("cannot slice a finite sequence by an infinite range of step %lld\n", step);
         }
+        count = first < 0 || (size_t)first >= length ? 0 : (length - 1 - (size_t)first) / (size_t)step + 1;
+    }
+    if (count == 0) {
+        return 0;
+    }
 
-        values[len++] = val;
+    long long last = count == UNDEF_SIZE ? first : first + (long long)(count - 1) * step;
+    long long bad = first < 0 || (size_t)first >= length ? first : last;
+    if (bad < 0 || (size_t)bad >= length) {
+        eval_error("index out of range: %lld\n", bad);
+    }
+    return count;
+}
+
+// Elements idx of range as another range, without enumerating either.
+Value_t range_slice(const Range_t* range, const Range_t* idx) {
+    size_t count = slice_length(idx, range->length);
+
+    long long first = idx->start.int_value;
+    long long k = idx->step.int_value;
+    Value_t start = count == 0 ? range->start : range_get(range, first);
+    Value_t step = range->step.type == V_INT ? make_int(range->step.int_value * k)
+                                             : make_float(range->step.float_value * (double)k);
+    Value_t stop = start;
+    if (count == UNDEF_SIZE) {
+        stop = INF;
+    } else if (count > 0) {
+        stop = range_get(range, first + (long long)(count - 1) * k);
     }
 
-    Value_t list = {
-        .type = V_LIST,
-        .list_size = len,
-        .list_value = values,
-    };
+    return range_new(start, stop, step, count);
+}
+
+Value_t list_slice(Value_t list, const Range_t* idx) {
+    size_t count = slice_length(idx, list.list_size);
+
+    struct ListBuilder builder = list_builder(count);
+    for (size_t i = 0; i < count; ++i) {
+        list_push(&builder, list_get(list, idx->start.int_value + (long long)i * idx->step.int_value));
+    }
 
-    return list;
+    return list_build(&builder);
 }
 
 Value_t eval_or(Context_t* context, Node_t* lhs, Node_t* rhs) {
     Value_t lval = eval(lhs, context);
 
-    if (lval.type == V_LIST && lval.list_size > 0) {
+    if (is_list(lval) && lval.list_size > 0) {
         return broadcast_func2(op_or, lval, eval(rhs, context));
     }
 
@@ -683,87 +1826,435 @@ Value_t eval_or(Context_t* context, Node_t* lhs, Node_t* rhs) {
         return TRUE;
     }
 
-    Value_t rval = eval(rhs, context);
+    Value_t rval = eval(rhs, context);
+
+    if (is_list(rval) && rval.list_size > 0) {
+        return broadcast_func2(op_or, lval, rval);
+    }
+
+    if (is_truthy(rval)) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+Value_t eval_and(Context_t* context, Node_t* lhs, Node_t* rhs) {
+    Value_t lval = eval(lhs, context);
+
+    if (is_list(lval) && lval.list_size > 0) {
+        return broadcast_func2(op_and, lval, eval(rhs, context));
+    }
+
+    if (!is_truthy(lval)) {
+        return FALSE;
+    }
+
+    Value_t rval = eval(rhs, context);
+
+    if (is_list(rval) && rval.list_size > 0) {
+        return broadcast_func2(op_and, lval, rval);
+    }
+
+    if (!is_truthy(rval)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// The element-wise operator for op, or NULL where op is not one (| and &
+// short-circuit instead).
+Value_t (*binop_func(Binop_t op))(Value_t, Value_t) {
+    switch (op) {
+        case TOK_PLUS:
+            return op_plus;
+        case TOK_MINUS:
+            return op_minus;
+        case TOK_STAR:
+            return op_times;
+        case TOK_FSLASH:
+            return op_divide;
+        case TOK_PERC:
+            return op_mod;
+        case TOK_POWER:
+            return op_power;
+        case TOK_LT:
+            return op_lt;
+        case TOK_GT:
+            return op_gt;
+        case TOK_LEQ:
+            return op_leq;
+        case TOK_GEQ:
+            return op_geq;
+        case TOK_EEQ:
+            return op_eeq;
+        case TOK_NEQ:
+            return op_neq;
+        default:
+            return NULL;
+    }
+}
+
+// List expression fusion. A tree of element-wise operators, unary minus
+// and not, and math builtins is collected into a plan for array_fused, so
+// that z = x + 2 * y makes one pass over x and y and allocates only z. Any
+// other subexpression is evaluated up front as a leaf of the plan.
+// Operations on numbers alone are applied as soon as they are collected,
+// and a plan that array_fused turns down is applied one operation at a
+// time, just as the tree would have been without fusion. An operator node
+// whose last value was a number skips the plan, which only costs scalar
+// code time, until it sees a list again.
+struct Fusion {
+    struct FuseNode nodes[FUSE_MAX];
+    size_t count;
+};
+
+// builtins that have a kernel in the plan
+const Func_t math_builtins[ARRAY_FUNC_COUNT] = {
+    [ARRAY_SIN] = c_sin, [ARRAY_COS] = c_cos, [ARRAY_TAN] = c_tan, [ARRAY_ASIN] = c_asin, [ARRAY_ACOS] = c_acos,
+    [ARRAY_ATAN] = c_atan, [ARRAY_EXP] = c_exp, [ARRAY_LOG] = c_log, [ARRAY_SQRT] = c_sqrt,
+};
+
+bool math_builtin(Value_t callable, enum ArrayFunc* f) {
+    if (callable.type != V_CALLABLE) {
+        return false;
+    }
+
+    struct EvalFunc* ef = callable.data;
+    for (size_t i = 0; i < ARRAY_FUNC_COUNT; ++i) {
+        if (ef->func == math_builtins[i]) {
+            *f = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+Value_t (*array_op_func(enum ArrayOp op))(Value_t, Value_t) {
+    for (size_t i = 0; i < sizeof(array_ops) / sizeof(array_ops[0]); ++i) {
+        if (array_ops[i].op == op) {
+            return array_ops[i].func;
+        }
+    }
+    return NULL;
+}
+
+// The rows of table run on several threads that share these hints, so they
+// are read and written as relaxed atomics, which are plain loads and stores
+// but keep a race between two threads defined.
+bool get_hint(const bool* hint) {
+    return __atomic_load_n(hint, __ATOMIC_RELAXED);
+}
+
+void set_hint(bool* hint, bool value) {
+    if (get_hint(hint) != value) {
+        __atomic_store_n(hint, value, __ATOMIC_RELAXED);
+    }
+}
+
+// Where an operator node keeps whether its last value was a number.
+bool* scalar_hint(Node_t* node) {
+    switch (node->type) {
+        case AST_BINOP:
+            return &node->binop_scalar;
+        case AST_UNOP:
+            return &node->unop_scalar;
+        default:
+            return NULL;
+    }
+}
+
+// Whether node may start a plan, judged from the tree alone.
+bool is_fusable(Node_t* node) {
+    switch (node->type) {
+        case AST_BINOP:
+            return binop_func(node->binop_type) != NULL;
+        case AST_UNOP:
+            return node->unop_type == TOK_MINUS || node->unop_type == TOK_BANG;
+        case AST_FCALL:
+            // builtins are looked up by name, never through a slot
+            return node->param_count == 1 && node->fref.slot == UNRESOLVED.slot;
+        default:
+            return false;
+    }
+}
+
+// Applies one operation of the plan to its operands' values, unfused.
+Value_t fuse_apply(struct Fusion* fusion, const struct FuseNode* node) {
+    Value_t lhs = fusion->nodes[node->lhs].value;
+    Value_t rhs = fusion->nodes[node->rhs].value;
+
+    switch (node->kind) {
+        case FUSE_BINOP:
+            return broadcast_func2(array_op_func(node->op), lhs, rhs);
+        case FUSE_NEG:
+            return broadcast_func1(op_unary_minus, lhs);
+        case FUSE_NOT:
+            return broadcast_func1(op_unary_not, lhs);
+        case FUSE_FUNC:
+            return math_builtins[node->func](1, &lhs);
+        default:
+            return node->value;
+    }
+}
+
+bool is_number_leaf(const struct FuseNode* node) {
+    return node->kind == FUSE_LEAF && !is_list(node->value);
+}
+
+// Appends an operation on the nodes just collected, or its result if
+// those are all numbers. Returns its index.
+size_t fuse_push(struct Fusion* fusion, struct FuseNode node) {
+    if (is_number_leaf(&fusion->nodes[node.lhs]) &&
+        (node.kind != FUSE_BINOP || is_number_leaf(&fusion->nodes[node.rhs]))) {
+        Value_t value = fuse_apply(fusion, &node);
+        fusion->count = node.lhs;
+        node = (struct FuseNode){.kind = FUSE_LEAF, .value = value};
+    }
+
+    fusion->nodes[fusion->count] = node;
+    return fusion->count++;
+}
+
+size_t fuse_collect(struct Fusion* fusion, Node_t* node, size_t budget, Context_t* context);
 
-    if (rval.type == V_LIST && rval.list_size > 0) {
-        return broadcast_func2(op_or, lval, rval);
-    }
+// Collects both operands of node, using at most budget entries in all.
+size_t fuse_binop(struct Fusion* fusion, struct FuseNode node, Node_t* lhs, Node_t* rhs, size_t budget,
+                  Context_t* context) {
+    size_t start = fusion->count;
+    node.lhs = fuse_collect(fusion, lhs, budget - 2, context);
+    node.rhs = fuse_collect(fusion, rhs, budget - 1 - (fusion->count - start), context);
+    return fuse_push(fusion, node);
+}
 
-    if (is_truthy(rval)) {
-        return TRUE;
+size_t fuse_unary(struct Fusion* fusion, struct FuseNode node, Node_t* arg, size_t budget, Context_t* context) {
+    node.lhs = fuse_collect(fusion, arg, budget - 1, context);
+    return fuse_push(fusion, node);
+}
+
+size_t fuse_collect(struct Fusion* fusion, Node_t* node, size_t budget, Context_t* context) {
+    enum ArrayFunc f;
+
+    switch (node->type) {
+        case AST_BINOP:
+            if (budget >= 3 && binop_func(node->binop_type) != NULL) {
+                struct FuseNode op = {.kind = FUSE_BINOP, .op = array_op(binop_func(node->binop_type))};
+                return fuse_binop(fusion, op, NODE(node->lhs), NODE(node->rhs), budget, context);
+            }
+            break;
+        case AST_UNOP:
+            if (budget >= 2 && (node->unop_type == TOK_MINUS || node->unop_type == TOK_BANG)) {
+                struct FuseNode op = {.kind = node->unop_type == TOK_MINUS ? FUSE_NEG : FUSE_NOT};
+                return fuse_unary(fusion, op, NODE(node->node), budget, context);
+            }
+            break;
+        case AST_FCALL:
+            if (budget >= 2 && node->param_count == 1 &&
+                math_builtin(get_ref(context, node->fref, node->fname), &f)) {
+                struct FuseNode op = {.kind = FUSE_FUNC, .func = f};
+                return fuse_unary(fusion, op, NODE(LIST(node->params)[0]), budget, context);
+            }
+            break;
+        default:
+            break;
     }
 
-    return FALSE;
+    fusion->nodes[fusion->count] = (struct FuseNode){.kind = FUSE_LEAF, .value = eval(node, context)};
+    return fusion->count++;
 }
 
-Value_t eval_and(Context_t* context, Node_t* lhs, Node_t* rhs) {
-    Value_t lval = eval(lhs, context);
+Value_t fuse_run(struct Fusion* fusion) {
+    struct FuseNode* root = &fusion->nodes[fusion->count - 1];
+    if (root->kind == FUSE_LEAF) {
+        return root->value;
+    }
 
-    if (lval.type == V_LIST && lval.list_size > 0) {
-        return broadcast_func2(op_and, lval, eval(rhs, context));
+    Value_t result;
+    if (array_fused(fusion->nodes, fusion->count, &result)) {
+        return value_temp(result);
     }
 
-    if (!is_truthy(lval)) {
-        return FALSE;
+    for (size_t i = 0; i < fusion->count; ++i) {
+        if (fusion->nodes[i].kind != FUSE_LEAF) {
+            fusion->nodes[i].value = fuse_apply(fusion, &fusion->nodes[i]);
+        }
     }
+    return root->value;
+}
 
-    Value_t rval = eval(rhs, context);
+// Fuses the tree under an operation root on lhs, and on rhs for a binary
+// one. Kept apart from the eval functions, whose stack frames would
+// otherwise carry the plan through every level of recursion.
+Value_t eval_fused(Context_t* context, struct FuseNode root, Node_t* lhs, Node_t* rhs, bool* scalar) {
+    struct Fusion fusion;
+    fusion.count = 0;
 
-    if (rval.type == V_LIST && rval.list_size > 0) {
-        return broadcast_func2(op_and, lval, rval);
+    if (root.kind == FUSE_BINOP) {
+        fuse_binop(&fusion, root, lhs, rhs, FUSE_MAX, context);
+    } else {
+        fuse_unary(&fusion, root, lhs, FUSE_MAX, context);
     }
 
-    if (!is_truthy(rval)) {
-        return FALSE;
-    }
+    Value_t result = fuse_run(&fusion);
+    set_hint(scalar, !is_list(result));
+    return result;
+}
 
-    return TRUE;
+// The operators on two ints, or on two numbers as floats, as op_plus and
+// the others apply them.
+long long int_arith(Binop_t op, long long a, long long b) {
+    switch (op) {
+        case TOK_PLUS:
+            return a + b;
+        case TOK_MINUS:
+            return a - b;
+        case TOK_STAR:
+            return a * b;
+        case TOK_FSLASH:
+            return a / b;
+        case TOK_PERC:
+            return a % b;
+        case TOK_POWER:
+            return pow((double)a, (double)b);
+        default:
+            eval_error("unknown binop type: %s\n", tok_type_to_str(op));
+    }
 }
 
-Value_t eval_binop(Context_t* context, Binop_t op, Node_t* lhs, Node_t* rhs) {
+double float_arith(Binop_t op, double a, double b) {
     switch (op) {
         case TOK_PLUS:
-            return broadcast_func2(op_plus, eval(lhs, context), eval(rhs, context));
+            return a + b;
         case TOK_MINUS:
-            return broadcast_func2(op_minus, eval(lhs, context), eval(rhs, context));
+            return a - b;
         case TOK_STAR:
-            return broadcast_func2(op_times, eval(lhs, context), eval(rhs, context));
+            return a * b;
         case TOK_FSLASH:
-            return broadcast_func2(op_divide, eval(lhs, context), eval(rhs, context));
+            return a / b;
         case TOK_PERC:
-            return broadcast_func2(op_mod, eval(lhs, context), eval(rhs, context));
+            return fmod(a, b);
         case TOK_POWER:
-            return broadcast_func2(op_power, eval(lhs, context), eval(rhs, context));
+            return pow(a, b);
+        default:
+            eval_error("unknown binop type: %s\n", tok_type_to_str(op));
+    }
+}
+
+bool is_comparison(Binop_t op) {
+    switch (op) {
         case TOK_LT:
-            return broadcast_func2(op_lt, eval(lhs, context), eval(rhs, context));
         case TOK_GT:
-            return broadcast_func2(op_gt, eval(lhs, context), eval(rhs, context));
         case TOK_LEQ:
-            return broadcast_func2(op_leq, eval(lhs, context), eval(rhs, context));
         case TOK_GEQ:
-            return broadcast_func2(op_geq, eval(lhs, context), eval(rhs, context));
         case TOK_EEQ:
-            return broadcast_func2(op_eeq, eval(lhs, context), eval(rhs, context));
         case TOK_NEQ:
-            return broadcast_func2(op_neq, eval(lhs, context), eval(rhs, context));
-        case TOK_PIPE:
-            return eval_or(context, lhs, rhs);
-        case TOK_AMP:
-            return eval_and(context, lhs, rhs);
+            return true;
         default:
-            eval_error("unknown binop type: %s\n", tok_type_to_str(op));
-    };
+            return false;
+    }
+}
+
+bool int_compare(Binop_t op, long long a, long long b) {
+    switch (op) {
+        case TOK_LT:
+            return a < b;
+        case TOK_GT:
+            return a > b;
+        case TOK_LEQ:
+            return a <= b;
+        case TOK_GEQ:
+            return a >= b;
+        case TOK_EEQ:
+            return a == b;
+        default:
+            return a != b;
+    }
+}
+
+bool float_compare(Binop_t op, double a, double b) {
+    switch (op) {
+        case TOK_LT:
+            return a < b;
+        case TOK_GT:
+            return a > b;
+        case TOK_LEQ:
+            return a <= b;
+        case TOK_GEQ:
+            return a >= b;
+        case TOK_EEQ:
+            return a == b;
+        default:
+            return a != b;
+    }
+}
+
+// A binop node first takes note of the operands it sees (see enum
+// Operands). While they keep being two ints, or two floats, it computes on
+// them directly; operands of any other kind make it take the generic path
+// for good.
+Value_t eval_binop(Context_t* context, Binop_t op, Node_t* lhs, Node_t* rhs, bool* scalar, enum Operands* seen) {
+    Value_t (*func)(Value_t, Value_t) = binop_func(op);
+
+    if (!get_hint(scalar) && func != NULL && (is_fusable(lhs) || is_fusable(rhs))) {
+        struct FuseNode root = {.kind = FUSE_BINOP, .op = array_op(func)};
+        return eval_fused(context, root, lhs, rhs, scalar);
+    }
+
+    if (op == TOK_PIPE) {
+        return eval_or(context, lhs, rhs);
+    }
+    if (op == TOK_AMP) {
+        return eval_and(context, lhs, rhs);
+    }
+    if (func == NULL) {
+        eval_error("unknown binop type: %s\n", tok_type_to_str(op));
+    }
+
+    Value_t a = eval(lhs, context);
+    Value_t b = eval(rhs, context);
+
+    enum Operands was = __atomic_load_n(seen, __ATOMIC_RELAXED);
+    if (was == OPERANDS_INTS && a.type == V_INT && b.type == V_INT) {
+        if (is_comparison(op)) {
+            return int_compare(op, a.int_value, b.int_value) ? TRUE : FALSE;
+        }
+        return make_int(int_arith(op, a.int_value, b.int_value));
+    }
+    if (was == OPERANDS_FLOATS && a.type == V_FLOAT && b.type == V_FLOAT) {
+        if (is_comparison(op)) {
+            return float_compare(op, a.float_value, b.float_value) ? TRUE : FALSE;
+        }
+        return make_float(float_arith(op, a.float_value, b.float_value));
+    }
+    if (was != OPERANDS_OTHER) {
+        enum Operands now = OPERANDS_OTHER;
+        if (was == OPERANDS_UNSEEN && a.type == V_INT && b.type == V_INT) {
+            now = OPERANDS_INTS;
+        } else if (was == OPERANDS_UNSEEN && a.type == V_FLOAT && b.type == V_FLOAT) {
+            now = OPERANDS_FLOATS;
+        }
+        __atomic_store_n(seen, now, __ATOMIC_RELAXED);
+    }
+
+    Value_t result = broadcast_func2(func, a, b);
+    set_hint(scalar, !is_list(result));
+    return result;
 }
 
 Value_t op_length(Value_t value) {
     Value_t result = {.type = V_INT};
     switch (value.type) {
-        case V_LIST: {
+        case V_LIST:
+        case V_INT_ARRAY:
+        case V_FLOAT_ARRAY: {
             result.int_value = value.list_size;
         } break;
         case V_RANGE: {
-            Value_t list = range_to_list(value.range_value);
-            result.int_value = list.list_size;
+            if (value.range_value->length == UNDEF_SIZE) {
+                eval_error("infinite range has no length\n");
+            }
+            result.int_value = (long long)value.range_value->length;
         } break;
         case V_STRING: {
             result.int_value = (long long)strlen(value.string_value);
@@ -775,12 +2266,23 @@ Value_t op_length(Value_t value) {
     return result;
 }
 
-Value_t eval_unop(Context_t* context, Unop_t op, Node_t* node) {
+Value_t eval_unop(Context_t* context, Unop_t op, Node_t* node, bool* scalar) {
+    Value_t result;
+
+    if ((op == TOK_MINUS || op == TOK_BANG) && !get_hint(scalar) && is_fusable(node)) {
+        struct FuseNode root = {.kind = op == TOK_MINUS ? FUSE_NEG : FUSE_NOT};
+        return eval_fused(context, root, node, NULL, scalar);
+    }
+
     switch (op) {
         case TOK_MINUS:
-            return broadcast_func1(op_unary_minus, eval(node, context));
+            result = broadcast_func1(op_unary_minus, eval(node, context));
+            set_hint(scalar, !is_list(result));
+            return result;
         case TOK_BANG:
-            return broadcast_func1(op_unary_not, eval(node, context));
+            result = broadcast_func1(op_unary_not, eval(node, context));
+            set_hint(scalar, !is_list(result));
+            return result;
         case TOK_HASH:
             return op_length(eval(node, context));
         default:
@@ -788,135 +2290,403 @@ Value_t eval_unop(Context_t* context, Unop_t op, Node_t* node) {
     }
 }
 
-Value_t eval_assignment(Context_t* context, Node_t* ident, Value_t value) {
-    if (ident->type == AST_IDENTIFIER) {
-        set_value(context, ident->name, value);
-    } else if (ident->type == AST_IDX) {
-        Value_t list = get_value(context, ident->lname);
-        if (list.type == V_NIL) {
-            eval_error("did not find name in current context: %s\n", ident->lname);
+// Expressions that type inference proved to be ints or floats (see infer.c)
+// are computed on plain numbers, without checking tags or building values on
+// the way. Variables among them are always locals, so their slots are read
+// directly.
+long long eval_int(Node_t* node, Context_t* context);
+double eval_float(Node_t* node, Context_t* context);
+
+enum NumType num_type(Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return node->value.type == V_INT ? NUM_INT : node->value.type == V_FLOAT ? NUM_FLOAT : NUM_ANY;
+        case AST_IDENTIFIER:
+            return node->ref_num;
+        case AST_BINOP:
+            return node->binop_num;
+        case AST_UNOP:
+            return node->unop_num;
+        default:
+            return NUM_ANY;
+    }
+}
+
+// An operand of a float operation, which may be an int.
+static inline double eval_real(Node_t* node, Context_t* context) {
+    return num_type(node) == NUM_INT ? (double)eval_int(node, context) : eval_float(node, context);
+}
+
+bool eval_compare(Binop_t op, Node_t* lhs, Node_t* rhs, Context_t* context) {
+    if (num_type(lhs) == NUM_INT && num_type(rhs) == NUM_INT) {
+        long long a = eval_int(lhs, context);
+        return int_compare(op, a, eval_int(rhs, context));
+    }
+    double a = eval_real(lhs, context);
+    return float_compare(op, a, eval_real(rhs, context));
+}
+
+long long eval_int(Node_t* node, Context_t* context) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return node->value.int_value;
+        case AST_IDENTIFIER:
+            return context->slots[node->ref.slot].int_value;
+        case AST_UNOP:
+            switch (node->unop_type) {
+                case TOK_MINUS:
+                    return -eval_int(NODE(node->node), context);
+                case TOK_BANG:
+                    return eval_real(NODE(node->node), context) == 0;
+                default:
+                    return op_length(eval(NODE(node->node), context)).int_value;
+            }
+        case AST_BINOP: {
+            Node_t* lhs = NODE(node->lhs);
+            Node_t* rhs = NODE(node->rhs);
+            if (is_comparison(node->binop_type)) {
+                return eval_compare(node->binop_type, lhs, rhs, context);
+            }
+            long long a = eval_int(lhs, context);
+            return int_arith(node->binop_type, a, eval_int(rhs, context));
         }
-        Value_t idx = eval(ident->iexpr, context);
-        if (idx.type != V_INT) {
-            eval_error("cannot index using value type: %s\n", ident->lname);
+        default:
+            return eval(node, context).int_value;
+    }
+}
+
+double eval_float(Node_t* node, Context_t* context) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return node->value.float_value;
+        case AST_IDENTIFIER:
+            return context->slots[node->ref.slot].float_value;
+        case AST_UNOP:
+            // the only operator that gives a float
+            return -eval_float(NODE(node->node), context);
+        case AST_BINOP: {
+            double a = eval_real(NODE(node->lhs), context);
+            return float_arith(node->binop_type, a, eval_real(NODE(node->rhs), context));
         }
-        list.list_value[idx.int_value] = value;
+        default:
+            return eval(node, context).float_value;
+    }
+}
+
+Value_t eval_num(Context_t* context, Node_t* node, enum NumType type) {
+    return type == NUM_INT ? make_int(eval_int(node, context)) : make_float(eval_float(node, context));
+}
+
+// name op= value on a variable that holds a number of the type the update
+// keeps.
+Value_t eval_update_num(Context_t* context, Node_t* node) {
+    Value_t* home = &context->slots[NODE(node->ident)->ref.slot];
+    Node_t* rvalue = NODE(node->rvalue);
+
+    if (node->assign_num == NUM_INT) {
+        long long x = eval_int(rvalue, context);
+        home->int_value = int_arith(node->assign_op, home->int_value, x);
     } else {
+        double x = eval_real(rvalue, context);
+        home->float_value = float_arith(node->assign_op, home->float_value, x);
+    }
+    return *home;
+}
+
+// name op= value. A list is updated in place where the variable is all that
+// refers to it, and the result has the list's type.
+Value_t eval_update(Context_t* context, struct SlotRef ref, const char* name, Binop_t op, Value_t value) {
+    Value_t* home = ref_home(context, ref, name);
+    if (home != NULL && is_array(*home) && list_owned(*home, home, 0) && list_update(*home, binop_func(op), value)) {
+        Value_t result = *home;
+        value_pin(&result);
+        return result;
+    }
+
+    Value_t current = get_ref(context, ref, name);
+    if (current.type == V_NIL) {
+        eval_error("did not find name in current context: %s\n", name);
+    }
+    Value_t result = broadcast_func2(binop_func(op), current, value);
+    set_ref(context, ref, name, result);
+    return result;
+}
+
+Value_t eval_assignment(Context_t* context, Node_t* ident, Binop_t op, Node_t* rvalue) {
+    if (ident->type == AST_IDENTIFIER && op == TOK_EQ) {
+        Value_t value = eval(rvalue, context);
+        set_ref(context, ident->ref, ident->name, value);
+        return value;
+    }
+
+    // what evaluating the operands pinned would make the list look shared
+    size_t mark = temps_mark();
+    Value_t value = eval(rvalue, context);
+
+    if (ident->type == AST_IDENTIFIER) {
+        return eval_update(context, ident->ref, ident->name, op, temps_keep(mark, value));
+    }
+    if (ident->type != AST_IDX) {
         eval_error("unexpected lvalue type: %s\n", node_type_to_str(ident->type));
     }
+
+    Value_t idx = eval(NODE(ident->iexpr), context);
+    if (idx.type != V_INT) {
+        eval_error("cannot index using value type: %s\n", value_type_to_str(idx.type));
+    }
+    value = temps_keep(mark, value);
+
+    Value_t list = get_ref(context, ident->lref, ident->lname);
+    if (list.type == V_NIL) {
+        eval_error("did not find name in current context: %s\n", ident->lname);
+    }
+    if (op != TOK_EQ) {
+        value = broadcast_func2(binop_func(op), index_value(list, idx, ident->lname), value);
+    }
+
+    // a list found in an enclosing scope belongs to that scope, and writing
+    // it makes a copy local to this one, as assigning the name would
+    Value_t* home = ref_home(context, ident->lref, ident->lname);
+    bool owned = home != NULL && value_block(*home) == value_block(list) && list_owned(list, home, 0);
+    if (list_assign(&list, idx, value, owned)) {
+        set_ref(context, ident->lref, ident->lname, list);
+    }
+    return value;
+}
+
+Value_t eval_identifier(Context_t* context, struct SlotRef ref, const char* name) {
+    Value_t value = get_ref(context, ref, name);
+    value_pin(&value);
     return value;
 }
 
-Value_t eval_identifier(Context_t* context, const char* name) {
-    return get_value(context, name);
+// value[i] for an int i, or value[a..b] for an int range, on a list or a
+// range. Indexing a range computes the elements it asks for and slicing one
+// makes a new range, so neither enumerates the range.
+Value_t index_value(Value_t value, Value_t idx, const char* name) {
+    if (value.type == V_NIL) {
+        eval_error("did not find name in current context: %s\n", name);
+    }
+    if (!is_list(value) && value.type != V_RANGE) {
+        eval_error("cannot index value type: %s\n", value_type_to_str(value.type));
+    }
+    size_t length = value.type == V_RANGE ? value.range_value->length : value.list_size;
+
+    if (idx.type == V_RANGE) {
+        return value.type == V_RANGE ? range_slice(value.range_value, idx.range_value)
+                                     : list_slice(value, idx.range_value);
+    }
+    if (idx.type != V_INT) {
+        eval_error("cannot index using value type: %s\n", value_type_to_str(idx.type));
+    }
+    if (idx.int_value < 0 || (length != UNDEF_SIZE && (size_t)idx.int_value >= length)) {
+        eval_error("index out of range: %lld\n", idx.int_value);
+    }
+
+    if (value.type == V_RANGE) {
+        return range_get(value.range_value, idx.int_value);
+    }
+    Value_t elem = list_get(value, idx.int_value);
+    value_pin(&elem);
+    return elem;
+}
+
+Value_t eval_idx(Context_t* context, struct SlotRef ref, const char* name, Node_t* iexpr) {
+    Value_t value = get_ref(context, ref, name);
+    value_pin(&value);
+    return index_value(value, eval(iexpr, context), name);
 }
 
-Value_t eval_stmnts(Context_t* context, size_t stmnt_count, Node_t** stmnts) {
+// What a statement leaves behind is released before the next one runs.
+Value_t eval_stmnts(Context_t* context, size_t stmnt_count, NodeIdx_t* stmnts) {
     Value_t result = NIL;
+    size_t mark = temps_mark();
 
     for (size_t i = 0; i < stmnt_count; ++i) {
-        result = eval(stmnts[i], context);
+        temps_drain(mark);
+        result = eval(NODE(stmnts[i]), context);
     }
 
     return result;
 }
 
-Value_t eval_items(Context_t* context, size_t item_count, Node_t** items) {
-    Value_t result = NIL;
-
-    result.type = V_LIST;
-    result.list_size = item_count;
-    result.list_value = malloc(item_count * sizeof(Value_t));
+Value_t eval_items(Context_t* context, size_t item_count, NodeIdx_t* items) {
+    struct ListBuilder builder = list_builder(item_count);
 
     for (size_t i = 0; i < item_count; ++i) {
-        result.list_value[i] = eval(items[i], context);
+        list_push(&builder, eval(NODE(items[i]), context));
     }
 
-    return result;
+    return list_build(&builder);
+}
+
+Value_t eval_call(struct EvalFunc* f, const char* fname, size_t nargs, Value_t* args);
+
+// The function a call names, for a name the resolver could not place. A call
+// of a builtin remembers it and skips the lookup through every context on
+// the way there until the epoch of the caches moves on (see memo.h), as a
+// new name anywhere or another function bound to a name makes it do.
+Value_t find_callable(Context_t* context, NodeIdx_t site, const char* fname) {
+    struct CallSite* cache = NULL;
+    if (site < call_site_count && !__atomic_load_n(&call_sites_off, __ATOMIC_RELAXED)) {
+        cache = &call_sites[site];
+    }
+
+    size_t epoch = memo_epoch();
+    if (cache != NULL && __atomic_load_n(&cache->epoch, __ATOMIC_ACQUIRE) == epoch) {
+        return make_callable(__atomic_load_n(&cache->f, __ATOMIC_RELAXED));
+    }
+
+    Value_t callable = get_symbol(context, fname);
+    if (cache != NULL && callable.type == V_CALLABLE && ((EvalFunc_t*)callable.data)->context->parent == NULL) {
+        __atomic_store_n(&cache->f, callable.data, __ATOMIC_RELAXED);
+        __atomic_store_n(&cache->epoch, epoch, __ATOMIC_RELEASE);
+    }
+    return callable;
 }
 
-Value_t eval_fcall(Context_t* context, const char* fname, size_t param_count, Node_t** params) {
-    Value_t callable = get_value(context, fname);
-    if (callable.type == V_NIL) {
+Value_t eval_fcall(Context_t* context, NodeIdx_t site, struct SlotRef ref, const char* fname, size_t param_count,
+                   NodeIdx_t* params) {
+    Value_t callable = ref.slot < 0 ? find_callable(context, site, fname) : get_ref(context, ref, fname);
+    if (callable.type != V_CALLABLE) {
         eval_error("could not find function: %s\n", fname);
     }
     struct EvalFunc* f = callable.data;
 
-    struct Context local = context_new(f->context);
+    // the argument's hint stands in for the call's, which has no room for one
+    enum ArrayFunc math;
+    bool* scalar = param_count == 1 ? scalar_hint(NODE(params[0])) : NULL;
+    if (scalar != NULL && !get_hint(scalar) && is_fusable(NODE(params[0])) && math_builtin(callable, &math)) {
+        struct FuseNode root = {.kind = FUSE_FUNC, .func = math};
+        return eval_fused(context, root, NODE(params[0]), NULL, scalar);
+    }
 
-    Value_t* args = malloc(param_count * sizeof(Value_t));
+    size_t mark = temps_mark();
+    Value_t* args = frame_alloc(param_count);
     for (size_t i = 0; i < param_count; ++i) {
-        Value_t param = eval(params[i], context);
-        args[i] = param;
+        args[i] = eval(NODE(params[i]), context);
     }
 
     Value_t result = NIL;
     if (f->body != NULL) {
-        for (size_t i = 0; i < param_count; ++i) {
-            set_value(&local, f->params[i], args[i]);
+        result = eval_call(f, fname, param_count, args);
+    } else {
+        if (f->func != NULL) {
+            result = f->func(param_count, args);
         }
-        result = eval(f->body, &local);
-    } else if (f->func != NULL) {
-        result = f->func(param_count, args);
+        frame_free(args);
     }
 
-    return result;
+    return temps_keep(mark, result);
 }
 
-Value_t eval_fdef(Context_t* context, const char* fname, size_t param_count, Node_t** params, Node_t* body) {
+Value_t eval_fdef(Context_t* context, struct SlotRef ref, const char* fname, size_t param_count, NodeIdx_t* params,
+                  Node_t* body, struct Scope* scope) {
     const char** names = malloc(param_count * sizeof(const char*));
 
     for (size_t i = 0; i < param_count; ++i) {
-        if (params[i]->type != AST_IDENTIFIER) {
-            eval_error("expected identifier but got %s\n", node_type_to_str(params[i]->type));
+        Node_t* param = NODE(params[i]);
+        if (param->type != AST_IDENTIFIER) {
+            eval_error("expected identifier but got %s\n", node_type_to_str(param->type));
         }
-        names[i] = params[i]->name;
+        names[i] = param->name;
     }
 
     EvalFunc_t* ef = evalfunc_new(context, param_count, names, body, NULL);
+    ef->scope = scope;
+    ef->memo = memo_new(fname, param_count);
     Value_t callable = {.type = V_CALLABLE, .data = ef};
-    set_value(context, fname, callable);
+    set_ref(context, ref, fname, callable);
+    context->defines = true;
 
     return NIL;
 }
 
-Value_t eval_for(Context_t* context, const char* name, Node_t* expr, Node_t* body) {
+// Every iteration releases what the one before left behind, so a loop
+// runs in the memory of one iteration.
+Value_t eval_for(Context_t* context, struct SlotRef ref, const char* name, Node_t* expr, Node_t* body) {
     Value_t values = eval(expr, context);
+    size_t mark = temps_mark();
 
     Value_t value = NIL;
 
-    if (values.type == V_LIST) {
+    if (is_list(values)) {
         for (size_t i = 0; i < values.list_size; ++i) {
-            set_value(context, name, values.list_value[i]);
+            temps_drain(mark);
+            set_ref(context, ref, name, list_get(values, i));
             value = eval(body, context);
         }
 
+    } else if (values.type == V_RANGE && values.range_value->start.type == V_INT) {
+        const Range_t* range = values.range_value;
+        long long start = range->start.int_value;
+        long long step = range->step.int_value;
+        // while the variable holds an int, the next one just replaces it
+        Value_t* home = ref.slot >= 0 ? ref_home(context, ref, name) : NULL;
+        for (size_t i = 0; i < range->length; ++i) {
+            temps_drain(mark);
+            long long x = start + (long long)i * step;
+            if (home != NULL && home->type == V_INT) {
+                home->int_value = x;
+            } else {
+                set_ref(context, ref, name, make_int(x));
+            }
+            value = eval(body, context);
+        }
     } else if (values.type == V_RANGE) {
-        Range_t* range = values.range_value;
-        for (Value_t val = range_next(range); !range->done; val = range_next(range)) {
-            set_value(context, name, val);
+        const Range_t* range = values.range_value;
+        double start = range->start.float_value;
+        double step = range->step.float_value;
+        for (size_t i = 0; i < range->length; ++i) {
+            temps_drain(mark);
+            double x = i + 1 == range->length ? range->stop.float_value : start + (double)i * step;
+            set_ref(context, ref, name, make_float(x));
             value = eval(body, context);
         }
     } else {
-        set_value(context, name, values);
+        set_ref(context, ref, name, values);
         value = eval(body, context);
     }
 
     return value;
 }
 
-Value_t make_float_range_count(double xstart, double xstop, size_t xcount) {
-    Value_t value = {.type = V_RANGE};
+bool past_stop(double x, double stop, double step) {
+    return step > 0 ? x > stop : x < stop;
+}
 
-    double xstep = (xstop - xstart) / (xcount - 1);
-    value.range_value = range_new(make_float(xstart), make_float(xstop), make_float(xstep), xcount);
+// The number of elements start + i * step from start to stop inclusive,
+// with step pointing from start towards stop. The division may be off by
+// one either way, so the count is settled against the elements themselves.
+size_t float_range_length(double start, double stop, double step) {
+    double q = floor((stop - start) / step);
+    if (!(q >= 0.0 && q < 0x1p62)) {
+        return UNDEF_SIZE;
+    }
 
-    return value;
+    size_t length = (size_t)q + 1;
+    if (length > 1 && past_stop(start + (double)(length - 1) * step, stop, step)) {
+        --length;
+    } else if (!past_stop(start + (double)length * step, stop, step)) {
+        ++length;
+    }
+    return length;
 }
 
-Value_t make_int_range_count(long long xstart, long long xstop, size_t xcount) {
-    Value_t value = {.type = V_RANGE};
+// xcount elements evenly spaced from xstart to xstop, or xstart alone for a
+// count of one.
+Value_t make_float_range_count(double xstart, double xstop, size_t xcount) {
+    if (xcount == 1) {
+        return range_new(make_float(xstart), make_float(xstart), make_float(0.0), 1);
+    }
+    double xstep = (xstop - xstart) / (xcount - 1);
+    return range_new(make_float(xstart), make_float(xstop), make_float(xstep), xcount);
+}
 
+Value_t make_int_range_count(long long xstart, long long xstop, size_t xcount) {
+    if (xcount == 1) {
+        return range_new(make_int(xstart), make_int(xstart), make_int(0), 1);
+    }
     size_t divs = xcount - 1;
     size_t dist = distance(xstart, xstop);
     lldiv_t div = lldiv(dist, divs);
@@ -932,14 +2702,10 @@ Value_t make_int_range_count(long long xstart, long long xstop, size_t xcount) {
         step = -div.quot;
     }
 
-    value.range_value = range_new(make_int(xstart), make_int(xstop), make_int(step), xcount);
-
-    return value;
+    return range_new(make_int(xstart), make_int(xstop), make_int(step), xcount);
 }
 
 Value_t make_int_range_step(long long xstart, long long xstop, long long step) {
-    Value_t value = {.type = V_RANGE};
-
     if (step < 0) {
         step = -step;
     }
@@ -948,44 +2714,50 @@ Value_t make_int_range_step(long long xstart, long long xstop, long long step) {
         step = -step;
     }
 
-    value.range_value = range_new(make_int(xstart), make_int(xstop), make_int(step), UNDEF_SIZE);
+    if (step == 0) {
+        return range_new(make_int(xstart), INF, make_int(step), UNDEF_SIZE);
+    }
 
-    return value;
+    size_t length = distance(xstart, xstop) / distance(0, step) + 1;
+    long long last = xstart + (long long)(length - 1) * step;
+    return range_new(make_int(xstart), make_int(last), make_int(step), length);
 }
 
 Value_t make_int_range_inf(long long xstart, long long step) {
-    Value_t value = {.type = V_RANGE};
-
     if (step < 0) {
         step = -step;
     }
 
-    value.range_value = range_new(make_int(xstart), INF, make_int(step), UNDEF_SIZE);
-
-    return value;
+    return range_new(make_int(xstart), INF, make_int(step), UNDEF_SIZE);
 }
 
 Value_t make_float_range_step(double xstart, double xstop, double step) {
-    Value_t value = {.type = V_RANGE};
-
     step = fabs(step);
     if (xstart > xstop) {
         step = -step;
     }
 
-    value.range_value = range_new(make_float(xstart), make_float(xstop), make_float(step), UNDEF_SIZE);
-
-    return value;
+    size_t length = float_range_length(xstart, xstop, step);
+    Value_t last = length == UNDEF_SIZE ? INF : make_float(xstart + (double)(length - 1) * step);
+    return range_new(make_float(xstart), last, make_float(step), length);
 }
 
 Value_t make_float_range_inf(double xstart, double step) {
-    Value_t value = {.type = V_RANGE};
-
     step = fabs(step);
 
-    value.range_value = range_new(make_float(xstart), INF, make_float(step), UNDEF_SIZE);
+    return range_new(make_float(xstart), INF, make_float(step), UNDEF_SIZE);
+}
 
-    return value;
+// The count of a range a..b..n, which must be an int of at least 1.
+Value_t eval_count(Context_t* context, Node_t* count) {
+    Value_t vcount = eval(count, context);
+    if (vcount.type != V_INT) {
+        eval_error("expected count to be integer but got: %s\n", value_type_to_str(vcount.type));
+    }
+    if (vcount.int_value < 1) {
+        eval_error("expected count to be at least 1 but got: %lld\n", vcount.int_value);
+    }
+    return vcount;
 }
 
 Value_t eval_range(Context_t* context, Node_t* start, Node_t* stop, Node_t* count, Node_t* step) {
@@ -996,10 +2768,7 @@ Value_t eval_range(Context_t* context, Node_t* start, Node_t* stop, Node_t* coun
 
     if (vstop.type == V_INF) {
         if (count) {
-            Value_t vcount = eval(count, context);
-            if (vcount.type != V_INT) {
-                eval_error("expected count to be integer but got: %s\n", value_type_to_str(vcount.type));
-            }
+            Value_t vcount = eval_count(context, count);
 
             if (vstart.type == V_INT) {
                 long long xstop = vstart.int_value + vcount.int_value - 1;
@@ -1032,10 +2801,7 @@ Value_t eval_range(Context_t* context, Node_t* start, Node_t* stop, Node_t* coun
     }
 
     if (count) {
-        Value_t vcount = eval(count, context);
-        if (vcount.type != V_INT) {
-            eval_error("expected count to be integer but got: %s\n", value_type_to_str(vcount.type));
-        }
+        Value_t vcount = eval_count(context, count);
 
         if (vstart.type == V_INT && vstop.type == V_INT) {
             value = make_int_range_count(vstart.int_value, vstop.int_value, vcount.int_value);
@@ -1065,7 +2831,7 @@ Value_t eval_range(Context_t* context, Node_t* start, Node_t* stop, Node_t* coun
     return value;
 }
 
-Value_t eval_cmd(Context_t* context, const char* name, Node_t** args, size_t nargs) {
+Value_t eval_cmd(Context_t* context, const char* name, NodeIdx_t* args, size_t nargs) {
     Cmd_t cmd = get_cmd(name);
     Value_t value = cmd(context, nargs, args);
     return value;
@@ -1082,11 +2848,11 @@ Value_t eval_case(Context_t* context, Node_t* expr, Node_t* pred) {
     return value;
 };
 
-Value_t eval_cases(Context_t* context, size_t stmnt_count, Node_t** stmnts) {
+Value_t eval_cases(Context_t* context, size_t stmnt_count, NodeIdx_t* stmnts) {
     Value_t result = NIL;
 
     for (size_t i = 0; i < stmnt_count; ++i) {
-        result = eval(stmnts[i], context);
+        result = eval(NODE(stmnts[i]), context);
         if (result.type != V_NIL) {
             return result;
         }
@@ -1095,38 +2861,160 @@ Value_t eval_cases(Context_t* context, size_t stmnt_count, Node_t** stmnts) {
     return result;
 }
 
+// Evaluates node as the body of a call, except that a call in tail position
+// is left in *call for eval_call to make in the same frame.
+Value_t eval_tail(Context_t* context, Node_t* node, Node_t** call) {
+    switch (node->type) {
+        case AST_FCALL:
+            *call = node;
+            return NIL;
+        case AST_BLOCK: {
+            if (node->stmnt_count == 0) {
+                return NIL;
+            }
+            size_t last = node->stmnt_count - 1;
+            size_t mark = temps_mark();
+            eval_stmnts(context, last, LIST(node->stmnts));
+            temps_drain(mark);
+            return eval_tail(context, CHILD(node->stmnts, last), call);
+        }
+        case AST_CASES: {
+            if (node->stmnt_count == 0) {
+                return NIL;
+            }
+            size_t last = node->stmnt_count - 1;
+            Value_t result = eval_cases(context, last, LIST(node->stmnts));
+            if (result.type != V_NIL) {
+                return result;
+            }
+            return eval_tail(context, CHILD(node->stmnts, last), call);
+        }
+        case AST_CASE:
+            if (!is_truthy(eval(NODE(node->pred), context))) {
+                return NIL;
+            }
+            return eval_tail(context, NODE(node->cexpr), call);
+        default:
+            return eval(node, context);
+    }
+}
+
+// Runs the scripted function f on the nargs values on top of the frame
+// stack, which it pops. A call in tail position to another scripted
+// function replaces the frame instead of nesting in it, so such recursion
+// runs in constant space.
+Value_t eval_call(struct EvalFunc* f, const char* fname, size_t nargs, Value_t* args) {
+    check_stack();
+    size_t mark = temps_mark();
+    struct Memo* memo = nargs == f->param_count ? func_memo(f) : NULL;
+    struct MemoTicket ticket = {.index = SIZE_MAX};
+    Value_t cached;
+    if (memo != NULL && memo_lookup(memo, args, &cached, &ticket)) {
+        frame_free(args);
+        return cached;
+    }
+    frame_free(args);
+
+    for (;;) {
+        if (nargs != f->param_count) {
+            eval_error("%s: expected %zu arguments but got: %zu\n", fname, f->param_count, nargs);
+        }
+        for (size_t i = 0; i < nargs; ++i) {
+            value_retain(args[i]);
+        }
+        Context_t local;
+        context_push(&local, f->context, f->scope, nargs, args);
+        // what the arguments were made under is held by the slots now
+        temps_drain(mark);
+
+        Node_t* call = NULL;
+        Value_t result = eval_tail(&local, f->body, &call);
+        if (call != NULL) {
+            Value_t callable = get_ref(&local, call->fref, call->fname);
+            if (callable.type == V_CALLABLE && ((struct EvalFunc*)callable.data)->body != NULL) {
+                size_t count = call->param_count;
+                args = frame_alloc(count);
+                for (size_t i = 0; i < count; ++i) {
+                    args[i] = eval(CHILD(call->params, i), &local);
+                }
+                if (frame_replaceable(&local, callable.data, count, args)) {
+                    // the temporaries keep the arguments while the slots
+                    // under them are popped and taken over by the next round
+                    f = callable.data;
+                    fname = call->fname;
+                    nargs = count;
+                    context_pop(&local);
+                    continue;
+                }
+                result = eval_call(callable.data, call->fname, count, args);
+            } else {
+                result = eval(call, &local);
+            }
+        }
+
+        frame_result(&local, result);
+        context_pop(&local);
+        if (memo != NULL) {
+            // a tail call's value is the value of the call it replaced
+            memo_store(memo, ticket, result);
+        }
+        return temps_keep(mark, result);
+    }
+}
+
 struct AstValue eval(struct AstNode* node, struct Context* context) {
+    Node_t* sig;
+
     switch (node->type) {
         case AST_LITERAL:
             return node->value;
         case AST_BINOP:
-            return eval_binop(context, node->binop_type, node->lhs, node->rhs);
+            if (node->binop_num != NUM_ANY) {
+                return eval_num(context, node, node->binop_num);
+            }
+            return eval_binop(context, node->binop_type, NODE(node->lhs), NODE(node->rhs), &node->binop_scalar,
+                              &node->binop_seen);
         case AST_UNOP:
-            return eval_unop(context, node->unop_type, node->node);
+            if (node->unop_num != NUM_ANY) {
+                return eval_num(context, node, node->unop_num);
+            }
+            return eval_unop(context, node->unop_type, NODE(node->node), &node->unop_scalar);
         case AST_IDENTIFIER:
-            return eval_identifier(context, node->name);
+            if (node->ref_num != NUM_ANY) {
+                return context->slots[node->ref.slot];
+            }
+            return eval_identifier(context, node->ref, node->name);
+        case AST_IDX:
+            return eval_idx(context, node->lref, node->lname, NODE(node->iexpr));
         case AST_ASSIGNMENT:
-            return eval_assignment(context, node->ident, eval(node->rvalue, context));
+            if (node->assign_num != NUM_ANY) {
+                return eval_update_num(context, node);
+            }
+            return eval_assignment(context, NODE(node->ident), node->assign_op, NODE(node->rvalue));
         case AST_PROGRAM:
-            return eval_stmnts(context, node->stmnt_count, node->stmnts);
+            return eval_stmnts(context, node->stmnt_count, LIST(node->stmnts));
         case AST_ITEMS:
-            return eval_items(context, node->item_count, node->items);
+            return eval_items(context, node->item_count, LIST(node->items));
         case AST_FCALL:
-            return eval_fcall(context, node->fname, node->param_count, node->params);
+            return eval_fcall(context, node - ast.cells, node->fref, node->fname, node->param_count,
+                              LIST(node->params));
         case AST_FDEF:
-            return eval_fdef(context, node->fname, node->param_count, node->params, node->fbody);
+            sig = NODE(node->fsig);
+            return eval_fdef(context, sig->fref, sig->fname, sig->param_count, LIST(sig->params), NODE(node->fbody),
+                             node->fscope);
         case AST_BLOCK:
-            return eval_stmnts(context, node->stmnt_count, node->stmnts);
+            return eval_stmnts(context, node->stmnt_count, LIST(node->stmnts));
         case AST_FOR:
-            return eval_for(context, node->lvar, node->lexpr, node->lbody);
+            return eval_for(context, node->vref, node->lvar, NODE(node->lexpr), NODE(node->lbody));
         case AST_RANGE:
-            return eval_range(context, node->rstart, node->rstop, node->rcount, node->rstep);
+            return eval_range(context, NODE(node->rstart), NODE(node->rstop), node->rcount ? NODE(node->rcount) : NULL,
+                              node->rstep ? NODE(node->rstep) : NULL);
         case AST_CMD:
-            return eval_cmd(context, node->cmd, node->cargs, node->carg_count);
+            return eval_cmd(context, node->cmd, LIST(node->cargs), node->carg_count);
         case AST_CASE:
-            return eval_case(context, node->cexpr, node->pred);
+            return eval_case(context, NODE(node->cexpr), NODE(node->pred));
         case AST_CASES:
-            return eval_cases(context, node->stmnt_count, node->stmnts);
+            return eval_cases(context, node->stmnt_count, LIST(node->stmnts));
         default:
             eval_error("unknown AST node type: %s\n", node_type_to_str(node->type));
             exit(1);
@@ -1,39 +1,168 @@
 #ifndef EVALER_H
 #define EVALER_H
 
+#include "map.h"
 #include "parser.h"
 
-struct Item {
-    const char* key;
-    struct AstValue value;
-};
-
-struct Map {
-    size_t capacity;
-    size_t size;
-    struct Item* items;
-};
-
+// Names the resolver knows about live in slots, laid out by scope. The map
+// holds everything bound at runtime by name (builtins, plugins).
 struct Context {
     struct Context* parent;
     struct Map map;
     bool read_only;
+    bool defines;  // a function was defined in it
+    struct Scope* scope;
+    struct AstValue* slots;
 };
 
+struct Chunk;
+struct Memo;
+
 struct EvalFunc {
     struct Context* context;
     const char** params;  // used for scripted functions
     size_t param_count;
     struct AstNode* body;                               // used for scripted functions
+    struct Scope* scope;                                // used for scripted functions
     struct AstValue (*func)(size_t, struct AstValue*);  // used for builtin functions
+    bool pure;                                          // no side effects, may be called at parse time
+    struct Chunk* chunk;                                // compiled body, filled in lazily by the VM
+    struct Memo* memo;                                  // cached results, for scripted functions
 };
 
-struct Map map_new();
-struct Context context_new(struct Context* parent);
+extern const struct AstValue NIL;
+extern const struct AstValue TRUE;
+extern const struct AstValue FALSE;
+
+// Makes table print comma separated values instead of aligned columns.
+void table_use_csv(bool csv);
+
+// number of values in the stack of each thread that holds the slots of
+// calls and the registers of the VM
+#define FRAME_STACK_SIZE (1 << 20)
+
+struct Context context_new(struct Context* parent, struct Scope* scope);
+// Releases the values of a context that is no longer used, such as the
+// globals at exit.
+void context_free(struct Context* context);
+
+// count values on top of the frame stack, left uninitialized, and the
+// values from base up popped off again.
+struct AstValue* frame_alloc(size_t count);
+void frame_free(struct AstValue* base);
+// Sets up context for a call, with its slots on top of the frame stack and
+// the parameters bound to the nargs values at args, whose references it
+// takes. args may lie in the part of the frame stack just freed.
+void context_push(struct Context* context, struct Context* parent, struct Scope* scope, size_t nargs,
+                  struct AstValue* args);
+// Releases a context made by context_push and pops its slots.
+void context_pop(struct Context* context);
+// Whether a call from context may take over its frame: neither the callee
+// nor an argument is a function defined in it, which would outlive it.
+bool frame_replaceable(struct Context* context, struct EvalFunc* f, size_t nargs, struct AstValue* args);
+// Checks that the value a call returns from context does not hold a
+// function defined in it, and returns it.
+struct AstValue frame_result(struct Context* context, struct AstValue result);
+// The cache to look calls of f up in, or NULL when f may depend on more
+// than its arguments or caching is off for it.
+struct Memo* func_memo(struct EvalFunc* f);
 void setup_builtin_context(struct Context* context);
+// Sets up the cache of the builtins that calls found, one entry for each
+// node of the tree, which must be final by then; call_sites_free drops it.
+void call_sites_init(void);
+void call_sites_free(void);
 
 struct AstValue get_value(struct Context* context, const char* name);
 void set_value(struct Context* context, const char* name, struct AstValue value);
+struct AstValue get_symbol(struct Context* context, const char* sym);
+void set_symbol(struct Context* context, const char* sym, struct AstValue value);
+struct AstValue get_ref(struct Context* context, struct SlotRef ref, const char* name);
+void set_ref(struct Context* context, struct SlotRef ref, const char* name, struct AstValue value);
+// How many times set_ref has stored into an enclosing context, such as the
+// element of an outer list a call writes. Copies of variables made before
+// stay valid while it is the same.
+extern _Thread_local size_t outer_stores;
+// The slot set_ref stores name in, or NULL for a name it would add to the
+// map.
+struct AstValue* ref_home(struct Context* context, struct SlotRef ref, const char* name);
+
+// Builds a list one element at a time. It stays packed while every element
+// is an int, or every element a float, and switches to tagged values at the
+// first element that does not fit.
+struct ListBuilder {
+    struct AstValue list;
+    size_t capacity;
+};
+
+struct ListBuilder list_builder(size_t capacity);
+void list_push(struct ListBuilder* builder, struct AstValue value);
+// Finishes the list and hands it to the temporaries of heap.h.
+struct AstValue list_build(struct ListBuilder* builder);
+
+bool is_list(struct AstValue value);
+struct AstValue list_get(struct AstValue list, size_t i);
+// Returns true when the list had to be unpacked, changing list itself into a
+// new temporary that the caller stores in place of the old list.
+bool list_set(struct AstValue* list, size_t i, struct AstValue value);
+// Whether list may be written in place: the references to its elements
+// are holders, plus the one in home if that holds the list.
+bool list_owned(struct AstValue list, const struct AstValue* home, size_t holders);
+// list[idx] = value, written in place if owned and into a copy otherwise.
+// Returns true when list changed into a new temporary, like list_set.
+bool list_assign(struct AstValue* list, struct AstValue idx, struct AstValue value, bool owned);
+// list = list func value in place, for a packed list that may be written.
+// Returns false where the result would be a new list.
+bool list_update(struct AstValue list, struct AstValue (*func)(struct AstValue, struct AstValue), struct AstValue value);
+// value[idx] for an element or a slice of a list or range; name is the
+// variable that holds value, for errors.
+struct AstValue index_value(struct AstValue value, struct AstValue idx, const char* name);
+
+bool is_truthy(struct AstValue value);
+
+// Walks a range without changing it.
+struct RangeCursor {
+    const struct RangeValue* range;
+    size_t index;
+};
+
+struct AstValue range_get(const struct RangeValue* range, size_t i);
+struct RangeCursor range_cursor(const struct RangeValue* range);
+// Returns false once the cursor has passed the last element.
+bool range_next(struct RangeCursor* cursor, struct AstValue* value);
+struct AstValue range_to_list(const struct RangeValue* range);
+// x func c, or c func x if not range_lhs, for every element x of range as
+// another range: + and - of a number, * by a number and / by a number that
+// keeps the elements exact. NIL for anything that is not such a sequence.
+struct AstValue range_affine(struct AstValue (*func)(struct AstValue, struct AstValue), const struct RangeValue* range,
+                             struct AstValue c, bool range_lhs);
+// Closed-form reductions, an error for infinite ranges where they diverge.
+struct AstValue range_sum(const struct RangeValue* range);
+struct AstValue range_min(const struct RangeValue* range);
+struct AstValue range_max(const struct RangeValue* range);
+
+struct AstValue broadcast_func1(struct AstValue (*func)(struct AstValue), struct AstValue value);
+struct AstValue broadcast_func2(struct AstValue (*func)(struct AstValue, struct AstValue), struct AstValue lhs,
+                                struct AstValue rhs);
+
+struct AstValue op_plus(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_minus(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_times(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_divide(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_mod(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_power(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_or(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_and(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_lt(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_gt(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_leq(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_geq(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_eeq(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_neq(struct AstValue lhs, struct AstValue rhs);
+struct AstValue op_unary_minus(struct AstValue value);
+struct AstValue op_unary_not(struct AstValue value);
+struct AstValue op_length(struct AstValue value);
+// < > <= >= == and !=, which give an int for any two numbers.
+bool is_comparison(enum TokenType op);
 
 struct AstValue eval(struct AstNode* node, struct Context* context);
 
@@ -0,0 +1,376 @@
+#include "fmt.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the digits of n backwards, two at a time, ending just before end.
+char* fmt_digits(uint64_t n, char* end) {
+    while (n >= 100) {
+        end -= 2;
+        memcpy(end, digit_pairs + 2 * (n % 100), 2);
+        n /= 100;
+    }
+    if (n >= 10) {
+        end -= 2;
+        memcpy(end, digit_pairs + 2 * n, 2);
+    } else {
+        *--end = (char)('0' + n);
+    }
+    return end;
+}
+
+size_t fmt_int(long long n, char* out) {
+    char buf[FMT_MAX];
+    char* end = buf + sizeof(buf);
+    // negated as unsigned, which also covers LLONG_MIN
+    char* start = fmt_digits(n < 0 ? -(uint64_t)n : (uint64_t)n, end);
+    if (n < 0) {
+        *--start = '-';
+    }
+    memcpy(out, start, end - start);
+    return end - start;
+}
+
+// Grisu2 as described by Florian Loitsch in "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers", after Milo Yip's dtoa.
+
+// f * 2^e
+struct DiyFp {
+    uint64_t f;
+    int e;
+};
+
+#define HIDDEN_BIT (1ull << 52)
+
+// 10^k rounded to 64 bits, for k = -348, -340, ..., 340
+const struct DiyFp cached_powers[] = {
+    {0xfa8fd5a0081c0288, -1220}, {0xbaaee17fa23ebf76, -1193}, {0x8b16fb203055ac76, -1166},
+    {0xcf42894a5dce35ea, -1140}, {0x9a6bb0aa55653b2d, -1113}, {0xe61acf033d1a45df, -1087},
+    {0xab70fe17c79ac6ca, -1060}, {0xff77b1fcbebcdc4f, -1034}, {0xbe5691ef416bd60c, -1007},
+    {0x8dd01fad907ffc3c, -980},  {0xd3515c2831559a83, -954},  {0x9d71ac8fada6c9b5, -927},
+    {0xea9c227723ee8bcb, -901},  {0xaecc49914078536d, -874},  {0x823c12795db6ce57, -847},
+    {0xc21094364dfb5637, -821},  {0x9096ea6f3848984f, -794},  {0xd77485cb25823ac7, -768},
+    {0xa086cfcd97bf97f4, -741},  {0xef340a98172aace5, -715},  {0xb23867fb2a35b28e, -688},
+    {0x84c8d4dfd2c63f3b, -661},  {0xc5dd44271ad3cdba, -635},  {0x936b9fcebb25c996, -608},
+    {0xdbac6c247d62a584, -582},  {0xa3ab66580d5fdaf6, -555},  {0xf3e2f893dec3f126, -529},
+    {0xb5b5ada8aaff80b8, -502},  {0x87625f056c7c4a8b, -475},  {0xc9bcff6034c13053, -449},
+    {0x964e858c91ba2655, -422},  {0xdff9772470297ebd, -396},  {0xa6dfbd9fb8e5b88f, -369},
+    {0xf8a95fcf88747d94, -343},  {0xb94470938fa89bcf, -316},  {0x8a08f0f8bf0f156b, -289},
+    {0xcdb02555653131b6, -263},  {0x993fe2c6d07b7fac, -236},  {0xe45c10c42a2b3b06, -210},
+    {0xaa242499697392d3, -183},  {0xfd87b5f28300ca0e, -157},  {0xbce5086492111aeb, -130},
+    {0x8cbccc096f5088cc, -103},  {0xd1b71758e219652c, -77},   {0x9c40000000000000, -50},
+    {0xe8d4a51000000000, -24},   {0xad78ebc5ac620000, 3},     {0x813f3978f8940984, 30},
+    {0xc097ce7bc90715b3, 56},    {0x8f7e32ce7bea5c70, 83},    {0xd5d238a4abe98068, 109},
+    {0x9f4f2726179a2245, 136},   {0xed63a231d4c4fb27, 162},   {0xb0de65388cc8ada8, 189},
+    {0x83c7088e1aab65db, 216},   {0xc45d1df942711d9a, 242},   {0x924d692ca61be758, 269},
+    {0xda01ee641a708dea, 295},   {0xa26da3999aef774a, 322},   {0xf209787bb47d6b85, 348},
+    {0xb454e4a179dd1877, 375},   {0x865b86925b9bc5c2, 402},   {0xc83553c5c8965d3d, 428},
+    {0x952ab45cfa97a0b3, 455},   {0xde469fbd99a05fe3, 481},   {0xa59bc234db398c25, 508},
+    {0xf6c69a72a3989f5c, 534},   {0xb7dcbf5354e9bece, 561},   {0x88fcf317f22241e2, 588},
+    {0xcc20ce9bd35c78a5, 614},   {0x98165af37b2153df, 641},   {0xe2a0b5dc971f303a, 667},
+    {0xa8d9d1535ce3b396, 694},   {0xfb9b7cd9a4a7443c, 720},   {0xbb764c4ca7a44410, 747},
+    {0x8bab8eefb6409c1a, 774},   {0xd01fef10a657842c, 800},   {0x9b10a4e5e9913129, 827},
+    {0xe7109bfba19c0c9d, 853},   {0xac2820d9623bf429, 880},   {0x80444b5e7aa7cf85, 907},
+    {0xbf21e44003acdd2d, 933},   {0x8e679c2f5e44ff8f, 960},   {0xd433179d9c8cb841, 986},
+    {0x9e19db92b4e31ba9, 1013},  {0xeb96bf6ebadf77d9, 1039},  {0xaf87023b9bf0ee6b, 1066},
+};
+
+const uint64_t powers_of_10[] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+// the product rounded to its upper 64 bits
+struct DiyFp diy_mul(struct DiyFp a, struct DiyFp b) {
+    unsigned __int128 p = (unsigned __int128)a.f * b.f;
+    uint64_t h = (uint64_t)(p >> 64);
+    uint64_t l = (uint64_t)p;
+    return (struct DiyFp){h + (l >> 63), a.e + b.e + 64};
+}
+
+struct DiyFp diy_normalize(struct DiyFp x) {
+    int shift = __builtin_clzll(x.f);
+    return (struct DiyFp){x.f << shift, x.e - shift};
+}
+
+// The neighbours of x halfway to the next doubles down and up, with the
+// exponent of the upper one, so that every number between them reads back
+// as x. Below a power of two the lower gap is half as wide.
+void diy_boundaries(struct DiyFp x, struct DiyFp* minus, struct DiyFp* plus) {
+    *plus = diy_normalize((struct DiyFp){(x.f << 1) + 1, x.e - 1});
+    *minus = x.f == HIDDEN_BIT ? (struct DiyFp){(x.f << 2) - 1, x.e - 2} : (struct DiyFp){(x.f << 1) - 1, x.e - 1};
+    minus->f <<= minus->e - plus->e;
+    minus->e = plus->e;
+}
+
+// A cached 10^-k that brings a number of binary exponent e to an exponent
+// in [-60, -32], where its integer part fits 32 bits.
+struct DiyFp cached_power(int e, int* k) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0) {
+        ++ik;
+    }
+    size_t index = (size_t)((ik >> 3) + 1);
+    *k = -(-348 + (int)index * 8);
+    return cached_powers[index];
+}
+
+// Moves the last digit down while that keeps it within delta of the upper
+// bound and brings it closer to w, which lies wp_w below the upper bound.
+void grisu_round(char* digits, size_t len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        --digits[len - 1];
+        rest += ten_kappa;
+    }
+}
+
+// The bounds were narrowed by err units each for the error of the products.
+// Whether one digit fewer, whose rest was above delta, might have done
+// between the true bounds: its rest is within the widened delta, or the
+// upper bound carries into its last digit.
+static inline bool grisu_near(uint64_t rest, uint64_t delta, uint64_t ten_kappa, uint64_t err) {
+    return rest - delta <= 2 * err || ten_kappa - rest <= 2 * err;
+}
+
+// Generates the digits of the upper bound mp until the rest is within delta,
+// that is until the digits so far lie between the bounds. *unsure is set
+// where one digit fewer might have done between the true bounds, so that
+// any fewer might.
+size_t grisu_digits(struct DiyFp w, struct DiyFp mp, uint64_t delta, char* digits, int* k, bool* unsure) {
+    struct DiyFp one = {1ull << -mp.e, mp.e};
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    size_t len = 0;
+
+    int kappa = 10;
+    while (kappa > 0 && powers_of_10[kappa - 1] > p1) {
+        --kappa;
+    }
+
+    while (kappa > 0) {
+        uint32_t d = (uint32_t)(p1 / powers_of_10[kappa - 1]);
+        p1 %= powers_of_10[kappa - 1];
+        if (d != 0 || len != 0) {
+            digits[len++] = (char)('0' + d);
+        }
+        --kappa;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            uint64_t ten_kappa = powers_of_10[kappa] << -one.e;
+            *unsure = len > 1 && grisu_near(rest + d * ten_kappa, delta, 10 * ten_kappa, 1);
+            *k += kappa;
+            grisu_round(digits, len, delta, rest, ten_kappa, wp_w);
+            return len;
+        }
+    }
+
+    // the error grows tenfold with every digit, as delta does
+    uint64_t err = 1;
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        err *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d != 0 || len != 0) {
+            digits[len++] = (char)('0' + d);
+        }
+        p2 &= one.f - 1;
+        --kappa;
+        if (p2 < delta) {
+            // the digit before, scaled by ten like delta
+            *unsure = len > 1 && grisu_near(p2 + (uint64_t)d * one.f, delta, 10 * one.f, err);
+            *k += kappa;
+            grisu_round(digits, len, delta, p2, one.f, -kappa < 20 ? wp_w * powers_of_10[-kappa] : 0);
+            return len;
+        }
+    }
+}
+
+// Whether c * 10^k reads back as x.
+bool reads_back(uint64_t c, int k, double x) {
+    char buf[FMT_MAX];
+    char* end = buf + sizeof(buf) - 1;
+    *end = '\0';
+    char* p = fmt_digits(k < 0 ? -(uint64_t)k : (uint64_t)k, end);
+    if (k < 0) {
+        *--p = '-';
+    }
+    *--p = 'e';
+    p = fmt_digits(c, p);
+    return strtod(p, NULL) == x;
+}
+
+// The len digits Grisu2 gave for x may be longer than the shortest that
+// reads back, as it narrows the bounds by the error of its products. Fewer
+// digits are tried, one at a time, for as long as one of the decimals
+// around x at that length reads back; the one nearest x is kept.
+size_t grisu_shorten(double x, char* digits, size_t len, int* k) {
+    uint64_t d = 0;
+    for (size_t i = 0; i < len; ++i) {
+        d = d * 10 + (uint64_t)(digits[i] - '0');
+    }
+
+    uint64_t best = 0;
+    size_t best_n = len;
+    for (size_t n = len - 1; n > 0; --n) {
+        uint64_t scale = powers_of_10[len - n];
+        uint64_t c = d / scale;
+        uint64_t found = 0;
+        uint64_t found_dist = 0;
+        for (uint64_t cand = c - 1; cand <= c + 1; ++cand) {
+            if (cand == 0 || !reads_back(cand, *k + (int)(len - n), x)) {
+                continue;
+            }
+            uint64_t dist = cand * scale > d ? cand * scale - d : d - cand * scale;
+            if (found == 0 || dist < found_dist) {
+                found = cand;
+                found_dist = dist;
+            }
+        }
+        if (found == 0) {
+            break;
+        }
+        best = found;
+        best_n = n;
+    }
+    if (best_n == len) {
+        return len;
+    }
+
+    *k += (int)(len - best_n);
+    while (best % 10 == 0) {
+        best /= 10;
+        ++*k;
+    }
+    char buf[20];
+    char* start = fmt_digits(best, buf + sizeof(buf));
+    len = buf + sizeof(buf) - start;
+    memcpy(digits, start, len);
+    return len;
+}
+
+// Digits of a positive finite x, such that x = digits * 10^k.
+size_t grisu2(double x, char* digits, int* k) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    int biased = (int)(u >> 52);
+    uint64_t mantissa = u & (HIDDEN_BIT - 1);
+    struct DiyFp v = biased != 0 ? (struct DiyFp){mantissa | HIDDEN_BIT, biased - 1075}
+                                 : (struct DiyFp){mantissa, -1074};
+
+    struct DiyFp minus;
+    struct DiyFp plus;
+    diy_boundaries(v, &minus, &plus);
+
+    struct DiyFp c_mk = cached_power(plus.e, k);
+    struct DiyFp w = diy_mul(diy_normalize(v), c_mk);
+    struct DiyFp wp = diy_mul(plus, c_mk);
+    struct DiyFp wm = diy_mul(minus, c_mk);
+    // narrowed by the error of the products
+    ++wm.f;
+    --wp.f;
+    bool unsure;
+    size_t len = grisu_digits(w, wp, wp.f - wm.f, digits, k, &unsure);
+    if (unsure) {
+        len = grisu_shorten(x, digits, len, k);
+    }
+    return len;
+}
+
+size_t fmt_float(double x, char* out) {
+    char* p = out;
+    if (x != x) {
+        memcpy(p, "nan", 3);
+        return 3;
+    }
+    if (__builtin_signbit(x)) {
+        *p++ = '-';
+        x = -x;
+    }
+    if (x == __builtin_inf()) {
+        memcpy(p, "inf", 3);
+        return p - out + 3;
+    }
+    if (x == 0.0) {
+        memcpy(p, "0.0", 3);
+        return p - out + 3;
+    }
+
+    char digits[20];
+    int k;
+    size_t len = grisu2(x, digits, &k);
+    // the point goes after the first point digits
+    int point = (int)len + k;
+
+    if (point > 16 || point < -3) {
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        int exp = point - 1;
+        *p++ = 'e';
+        *p++ = exp < 0 ? '-' : '+';
+        exp = exp < 0 ? -exp : exp;
+        if (exp < 10) {
+            *p++ = '0';
+        }
+        p += fmt_int(exp, p);
+    } else if (point >= (int)len) {
+        memcpy(p, digits, len);
+        p += len;
+        memset(p, '0', point - len);
+        p += point - len;
+        memcpy(p, ".0", 2);
+        p += 2;
+    } else if (point > 0) {
+        memcpy(p, digits, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, digits + point, len - point);
+        p += len - point;
+    } else {
+        memcpy(p, "0.", 2);
+        p += 2;
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, digits, len);
+        p += len;
+    }
+    return p - out;
+}
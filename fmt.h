@@ -0,0 +1,23 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stddef.h>
+
+// Longest text of fmt_int and fmt_float, such as -2.2250738585072014e-308.
+#define FMT_MAX 32
+
+// Writes n in decimal to out, without a terminating zero, and returns the
+// length.
+size_t fmt_int(long long n, char* out);
+
+// Writes the shortest decimal that reads back as x, found with Grisu2, and
+// returns the length. Floats always show a point or an exponent, as in
+// 0.1, 5.0 and 1e+16, so that they read back as floats; exponents are used
+// below 1e-4 and from 1e16 on. Where the error of Grisu2 leaves it unsure
+// that its digits are the fewest, about one double in 1000, shorter ones are
+// checked by reading them back.
+size_t fmt_float(double x, char* out);
+
+#endif
+
+// vim: ft=c
@@ -0,0 +1,133 @@
+#include "heap.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+struct HeapBlock {
+    size_t refs;
+    size_t size;    // bytes of data
+    size_t values;  // tagged values at the start of data
+    max_align_t data[];
+};
+
+typedef struct HeapBlock HeapBlock_t;
+
+// Counters of all threads, for heap_report.
+size_t heap_live = 0;
+size_t heap_peak = 0;
+
+// Blocks to release when the temporaries of this thread are drained.
+struct Temps {
+    size_t size;
+    size_t capacity;
+    void** data;
+};
+
+_Thread_local struct Temps temps = {0};
+
+HeapBlock_t* heap_block(void* data) {
+    return (HeapBlock_t*)((char*)data - offsetof(HeapBlock_t, data));
+}
+
+void heap_count(size_t added, size_t removed) {
+    size_t live = __atomic_add_fetch(&heap_live, added - removed, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&heap_peak, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void* heap_alloc(size_t size) {
+    HeapBlock_t* block = malloc(sizeof(HeapBlock_t) + size);
+    if (block == NULL) {
+        error("out of memory\n");
+    }
+    block->refs = 1;
+    block->size = size;
+    block->values = 0;
+    heap_count(size, 0);
+    return block->data;
+}
+
+void* heap_realloc(void* data, size_t size) {
+    HeapBlock_t* block = realloc(heap_block(data), sizeof(HeapBlock_t) + size);
+    if (block == NULL) {
+        error("out of memory\n");
+    }
+    heap_count(size, block->size);
+    block->size = size;
+    return block->data;
+}
+
+void heap_set_values(void* data, size_t count) {
+    heap_block(data)->values = count;
+}
+
+Value_t heap_array(enum ValueType type, size_t n) {
+    Value_t value = {.type = type, .counted = true, .list_size = n};
+    value.list_value = heap_alloc(n * sizeof(double));
+    return value;
+}
+
+void heap_release(void* data) {
+    HeapBlock_t* block = heap_block(data);
+    if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    Value_t* values = data;
+    for (size_t i = 0; i < block->values; ++i) {
+        value_release(values[i]);
+    }
+    heap_count(0, block->size);
+    free(block);
+}
+
+void heap_retain(void* data) {
+    __atomic_add_fetch(&heap_block(data)->refs, 1, __ATOMIC_RELAXED);
+}
+
+size_t heap_refs(void* data) {
+    return __atomic_load_n(&heap_block(data)->refs, __ATOMIC_ACQUIRE);
+}
+
+void temps_push(void* data) {
+    if (temps.size == temps.capacity) {
+        temps.capacity = temps.capacity ? 2 * temps.capacity : 256;
+        temps.data = realloc(temps.data, temps.capacity * sizeof(void*));
+    }
+    temps.data[temps.size++] = data;
+}
+
+size_t temps_mark(void) {
+    return temps.size;
+}
+
+void temps_drain(size_t mark) {
+    while (temps.size > mark) {
+        heap_release(temps.data[--temps.size]);
+    }
+}
+
+Value_t temps_keep(size_t mark, Value_t value) {
+    if (temps.size > mark) {
+        value_retain(value);
+        temps_drain(mark);
+        value_temp(value);
+    }
+    return value;
+}
+
+void temps_keep_all(size_t mark, Value_t* values, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        value_retain(values[i]);
+    }
+    temps_drain(mark);
+    for (size_t i = 0; i < count; ++i) {
+        value_temp(values[i]);
+    }
+}
+
+void heap_report(FILE* out) {
+    fprintf(out, "heap: %zu bytes at most, %zu in use\n", __atomic_load_n(&heap_peak, __ATOMIC_RELAXED),
+            __atomic_load_n(&heap_live, __ATOMIC_RELAXED));
+}
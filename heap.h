@@ -0,0 +1,106 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdio.h>
+#include "nc.h"
+
+// Reference counted blocks for the elements of lists and for ranges. A
+// value whose counted flag is set points at the data of such a block; any
+// other list or range (dumps mapped from disk, plugin results) is never
+// freed.
+//
+// Every value an expression yields stays valid until the temporaries it was
+// made under are drained: new values are handed to the temporaries of the
+// thread, and values that are only borrowed, such as the value of a
+// variable, are pinned there. Storing a value anywhere that outlives that,
+// a variable or a list element, retains it, and overwriting it releases it.
+// Lists are shared this way when assigned, and copied when written while
+// anything but the variable being written refers to them.
+
+// A block of size bytes with one reference, which the caller owns.
+void* heap_alloc(size_t size);
+// Grows a block that nothing else refers to yet.
+void* heap_realloc(void* data, size_t size);
+// The block's data starts with count tagged values, which are released
+// along with it.
+void heap_set_values(void* data, size_t count);
+// A packed list of n elements in a new block, owned by the caller.
+struct AstValue heap_array(enum ValueType type, size_t n);
+
+void heap_retain(void* data);
+void heap_release(void* data);
+// The number of references to a block. Only a block with no reference but
+// the caller's may be written in place.
+size_t heap_refs(void* data);
+void temps_push(void* data);
+
+// The block behind value, or NULL. The functions below are inline so that
+// values without one, numbers above all, cost no more than this test.
+static inline void* value_block(struct AstValue value) {
+    switch (value.type) {
+        case V_LIST:
+        case V_INT_ARRAY:
+        case V_FLOAT_ARRAY:
+            return value.counted ? value.list_value : NULL;
+        case V_RANGE:
+            return value.counted ? value.range_value : NULL;
+        default:
+            return NULL;
+    }
+}
+
+static inline struct AstValue value_retain(struct AstValue value) {
+    void* data = value_block(value);
+    if (data != NULL) {
+        heap_retain(data);
+    }
+    return value;
+}
+
+static inline void value_release(struct AstValue value) {
+    void* data = value_block(value);
+    if (data != NULL) {
+        heap_release(data);
+    }
+}
+
+// Replaces *dst with value, retaining the one and releasing the other.
+static inline void value_store(struct AstValue* dst, struct AstValue value) {
+    value_retain(value);
+    value_release(*dst);
+    *dst = value;
+}
+
+// Hands the caller's reference to value over to the temporaries.
+static inline struct AstValue value_temp(struct AstValue value) {
+    void* data = value_block(value);
+    if (data != NULL) {
+        temps_push(data);
+    }
+    return value;
+}
+
+// Retains a borrowed value until the temporaries are drained. It takes a
+// pointer so that a number is tested where it lies, not copied around.
+static inline void value_pin(const struct AstValue* value) {
+    void* data = value_block(*value);
+    if (data != NULL) {
+        heap_retain(data);
+        temps_push(data);
+    }
+}
+
+size_t temps_mark(void);
+// Releases the temporaries made since mark.
+void temps_drain(size_t mark);
+// Drains to mark, keeping value.
+struct AstValue temps_keep(size_t mark, struct AstValue value);
+// Drains to mark, keeping count values.
+void temps_keep_all(size_t mark, struct AstValue* values, size_t count);
+
+// The most bytes the blocks took up at once and what they take up now.
+void heap_report(FILE* out);
+
+#endif
+
+// vim: ft=c
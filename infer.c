@@ -0,0 +1,315 @@
+#include "infer.h"
+#include <stdlib.h>
+#include <string.h>
+#include "evaler.h"
+#include "nc_error.h"
+
+typedef struct AstNode Node_t;
+typedef struct Scope Scope_t;
+
+// The types of the variables of one scope, joined over every assignment
+// seen so far. They only widen, from unwritten to a number to NUM_ANY, so
+// walking the tree until none changes settles them.
+struct VarTypes {
+    Scope_t* scope;
+    size_t count;
+    enum NumType* types;
+    bool* written;
+    struct VarTypes* next;
+};
+
+struct Infer {
+    struct VarTypes* vars;  // of every scope walked
+    bool changed;           // in this walk
+};
+
+// The scope the walk is in, and which of its variables surely hold a value
+// of this run of its code by now.
+struct Walk {
+    struct VarTypes* vars;
+    bool* assigned;
+    struct Walk* outer;
+};
+
+struct VarTypes* var_types(struct Infer* in, Scope_t* scope) {
+    for (struct VarTypes* vars = in->vars; vars != NULL; vars = vars->next) {
+        if (vars->scope == scope) {
+            return vars;
+        }
+    }
+
+    struct VarTypes* vars = malloc(sizeof(struct VarTypes));
+    vars->scope = scope;
+    vars->count = scope->slot_count;
+    vars->types = calloc(scope->slot_count + 1, sizeof(enum NumType));
+    vars->written = calloc(scope->slot_count + 1, sizeof(bool));
+    vars->next = in->vars;
+    in->vars = vars;
+    return vars;
+}
+
+// Joins type into what the variable at ref holds.
+void var_write(struct Infer* in, struct Walk* w, struct SlotRef ref, enum NumType type) {
+    if (ref.slot < 0) {
+        return;
+    }
+    for (int i = 0; i < ref.depth && w != NULL; ++i) {
+        w = w->outer;
+    }
+    if (w == NULL) {
+        return;
+    }
+
+    struct VarTypes* vars = w->vars;
+    if (!vars->written[ref.slot]) {
+        vars->written[ref.slot] = true;
+        vars->types[ref.slot] = type;
+        in->changed = true;
+    } else if (vars->types[ref.slot] != type && vars->types[ref.slot] != NUM_ANY) {
+        vars->types[ref.slot] = NUM_ANY;
+        in->changed = true;
+    }
+}
+
+enum NumType var_read(struct Walk* w, struct SlotRef ref) {
+    if (ref.slot < 0 || ref.depth != 0 || !w->assigned[ref.slot] || !w->vars->written[ref.slot]) {
+        return NUM_ANY;
+    }
+    return w->vars->types[ref.slot];
+}
+
+// What an arithmetic operator gives for operands of these types.
+enum NumType arith_type(enum NumType lhs, enum NumType rhs) {
+    if (lhs == NUM_ANY || rhs == NUM_ANY) {
+        return NUM_ANY;
+    }
+    return lhs == NUM_INT && rhs == NUM_INT ? NUM_INT : NUM_FLOAT;
+}
+
+enum NumType infer(struct Infer* in, struct Walk* w, Node_t* node);
+
+// The type of node as an operand. An assignment changes a variable, and
+// operands are evaluated in no set order, so its value is not typed there.
+enum NumType infer_operand(struct Infer* in, struct Walk* w, Node_t* node) {
+    enum NumType type = infer(in, w, node);
+    return node->type == AST_ASSIGNMENT ? NUM_ANY : type;
+}
+
+// The type of the elements a for loop binds its variable to: those of a
+// range of ints, or of a list of numbers of one type.
+enum NumType elem_type(struct Infer* in, struct Walk* w, Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return node->value.type == V_INT_ARRAY ? NUM_INT : node->value.type == V_FLOAT_ARRAY ? NUM_FLOAT : NUM_ANY;
+        case AST_RANGE: {
+            enum NumType start = infer_operand(in, w, NODE(node->rstart));
+            Node_t* stop = NODE(node->rstop);
+            bool infinite = stop->type == AST_LITERAL && stop->value.type == V_INF;
+            enum NumType stop_type = infinite ? NUM_INT : infer_operand(in, w, stop);
+            enum NumType step = node->rstep ? infer_operand(in, w, NODE(node->rstep)) : NUM_INT;
+            if (node->rcount) {
+                infer(in, w, NODE(node->rcount));
+                return NUM_ANY;
+            }
+            return start == NUM_INT && stop_type == NUM_INT && step == NUM_INT ? NUM_INT : NUM_ANY;
+        }
+        case AST_ITEMS: {
+            enum NumType type = NUM_ANY;
+            for (size_t i = 0; i < node->item_count; ++i) {
+                enum NumType item = infer_operand(in, w, CHILD(node->items, i));
+                type = i == 0 || item == type ? item : NUM_ANY;
+            }
+            return type;
+        }
+        default:
+            infer(in, w, node);
+            return NUM_ANY;
+    }
+}
+
+// Statements run in order, so an assignment among them has surely run for
+// the statements after it. What a block assigns may not have run after it,
+// as a block may be a branch or a loop body.
+void infer_stmnts(struct Infer* in, struct Walk* w, NodeIdx_t list, size_t count, bool scoped) {
+    bool* saved = NULL;
+    if (scoped) {
+        saved = malloc(w->vars->count + 1);
+        memcpy(saved, w->assigned, w->vars->count);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Node_t* stmnt = CHILD(list, i);
+        infer(in, w, stmnt);
+        if (stmnt->type == AST_ASSIGNMENT && NODE(stmnt->ident)->type == AST_IDENTIFIER) {
+            struct SlotRef ref = NODE(stmnt->ident)->ref;
+            if (ref.slot >= 0 && ref.depth == 0) {
+                w->assigned[ref.slot] = true;
+            }
+        }
+    }
+
+    if (scoped) {
+        memcpy(w->assigned, saved, w->vars->count);
+        free(saved);
+    }
+}
+
+void infer_list(struct Infer* in, struct Walk* w, NodeIdx_t list, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        infer(in, w, CHILD(list, i));
+    }
+}
+
+// Walks a function body in a scope of its own, where only the parameters
+// are bound when it starts, to values of any type.
+void infer_body(struct Infer* in, struct Walk* outer, Node_t* fdef) {
+    Node_t* sig = NODE(fdef->fsig);
+    struct Walk w = {
+        .vars = var_types(in, fdef->fscope),
+        .assigned = calloc(fdef->fscope->slot_count + 1, sizeof(bool)),
+        .outer = outer,
+    };
+    for (size_t i = 0; i < sig->param_count; ++i) {
+        struct SlotRef ref = {.depth = 0, .slot = (int)i};
+        var_write(in, &w, ref, NUM_ANY);
+    }
+
+    infer(in, &w, NODE(fdef->fbody));
+    free(w.assigned);
+}
+
+enum NumType infer(struct Infer* in, struct Walk* w, Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return node->value.type == V_INT ? NUM_INT : node->value.type == V_FLOAT ? NUM_FLOAT : NUM_ANY;
+        case AST_IDENTIFIER:
+            node->ref_num = var_read(w, node->ref);
+            return node->ref_num;
+        case AST_BINOP: {
+            enum NumType lhs = infer_operand(in, w, NODE(node->lhs));
+            enum NumType rhs = infer_operand(in, w, NODE(node->rhs));
+            switch (node->binop_type) {
+                case TOK_PLUS:
+                case TOK_MINUS:
+                case TOK_STAR:
+                case TOK_FSLASH:
+                case TOK_PERC:
+                case TOK_POWER:
+                    node->binop_num = arith_type(lhs, rhs);
+                    break;
+                default:
+                    node->binop_num = is_comparison(node->binop_type) && arith_type(lhs, rhs) != NUM_ANY ? NUM_INT : NUM_ANY;
+                    break;
+            }
+            return node->binop_num;
+        }
+        case AST_UNOP: {
+            enum NumType type = infer_operand(in, w, NODE(node->node));
+            switch (node->unop_type) {
+                case TOK_MINUS:
+                    node->unop_num = type;
+                    break;
+                case TOK_BANG:
+                    node->unop_num = type != NUM_ANY ? NUM_INT : NUM_ANY;
+                    break;
+                case TOK_HASH:
+                    // a length, or an error
+                    node->unop_num = NUM_INT;
+                    break;
+                default:
+                    node->unop_num = NUM_ANY;
+                    break;
+            }
+            return node->unop_num;
+        }
+        case AST_ASSIGNMENT: {
+            Node_t* ident = NODE(node->ident);
+            enum NumType value = infer_operand(in, w, NODE(node->rvalue));
+            if (ident->type != AST_IDENTIFIER) {
+                infer(in, w, ident);
+                var_write(in, w, ident->lref, NUM_ANY);
+                return NUM_ANY;
+            }
+            if (node->assign_op == TOK_EQ) {
+                var_write(in, w, ident->ref, value);
+                return value;
+            }
+            // an update reads the variable first
+            enum NumType current = var_read(w, ident->ref);
+            enum NumType result = arith_type(current, value);
+            node->assign_num = current != NUM_ANY && result == current ? result : NUM_ANY;
+            var_write(in, w, ident->ref, result);
+            return result;
+        }
+        case AST_PROGRAM:
+            infer_stmnts(in, w, node->stmnts, node->stmnt_count, false);
+            return NUM_ANY;
+        case AST_BLOCK:
+            infer_stmnts(in, w, node->stmnts, node->stmnt_count, true);
+            return NUM_ANY;
+        case AST_CASES:
+            infer_list(in, w, node->stmnts, node->stmnt_count);
+            return NUM_ANY;
+        case AST_ITEMS:
+            infer_list(in, w, node->items, node->item_count);
+            return NUM_ANY;
+        case AST_FCALL:
+            infer_list(in, w, node->params, node->param_count);
+            return NUM_ANY;
+        case AST_FDEF:
+            var_write(in, w, NODE(node->fsig)->fref, NUM_ANY);
+            infer_body(in, w, node);
+            return NUM_ANY;
+        case AST_IDX:
+            infer(in, w, NODE(node->iexpr));
+            return NUM_ANY;
+        case AST_FOR: {
+            // the loop may not run, so its variable is only surely bound in
+            // the body
+            var_write(in, w, node->vref, elem_type(in, w, NODE(node->lexpr)));
+            bool bound = node->vref.slot >= 0 && node->vref.depth == 0;
+            bool was = bound && w->assigned[node->vref.slot];
+            if (bound) {
+                w->assigned[node->vref.slot] = true;
+            }
+            infer(in, w, NODE(node->lbody));
+            if (bound) {
+                w->assigned[node->vref.slot] = was;
+            }
+            return NUM_ANY;
+        }
+        case AST_RANGE:
+            elem_type(in, w, node);
+            return NUM_ANY;
+        case AST_CMD:
+            infer_list(in, w, node->cargs, node->carg_count);
+            return NUM_ANY;
+        case AST_CASE:
+            infer(in, w, NODE(node->pred));
+            infer(in, w, NODE(node->cexpr));
+            return NUM_ANY;
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+}
+
+void infer_types(NodeIdx_t root, Scope_t* globals) {
+    struct Infer in = {0};
+    do {
+        in.changed = false;
+        struct Walk w = {
+            .vars = var_types(&in, globals),
+            .assigned = calloc(globals->slot_count + 1, sizeof(bool)),
+        };
+        infer(&in, &w, NODE(root));
+        free(w.assigned);
+    } while (in.changed);
+
+    while (in.vars != NULL) {
+        struct VarTypes* next = in.vars->next;
+        free(in.vars->types);
+        free(in.vars->written);
+        free(in.vars);
+        in.vars = next;
+    }
+}
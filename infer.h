@@ -0,0 +1,17 @@
+#ifndef INFER_H
+#define INFER_H
+
+#include "parser.h"
+#include "resolver.h"
+
+// Marks the expressions of the resolved tree that can only evaluate to an
+// int, or only to a float, with the NumType fields of their nodes. A
+// variable of a scope has a type where it is read if every assignment to it
+// anywhere gives that type and one of them surely ran before the read;
+// variables of enclosing scopes, parameters and names bound at run time are
+// never typed.
+void infer_types(NodeIdx_t root, struct Scope* globals);
+
+#endif
+
+// vim: ft=c
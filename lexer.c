@@ -3,61 +3,53 @@
 #include <stdbool.h>
 #include <string.h>
 #include "token.h"
+#include "map.h"
 #include "utils.h"
 #include "lexer.h"
 
-bool tok_is_keyword(const char* str) {
-#define X(x)                    \
-    if (strcmp(str, #x) == 0) { \
-        return true;            \
-    }
-    KEYWORDS
-#undef X
+struct Keyword {
+    const char* name;
+    size_t length;
+    enum TokenType type;
+};
 
-    return false;
-}
+#include "keywords.h"
 
-bool tok_is_command(const char* str) {
-#define X(x)                    \
-    if (strcmp(str, #x) == 0) { \
-        return true;            \
+// Returns the keyword type of the word, TOK_CMD for commands and
+// TOK_IDENTIFIER for everything else.
+enum TokenType tok_classify(const char* word, size_t length) {
+    uint32_t h = KW_SEED;
+    for (size_t i = 0; i < length; ++i) {
+        h = KW_HASH_STEP(h, word[i]);
     }
-    COMMANDS
-#undef X
-
-    return false;
-}
 
-enum TokenType tok_kw_to_tt(const char* str) {
-#define X(x)                    \
-    if (strcmp(str, #x) == 0) { \
-        return KW_##x;          \
+    const struct Keyword* kw = keywords + KW_INDEX(h);
+    if (kw->name != NULL && kw->length == length && memcmp(kw->name, word, length) == 0) {
+        return kw->type;
     }
-    KEYWORDS
-#undef X
 
-    fprintf(stderr, "token_error: unknown keyword: %s\n", str);
-    exit(1);
+    return TOK_IDENTIFIER;
 }
 
-enum TokenType tok_cmd_to_tt(const char* str) {
-#define X(x)                    \
-    if (strcmp(str, #x) == 0) { \
-        return CMD_##x;         \
+bool tok_has_text(enum TokenType type) {
+    switch (type) {
+        case TOK_INTEGER:
+        case TOK_FLOAT:
+        case TOK_STRING:
+        case TOK_IDENTIFIER:
+        case TOK_CMD:
+            return true;
+        default:
+            return false;
     }
-    COMMANDS
-#undef X
-
-    fprintf(stderr, "token_error: unknown keyword: %s\n", str);
-    exit(1);
 }
 
-const char* tok_to_str(struct Token t) {
+const char* tok_to_str(const char* source, struct Token t) {
     const char* tt = tok_type_to_str(t.type);
 
     StringBuilder sb = {};
-    if (t.value) {
-        const char* strs[] = {tt, "(", t.value, ")"};
+    if (tok_has_text(t.type)) {
+        const char* strs[] = {tt, "(", strndup(source + t.offset, t.length), ")"};
         sb = sb_join("", 4, strs);
     } else {
         sb_append(&sb, tt);
@@ -96,20 +88,22 @@ const char* tok_type_to_str(enum TokenType tok_type) {
 //   | [_a-zA-Z][_a-zA-Z0-9']*
 // 'string': (?<=").*(?=")
 
+// Every token but EOF consumes at least one byte of source, so the array is
+// sized up front and never has to grow.
 struct TokenArray {
-    size_t capacity;
+    const char* source;
     size_t size;
     struct Token* data;
 };
 
-int ta_append(struct TokenArray* arr, enum TokenType type, const char* value) {
-    if (arr->size >= arr->capacity) {
-        arr->capacity *= 2;
-        arr->data = realloc(arr->data, arr->capacity * sizeof(struct Token));
-    }
-    struct Token t = {.type = type, .value = value};
+void ta_append(struct TokenArray* arr, enum TokenType type, const char* start, const char* end) {
+    struct Token t = {
+        .type = type,
+        .offset = (uint32_t)(start - arr->source),
+        .length = (uint32_t)(end - start),
+        .sym = NULL,
+    };
     arr->data[arr->size++] = t;
-    return 0;
 }
 
 void tok_number(struct TokenArray* arr, const char** ptr) {
@@ -141,7 +135,8 @@ void tok_number(struct TokenArray* arr, const char** ptr) {
 
     if (**ptr == 'e' || **ptr == 'E') {
         (*ptr)++;
-        if (**ptr == '-') {
+        // 1e+22, as floats are printed, reads back as one number
+        if (**ptr == '-' || (**ptr == '+' && '0' <= *(*ptr + 1) && *(*ptr + 1) <= '9')) {
             (*ptr)++;
         }
         tt = TOK_FLOAT;
@@ -151,9 +146,7 @@ void tok_number(struct TokenArray* arr, const char** ptr) {
         (*ptr)++;
     }
 
-    const char* value = strndup(start, *ptr - start);
-
-    ta_append(arr, tt, value);
+    ta_append(arr, tt, start, *ptr);
 }
 
 void tok_ident_or_keyword(struct TokenArray* arr, const char** ptr) {
@@ -161,14 +154,11 @@ void tok_ident_or_keyword(struct TokenArray* arr, const char** ptr) {
     while (isalnum(**ptr) || **ptr == '_') {
         (*ptr)++;
     }
-    const char* name = strndup(start, *ptr - start);
 
-    if (tok_is_keyword(name)) {
-        ta_append(arr, tok_kw_to_tt(name), 0);
-    } else if (tok_is_command(name)) {
-        ta_append(arr, TOK_CMD, name);
-    } else {
-        ta_append(arr, TOK_IDENTIFIER, name);
+    enum TokenType tt = tok_classify(start, *ptr - start);
+    ta_append(arr, tt, start, *ptr);
+    if (tt == TOK_IDENTIFIER || tt == TOK_CMD) {
+        arr->data[arr->size - 1].sym = intern_n(start, *ptr - start);
     }
 }
 
@@ -178,15 +168,31 @@ void tok_string(struct TokenArray* arr, const char** ptr) {
     while (**ptr && **ptr != '"') {
         (*ptr)++;
     }
-    const char* value = strndup(start, *ptr - start);
+    if (**ptr != '"') {
+        fprintf(stderr, "token_error: unterminated string\n");
+        exit(1);
+    }
+    ta_append(arr, TOK_STRING, start, *ptr);
     ++*ptr;
-
-    ta_append(arr, TOK_STRING, value);
 }
 
-int tokenize(const char* string, struct Token* tokens[]) {
-    struct TokenArray arr = {.capacity = 16};
-    arr.data = malloc(arr.capacity * sizeof(struct Token));
+#define emit1(tt)                    \
+    ta_append(&arr, (tt), s, s + 1); \
+    ++s
+
+#define emit2(tt)                    \
+    ta_append(&arr, (tt), s, s + 2); \
+    s += 2
+
+size_t tokenize(struct Arena* arena, const char* string, struct Token* tokens[]) {
+    size_t length = strlen(string);
+    if (length >= UINT32_MAX) {
+        fprintf(stderr, "token_error: source too large\n");
+        exit(1);
+    }
+
+    struct TokenArray arr = {.source = string, .size = 0};
+    arr.data = arena_alloc(arena, (length + 1) * sizeof(struct Token));
 
     const char* s = string;
     const char* peek;
@@ -198,130 +204,117 @@ int tokenize(const char* string, struct Token* tokens[]) {
                 ++s;
                 continue;
             case '\n':
-                ta_append(&arr, TOK_EOL, 0);
-                ++s;
+                emit1(TOK_EOL);
                 break;
             case '#':
                 if (*peek == ' ') {
-                    while ((*++s) != '\n') {
+                    while (*s && *s != '\n') {
+                        ++s;
                     }
                     break;
                 }
-                ta_append(&arr, TOK_HASH, 0);
-                ++s;
+                emit1(TOK_HASH);
                 break;
             case '<':
                 if (*peek == '=') {
-                    ta_append(&arr, TOK_LEQ, 0);
-                    s += 2;
+                    emit2(TOK_LEQ);
                 } else {
-                    ta_append(&arr, TOK_LT, 0);
-                    ++s;
+                    emit1(TOK_LT);
                 }
                 break;
             case '>':
                 if (*peek == '=') {
-                    ta_append(&arr, TOK_GEQ, 0);
-                    s += 2;
+                    emit2(TOK_GEQ);
                 } else {
-                    ta_append(&arr, TOK_GT, 0);
-                    ++s;
+                    emit1(TOK_GT);
                 }
                 break;
             case '=':
                 if (*peek == '=') {
-                    ta_append(&arr, TOK_EEQ, 0);
-                    s += 2;
+                    emit2(TOK_EEQ);
                 } else {
-                    ta_append(&arr, TOK_EQ, 0);
-                    ++s;
+                    emit1(TOK_EQ);
                 }
                 break;
             case '!':
                 if (*peek == '=') {
-                    s += 2;
-                    ta_append(&arr, TOK_NEQ, 0);
+                    emit2(TOK_NEQ);
                 } else {
-                    ta_append(&arr, TOK_BANG, 0);
-                    ++s;
+                    emit1(TOK_BANG);
                 }
                 break;
             case '&':
-                ta_append(&arr, TOK_AMP, 0);
-                ++s;
+                emit1(TOK_AMP);
                 break;
             case '|':
-                ta_append(&arr, TOK_PIPE, 0);
-                ++s;
+                emit1(TOK_PIPE);
                 break;
             case '-':
                 if (*peek == '.' || ('0' <= *peek && *peek <= '9')) {
                     tok_number(&arr, &s);
+                } else if (*peek == '=') {
+                    emit2(TOK_MINUSEQ);
                 } else {
-                    ta_append(&arr, TOK_MINUS, 0);
-                    ++s;
+                    emit1(TOK_MINUS);
                 }
                 break;
             case '+':
-                ta_append(&arr, TOK_PLUS, 0);
-                ++s;
+                if (*peek == '=') {
+                    emit2(TOK_PLUSEQ);
+                } else {
+                    emit1(TOK_PLUS);
+                }
                 break;
             case '*':
-                ta_append(&arr, TOK_STAR, 0);
-                ++s;
+                if (*peek == '=') {
+                    emit2(TOK_STAREQ);
+                } else {
+                    emit1(TOK_STAR);
+                }
                 break;
             case '/':
-                ta_append(&arr, TOK_FSLASH, 0);
-                ++s;
+                if (*peek == '=') {
+                    emit2(TOK_FSLASHEQ);
+                } else {
+                    emit1(TOK_FSLASH);
+                }
                 break;
             case '^':
-                ta_append(&arr, TOK_POWER, 0);
-                ++s;
+                emit1(TOK_POWER);
                 break;
             case '%':
-                ta_append(&arr, TOK_PERC, 0);
-                ++s;
+                emit1(TOK_PERC);
                 break;
             case ',':
-                ta_append(&arr, TOK_COMMA, 0);
-                ++s;
+                emit1(TOK_COMMA);
                 break;
             case '(':
-                ta_append(&arr, TOK_LPAREN, 0);
-                ++s;
+                emit1(TOK_LPAREN);
                 break;
             case ')':
-                ta_append(&arr, TOK_RPAREN, 0);
-                ++s;
+                emit1(TOK_RPAREN);
                 break;
             case ':':
-                ta_append(&arr, TOK_COLON, 0);
-                ++s;
+                emit1(TOK_COLON);
                 break;
             case ';':
-                ta_append(&arr, TOK_SEMICOLON, 0);
-                ++s;
+                emit1(TOK_SEMICOLON);
                 break;
             case '[':
-                ta_append(&arr, TOK_LBRACKET, 0);
-                ++s;
+                emit1(TOK_LBRACKET);
                 break;
             case ']':
-                ta_append(&arr, TOK_RBRACKET, 0);
-                ++s;
+                emit1(TOK_RBRACKET);
                 break;
             case '{':
-                ta_append(&arr, TOK_LBRACE, 0);
-                ++s;
+                emit1(TOK_LBRACE);
                 break;
             case '}':
-                ta_append(&arr, TOK_RBRACE, 0);
-                ++s;
+                emit1(TOK_RBRACE);
                 break;
             case '.':
                 if (*peek == '.') {
-                    ta_append(&arr, TOK_DOTDOT, 0);
-                    s += 2;
+                    emit2(TOK_DOTDOT);
                 } else {
                     tok_number(&arr, &s);
                 }
@@ -341,8 +334,11 @@ int tokenize(const char* string, struct Token* tokens[]) {
         };
     }
 
-    ta_append(&arr, TOK_EOF, 0);
+    ta_append(&arr, TOK_EOF, s, s);
     *tokens = arr.data;
 
     return arr.size;
 }
+
+#undef emit1
+#undef emit2
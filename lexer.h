@@ -1,11 +1,12 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "arena.h"
 #include "token.h"
 
-const char* tok_to_str(struct Token t);
+const char* tok_to_str(const char* source, struct Token t);
 const char* tok_type_to_str(enum TokenType tok_type);
-int tokenize(const char* string, struct Token* tokens[]);
+size_t tokenize(struct Arena* arena, const char* string, struct Token* tokens[]);
 
 #endif
 
@@ -0,0 +1,150 @@
+#include "map.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+
+typedef struct Map Map_t;
+typedef struct Item Item_t;
+
+struct Symbols {
+    size_t size;
+    size_t capacity;
+    const char** data;
+};
+
+struct Symbols symbols = {0};
+
+void symbols_grow() {
+    size_t capacity = symbols.capacity ? 2 * symbols.capacity : 256;
+    const char** data = calloc(capacity, sizeof(const char*));
+
+    for (size_t i = 0; i < symbols.capacity; ++i) {
+        const char* sym = symbols.data[i];
+        if (sym == NULL) {
+            continue;
+        }
+        size_t j = hash_str(sym) & (capacity - 1);
+        while (data[j] != NULL) {
+            j = (j + 1) & (capacity - 1);
+        }
+        data[j] = sym;
+    }
+
+    free(symbols.data);
+    symbols.data = data;
+    symbols.capacity = capacity;
+}
+
+// Interns the first len bytes of str, which need not be terminated.
+const char* intern_n(const char* str, size_t len) {
+    if (2 * (symbols.size + 1) > symbols.capacity) {
+        symbols_grow();
+    }
+
+    size_t mask = symbols.capacity - 1;
+    size_t i = hash_str_n(str, len) & mask;
+    for (; symbols.data[i] != NULL; i = (i + 1) & mask) {
+        const char* sym = symbols.data[i];
+        if (sym == str || (strncmp(sym, str, len) == 0 && sym[len] == '\0')) {
+            return sym;
+        }
+    }
+
+    char* sym = strndup(str, len);
+    symbols.data[i] = sym;
+    symbols.size++;
+    return sym;
+}
+
+const char* intern(const char* str) {
+    return intern_n(str, strlen(str));
+}
+
+size_t hash_sym(const char* sym) {
+    uint64_t h = (uint64_t)(uintptr_t)sym * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h ^ (h >> 32));
+}
+
+Map_t map_new() {
+    Map_t map = {.size = 0, .capacity = 0, .items = NULL};
+    return map;
+}
+
+void map_free(Map_t* map) {
+    if (map->capacity > 0) {
+        free(map->items);
+    }
+    *map = map_new();
+}
+
+Item_t* map_probe(Map_t* map, const char* sym) {
+    size_t mask = map->capacity - 1;
+    size_t i = hash_sym(sym) & mask;
+    while (map->items[i].key != NULL && map->items[i].key != sym) {
+        i = (i + 1) & mask;
+    }
+    return map->items + i;
+}
+
+void map_grow(Map_t* map) {
+    Item_t* old = map->capacity ? map->items : map->inline_items;
+    size_t old_count = map->capacity ? map->capacity : map->size;
+
+    map->capacity = map->capacity ? 2 * map->capacity : 4 * MAP_INLINE;
+    map->items = calloc(map->capacity, sizeof(Item_t));
+
+    for (size_t i = 0; i < old_count; ++i) {
+        if (old[i].key != NULL) {
+            *map_probe(map, old[i].key) = old[i];
+        }
+    }
+
+    if (old != map->inline_items) {
+        free(old);
+    }
+}
+
+struct AstValue* map_get(Map_t* map, const char* sym) {
+    if (map->capacity == 0) {
+        for (size_t i = 0; i < map->size; ++i) {
+            if (map->inline_items[i].key == sym) {
+                return &map->inline_items[i].value;
+            }
+        }
+        return NULL;
+    }
+
+    Item_t* item = map_probe(map, sym);
+    return item->key != NULL ? &item->value : NULL;
+}
+
+// Returns the value stored under sym, inserting NIL first if it is missing.
+struct AstValue* map_put(Map_t* map, const char* sym) {
+    struct AstValue* value = map_get(map, sym);
+    if (value != NULL) {
+        return value;
+    }
+
+    if (map->capacity == 0 && map->size < MAP_INLINE) {
+        Item_t* item = map->inline_items + map->size++;
+        item->key = sym;
+        item->value.type = V_NIL;
+        return &item->value;
+    }
+
+    if (2 * (map->size + 1) > map->capacity) {
+        map_grow(map);
+    }
+
+    Item_t* item = map_probe(map, sym);
+    item->key = sym;
+    item->value.type = V_NIL;
+    map->size++;
+    return &item->value;
+}
+
+struct Item* map_items(Map_t* map, size_t* count) {
+    *count = map->capacity ? map->capacity : map->size;
+    return map->capacity ? map->items : map->inline_items;
+}
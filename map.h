@@ -0,0 +1,40 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "nc.h"
+
+// Returns the canonical copy of str. Equal names intern to the same pointer,
+// so maps and scopes compare and hash symbols by address.
+const char* intern(const char* str);
+const char* intern_n(const char* str, size_t len);
+
+// entries a map stores in place before it moves to the heap
+#define MAP_INLINE 4
+
+struct Item {
+    const char* key;  // interned
+    struct AstValue value;
+};
+
+// Symbol table keyed by interned names. Up to MAP_INLINE items live in the
+// map itself and are scanned; larger maps switch to a power-of-two table on
+// the heap with linear probing, kept at most half full.
+struct Map {
+    size_t size;
+    size_t capacity;  // 0 while the items are inline
+    struct Item* items;
+    struct Item inline_items[MAP_INLINE];
+};
+
+struct Map map_new();
+// Frees the table of a map, leaving its values to the caller.
+void map_free(struct Map* map);
+struct AstValue* map_get(struct Map* map, const char* sym);
+struct AstValue* map_put(struct Map* map, const char* sym);
+// The items are the entries of the returned array up to *count whose key is
+// not NULL.
+struct Item* map_items(struct Map* map, size_t* count);
+
+#endif
+
+// vim: ft=c
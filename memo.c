@@ -0,0 +1,199 @@
+#include "memo.h"
+#include <stdlib.h>
+#include "evaler.h"
+#include "heap.h"
+
+bool memo_on = true;
+size_t memo_epochs = 1;
+
+// Every cache, in the order the functions were defined, for memo_report and
+// memo_drop.
+struct Memo* memo_first = NULL;
+struct Memo** memo_last = &memo_first;
+pthread_mutex_t memo_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void memo_use(bool on) {
+    __atomic_store_n(&memo_on, on, __ATOMIC_RELAXED);
+}
+
+bool memo_enabled(void) {
+    return __atomic_load_n(&memo_on, __ATOMIC_RELAXED);
+}
+
+void memo_invalidate(void) {
+    __atomic_add_fetch(&memo_epochs, 1, __ATOMIC_RELEASE);
+}
+
+size_t memo_epoch(void) {
+    return __atomic_load_n(&memo_epochs, __ATOMIC_ACQUIRE);
+}
+
+struct Memo* memo_new(const char* name, size_t nkeys) {
+    struct Memo* memo = calloc(1, sizeof(struct Memo));
+    memo->name = name;
+    memo->nkeys = nkeys;
+    pthread_mutex_init(&memo->lock, NULL);
+
+    pthread_mutex_lock(&memo_list_lock);
+    *memo_last = memo;
+    memo_last = &memo->next;
+    pthread_mutex_unlock(&memo_list_lock);
+    return memo;
+}
+
+// Empties the cache; the caller holds its lock.
+void memo_clear(struct Memo* memo) {
+    if (memo->entries == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < MEMO_SETS * MEMO_WAYS; ++i) {
+        value_release(memo->entries[i].result);
+    }
+    free(memo->entries);
+    free(memo->keys);
+    memo->entries = NULL;
+    memo->keys = NULL;
+}
+
+bool memo_active(struct Memo* memo, bool (*pure)(void* arg), void* arg) {
+    if (!memo_enabled() || __atomic_load_n(&memo->off, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    size_t epoch = memo_epoch();
+    if (__atomic_load_n(&memo->epoch, __ATOMIC_ACQUIRE) != epoch) {
+        pthread_mutex_lock(&memo->lock);
+        if (memo->epoch != epoch) {
+            memo_clear(memo);
+            __atomic_store_n(&memo->pure, pure(arg), __ATOMIC_RELAXED);
+            __atomic_store_n(&memo->epoch, epoch, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&memo->lock);
+    }
+    return __atomic_load_n(&memo->pure, __ATOMIC_RELAXED);
+}
+
+// Mixes the bits of a value into hash, as in the finalizer of MurmurHash3.
+static inline uint64_t memo_mix(uint64_t hash, uint64_t bits) {
+    hash ^= bits;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Ints and floats of equal bits differ as keys, as 1 and 1.0 give results
+// of different types.
+static inline bool memo_same(const Value_t* keys, const Value_t* args, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (keys[i].type != args[i].type || keys[i].int_value != args[i].int_value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool memo_lookup(struct Memo* memo, const Value_t* args, Value_t* result, struct MemoTicket* ticket) {
+    ticket->index = SIZE_MAX;
+    if (__atomic_load_n(&memo->skip, __ATOMIC_RELAXED) > 0 &&
+        __atomic_sub_fetch(&memo->skip, 1, __ATOMIC_RELAXED) >= 0) {
+        return false;
+    }
+
+    uint64_t hash = memo->nkeys;
+    for (size_t i = 0; i < memo->nkeys; ++i) {
+        if (args[i].type != V_INT && args[i].type != V_FLOAT) {
+            return false;
+        }
+        hash = memo_mix(hash, (uint64_t)args[i].int_value + args[i].type);
+    }
+
+    pthread_mutex_lock(&memo->lock);
+    if (memo->entries == NULL) {
+        memo->entries = calloc(MEMO_SETS * MEMO_WAYS, sizeof(struct MemoEntry));
+        memo->keys = malloc(MEMO_SETS * MEMO_WAYS * memo->nkeys * sizeof(Value_t) + 1);
+    }
+
+    size_t first = (hash % MEMO_SETS) * MEMO_WAYS;
+    struct MemoEntry* victim = memo->entries + first;
+    bool found = false;
+    for (size_t i = first; i < first + MEMO_WAYS; ++i) {
+        struct MemoEntry* entry = memo->entries + i;
+        if (entry->used != 0 && entry->hash == hash && memo_same(memo->keys + i * memo->nkeys, args, memo->nkeys)) {
+            if (entry->result.type != V_NIL) {
+                entry->used = ++memo->tick;
+                memo->hits++;
+                memo->window_hits++;
+                memo->window_lookups++;
+                // pinned before another thread can evict it
+                *result = entry->result;
+                value_pin(result);
+                pthread_mutex_unlock(&memo->lock);
+                return true;
+            }
+            // the call that added it has not returned, or returned nothing
+            victim = entry;
+            found = true;
+            break;
+        }
+        if (entry->used < victim->used) {
+            victim = entry;
+        }
+    }
+
+    memo->misses++;
+    if (++memo->window_lookups >= MEMO_WINDOW) {
+        if (memo->window_hits * MEMO_RARE < MEMO_WINDOW) {
+            __atomic_store_n(&memo->skip, MEMO_SKIP, __ATOMIC_RELAXED);
+        }
+        memo->window_hits = 0;
+        memo->window_lookups = 0;
+    }
+    size_t i = victim - memo->entries;
+    if (!found) {
+        value_release(victim->result);
+        victim->result = NIL;
+        victim->hash = hash;
+        victim->used = ++memo->tick;
+        for (size_t j = 0; j < memo->nkeys; ++j) {
+            memo->keys[i * memo->nkeys + j] = args[j];
+        }
+    }
+    ticket->index = i;
+    ticket->used = victim->used;
+    pthread_mutex_unlock(&memo->lock);
+    return false;
+}
+
+// The entry may have gone to another key, or the cache been cleared, while
+// the call ran; the result is dropped then. Ticks only grow, so an entry
+// that was reused never matches.
+void memo_store(struct Memo* memo, struct MemoTicket ticket, Value_t result) {
+    if (ticket.index == SIZE_MAX) {
+        return;
+    }
+    pthread_mutex_lock(&memo->lock);
+    if (memo->entries != NULL) {
+        struct MemoEntry* entry = memo->entries + ticket.index;
+        if (entry->used == ticket.used && entry->result.type == V_NIL) {
+            entry->result = value_retain(result);
+        }
+    }
+    pthread_mutex_unlock(&memo->lock);
+}
+
+void memo_report(FILE* out) {
+    for (struct Memo* memo = memo_first; memo != NULL; memo = memo->next) {
+        if (memo->hits + memo->misses > 0) {
+            fprintf(out, "memo: %s: %zu hits, %zu misses\n", memo->name, memo->hits, memo->misses);
+        }
+    }
+}
+
+void memo_drop(void) {
+    for (struct Memo* memo = memo_first; memo != NULL; memo = memo->next) {
+        memo_clear(memo);
+    }
+}
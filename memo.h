@@ -0,0 +1,81 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "nc.h"
+
+// Results of calls of pure scripted functions, cached per function and keyed
+// on the argument values. Only calls whose arguments are all ints or floats
+// are cached. A cache has MEMO_SETS sets of MEMO_WAYS entries, and a new key
+// takes the least recently used entry of its set.
+#define MEMO_SETS 256
+#define MEMO_WAYS 4
+
+// A function whose calls hit fewer than one lookup in MEMO_RARE over
+// MEMO_WINDOW lookups skips the cache for MEMO_SKIP calls after that, so
+// that calls that never repeat cost little more than without it.
+#define MEMO_WINDOW 1024
+#define MEMO_RARE 8
+#define MEMO_SKIP (15 * MEMO_WINDOW)
+
+struct MemoEntry {
+    uint64_t used;           // tick of the last lookup that found it, 0 while empty
+    uint64_t hash;
+    struct AstValue result;  // NIL until the call that added it returns
+};
+
+// Where memo_store puts the result of a call that missed. index is
+// SIZE_MAX for a call that cannot be cached.
+struct MemoTicket {
+    size_t index;
+    uint64_t used;
+};
+
+struct Memo {
+    const char* name;
+    size_t nkeys;
+    bool off;      // switched off for this function alone
+    size_t epoch;  // memo_epoch() when pure was decided, 0 before that
+    bool pure;
+    uint64_t tick;
+    struct MemoEntry* entries;  // allocated by the first miss
+    struct AstValue* keys;      // nkeys for each entry
+    size_t hits;
+    size_t misses;
+    size_t window_hits;
+    size_t window_lookups;
+    long skip;  // calls left to skip the cache for
+    pthread_mutex_t lock;
+    struct Memo* next;
+};
+
+// Switches caching on or off for every function.
+void memo_use(bool on);
+bool memo_enabled(void);
+
+// Makes every cache decide again whether its function is pure, and start
+// over, as when a name is bound to another function.
+void memo_invalidate(void);
+size_t memo_epoch(void);
+
+struct Memo* memo_new(const char* name, size_t nkeys);
+// Whether calls may be looked up in memo: caching is on for it, and its
+// function is pure, which pure(arg) decides again in every epoch.
+bool memo_active(struct Memo* memo, bool (*pure)(void* arg), void* arg);
+
+// Looks up the call with args. A hit returns true and the result, pinned
+// until the temporaries are drained; a miss adds an entry for the call and
+// leaves in *ticket where to store its result.
+bool memo_lookup(struct Memo* memo, const struct AstValue* args, struct AstValue* result, struct MemoTicket* ticket);
+void memo_store(struct Memo* memo, struct MemoTicket ticket, struct AstValue result);
+
+// The hits and misses of every function that was looked up.
+void memo_report(FILE* out);
+// Releases every cached result, as at exit.
+void memo_drop(void);
+
+#endif
+
+// vim: ft=c
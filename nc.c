@@ -5,9 +5,18 @@
 #define NC_IMPL
 #include "nc.h"
 
+#include "array.h"
+#include "heap.h"
 #include "lexer.h"
+#include "memo.h"
 #include "parser.h"
+#include "resolver.h"
+#include "optimizer.h"
+#include "pool.h"
 #include "evaler.h"
+#include "compiler.h"
+#include "vm.h"
+#include "writer.h"
 
 #define BUFSIZE 4095  // pagesize - 1
 
@@ -30,46 +39,126 @@ const char* read_file(FILE* fd) {
 }
 
 int main(int argc, const char* argv[]) {
-    const char* text;
+    const char* text = NULL;
+    bool use_vm = false;
+    bool dump_code = false;
+    bool ast_stats = false;
+    bool dump_opt = false;
+    bool heap_stats = false;
+    bool memo_stats = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--vm") == 0) {
+            use_vm = true;
+        } else if (strcmp(argv[i], "--dump-code") == 0) {
+            dump_code = true;
+        } else if (strcmp(argv[i], "--ast-stats") == 0) {
+            ast_stats = true;
+        } else if (strcmp(argv[i], "--dump-opt") == 0) {
+            dump_opt = true;
+        } else if (strcmp(argv[i], "--heap-stats") == 0) {
+            heap_stats = true;
+        } else if (strcmp(argv[i], "--memo-stats") == 0) {
+            memo_stats = true;
+        } else if (strcmp(argv[i], "--no-memo") == 0) {
+            memo_use(false);
+        } else if (strcmp(argv[i], "--no-inline") == 0) {
+            optimize_use_inlining(false);
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            table_use_csv(true);
+        } else if (strcmp(argv[i], "--libm") == 0) {
+            array_use_libm(true);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            pool_set_threads(strtoul(argv[i] + 10, NULL, 10));
+        } else if (strncmp(argv[i], "--thread-min=", 13) == 0) {
+            array_set_thread_min(strtoul(argv[i] + 13, NULL, 10));
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            error("unknown option: %s\n", argv[i]);
+        } else {
+            text = argv[i];
+        }
+    }
+    array_init();
 
-    if (argc < 2) {
+    if (text == NULL) {
         text = read_file(stdin);
-    } else {
-        text = argv[1];
     }
 
+    struct Arena token_arena = {0};
     struct Token* tokens;
-    tokenize(text, &tokens);
+    tokenize(&token_arena, text, &tokens);
 
     struct Parser parser;
+    parser.source = text;
     parser.tokens = tokens;
     parser.tok = tokens;
 
     while (tokens->type != TOK_EOF) {
-        printf("%s ", tok_to_str(*tokens++));
+        printf("%s ", tok_to_str(text, *tokens++));
     }
 
-    printf("%s ", tok_to_str(*tokens++));
+    printf("%s ", tok_to_str(text, *tokens++));
     printf("\n");
 
-    struct AstNode root;
-    parse(&parser, &root);
+    NodeIdx_t root = parse(&parser);
+
+    // the tree keeps no pointers into the tokens
+    arena_free(&token_arena);
 
-    draw_ast(&root);
+    draw_ast(root);
 
-    struct Context builtin = context_new(NULL);
+    struct Scope* globals = resolve(NODE(root));
+
+    struct Context builtin = context_new(NULL, NULL);
     setup_builtin_context(&builtin);
-    struct Context context = context_new(&builtin);
+    optimize(root, globals, &builtin);
+    call_sites_init();
+    struct Context context = context_new(&builtin, globals);
+
+    if (dump_opt) {
+        draw_ast(root);
+    }
+
+    if (ast_stats) {
+        printf("ast: %zu nodes, %zu bytes\n", node_count, ast_bytes());
+    }
 
     struct AstValue val = {.type = V_INT, .int_value = 42};
     set_value(&context, "x", val);
 
-    struct AstValue result = eval(&root, &context);
+    struct AstValue result;
+    if (use_vm || dump_code) {
+        struct Chunk* chunk = compile(NODE(root), false);
+        if (dump_code) {
+            disassemble(chunk);
+        }
+        result = vm_run(chunk, &context);
+    } else {
+        result = eval(NODE(root), &context);
+    }
 
     if (result.type != V_NIL) {
-        const char* out = ast_value_to_str(&result);
-        printf("%s\n", out);
+        struct Writer* out = writer_acquire_stdout();
+        writer_value(out, result);
+        writer_put(out, "\n", 1);
+        writer_release_stdout(out);
     }
 
+    if (memo_stats) {
+        memo_report(stderr);
+    }
+
+    // whatever is still in use now was leaked
+    context_free(&context);
+    memo_drop();
+    temps_drain(0);
+    if (heap_stats) {
+        heap_report(stderr);
+    }
+
+    // function values point into the tree, so it goes last
+    call_sites_free();
+    ast_free();
+
     return 0;
 }
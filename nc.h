@@ -8,13 +8,15 @@
 #include "nc_error.h"
 
 #define NC_VALUE_TYPES_X \
-    X(V_NIL)        \
-    X(V_INT)        \
-    X(V_FLOAT)      \
-    X(V_STRING)     \
-    X(V_LIST)       \
-    X(V_RANGE)      \
-    X(V_INF)        \
+    X(V_NIL)         \
+    X(V_INT)         \
+    X(V_FLOAT)       \
+    X(V_STRING)      \
+    X(V_LIST)        \
+    X(V_INT_ARRAY)   \
+    X(V_FLOAT_ARRAY) \
+    X(V_RANGE)       \
+    X(V_INF)         \
     X(V_CALLABLE)
 
 enum ValueType {
@@ -27,6 +29,9 @@ struct RangeValue;
 
 struct AstValue {
     enum ValueType type;
+    // a list or range in a reference counted block of heap.h; plugins leave
+    // it false
+    bool counted;
     union {
         // V_INT
         long long int int_value;
@@ -37,9 +42,14 @@ struct AstValue {
         // V_STRING
         const char* string_value;
 
-        // V_LIST
+        // V_LIST, V_INT_ARRAY, V_FLOAT_ARRAY
+        // lists of only ints or only floats are packed into plain arrays
         struct {
-            struct AstValue* list_value;
+            union {
+                struct AstValue* list_value;
+                long long int* int_array;
+                double* float_array;
+            };
             size_t list_size;
         };
 
@@ -51,15 +61,13 @@ struct AstValue {
     };
 };
 
+// start, start + step, ... up to stop, or without end if length is
+// UNDEF_SIZE; see range_new
 struct RangeValue {
     struct AstValue start;
     struct AstValue stop;
-    struct AstValue value;
     struct AstValue step;
-    size_t count;
     size_t length;
-    bool done;
-    bool started;
 };
 
 typedef struct AstValue Value_t;
@@ -85,6 +93,8 @@ typedef PlugSpec_t* (*PlugInitFunc_t)();
 
 const char* nc_value_type_to_str(enum ValueType value_type);
 double nc_as_float(Value_t value);
+bool nc_is_list(Value_t value);
+Value_t nc_list_get(Value_t list, size_t i);
 
 #ifdef NC_IMPL
 
@@ -114,6 +124,27 @@ inline double nc_as_float(Value_t value) {
     }
 }
 
+inline bool nc_is_list(Value_t value) {
+    return value.type == V_LIST || value.type == V_INT_ARRAY || value.type == V_FLOAT_ARRAY;
+}
+
+inline Value_t nc_list_get(Value_t list, size_t i) {
+    switch (list.type) {
+        case V_LIST:
+            return list.list_value[i];
+        case V_INT_ARRAY: {
+            Value_t value = NC_INT(list.int_array[i]);
+            return value;
+        }
+        case V_FLOAT_ARRAY: {
+            Value_t value = NC_FLOAT(list.float_array[i]);
+            return value;
+        }
+        default:
+            error("cannot index value type: %s\n", nc_value_type_to_str(list.type));
+    }
+}
+
 #endif
 
 #endif
@@ -0,0 +1,979 @@
+#include "optimizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resolver.h"
+#include "heap.h"
+#include "infer.h"
+#include "nc_error.h"
+
+typedef struct AstNode Node_t;
+typedef struct AstValue Value_t;
+typedef struct Context Context_t;
+
+struct Folder {
+    Context_t* builtins;
+    bool plugins;  // a plugin may shadow any builtin, so calls are left alone
+};
+
+// Only numbers and flat lists of numbers are folded. Anything else may fail
+// to evaluate, and that error belongs to run time, not to code that is never
+// reached.
+bool is_number(Node_t* node) {
+    return node->type == AST_LITERAL && (node->value.type == V_INT || node->value.type == V_FLOAT);
+}
+
+bool is_const(Node_t* node) {
+    if (node->type != AST_ITEMS) {
+        return is_number(node);
+    }
+
+    for (size_t i = 0; i < node->item_count; ++i) {
+        if (!is_number(CHILD(node->items, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool has_int(Node_t* node, long long x) {
+    if (node->type == AST_LITERAL) {
+        return node->value.type == V_INT && node->value.int_value == x;
+    }
+
+    for (size_t i = 0; i < node->item_count; ++i) {
+        if (has_int(CHILD(node->items, i), x)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Integer division by zero (or of the smallest integer by -1) traps, and
+// lists of different lengths do not broadcast.
+bool can_fold_binop(Node_t* node) {
+    Node_t* lhs = NODE(node->lhs);
+    Node_t* rhs = NODE(node->rhs);
+
+    if (!is_const(lhs) || !is_const(rhs)) {
+        return false;
+    }
+
+    if (lhs->type == AST_ITEMS && rhs->type == AST_ITEMS && lhs->item_count != rhs->item_count) {
+        return false;
+    }
+
+    if (node->binop_type == TOK_FSLASH || node->binop_type == TOK_PERC) {
+        return !has_int(rhs, 0) && !has_int(rhs, -1);
+    }
+
+    return true;
+}
+
+bool can_fold_unop(Node_t* node) {
+    Node_t* operand = NODE(node->node);
+
+    if (node->unop_type == TOK_HASH) {
+        return operand->type == AST_ITEMS && is_const(operand);
+    }
+
+    return is_const(operand);
+}
+
+// Expressions that evaluate to an integer whenever they evaluate at all.
+bool is_int_expr(Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return node->value.type == V_INT;
+        case AST_BINOP:
+            return is_int_expr(NODE(node->lhs)) && is_int_expr(NODE(node->rhs));
+        case AST_UNOP:
+            return node->unop_type == TOK_HASH || is_int_expr(NODE(node->node));
+        default:
+            return false;
+    }
+}
+
+bool is_int_literal(Node_t* node, long long x) {
+    return node->type == AST_LITERAL && node->value.type == V_INT && node->value.int_value == x;
+}
+
+// The operand that x*1, 1*x, x+0, 0+x and x-0 reduce to, or NO_NODE.
+NodeIdx_t identity_operand(Node_t* node) {
+    Node_t* lhs = NODE(node->lhs);
+    Node_t* rhs = NODE(node->rhs);
+
+    switch (node->binop_type) {
+        case TOK_STAR:
+            if (is_int_literal(rhs, 1) && is_int_expr(lhs)) {
+                return node->lhs;
+            }
+            if (is_int_literal(lhs, 1) && is_int_expr(rhs)) {
+                return node->rhs;
+            }
+            break;
+        case TOK_PLUS:
+            if (is_int_literal(rhs, 0) && is_int_expr(lhs)) {
+                return node->lhs;
+            }
+            if (is_int_literal(lhs, 0) && is_int_expr(rhs)) {
+                return node->rhs;
+            }
+            break;
+        case TOK_MINUS:
+            if (is_int_literal(rhs, 0) && is_int_expr(lhs)) {
+                return node->lhs;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return NO_NODE;
+}
+
+// Turns node idx into a literal, or into a list of literals. Lists stay
+// AST_ITEMS so that every evaluation still yields a fresh list.
+void store_value(NodeIdx_t idx, Value_t value) {
+    if (!is_list(value)) {
+        Node_t* node = NODE(idx);
+        node->type = AST_LITERAL;
+        node->value = value;
+        return;
+    }
+
+    NodeIdx_t* items = malloc(value.list_size * sizeof(NodeIdx_t));
+    for (size_t i = 0; i < value.list_size; ++i) {
+        items[i] = node_new(AST_LITERAL);
+        NODE(items[i])->value = list_get(value, i);
+    }
+    NodeIdx_t list = list_new(value.list_size, items);
+    free(items);
+
+    Node_t* node = NODE(idx);
+    node->type = AST_ITEMS;
+    node->item_count = value.list_size;
+    node->items = list;
+}
+
+void fold_fcall(struct Folder* f, NodeIdx_t idx) {
+    Node_t* node = NODE(idx);
+
+    // names the program binds itself resolve to a slot
+    if (f->plugins || node->fref.slot != UNRESOLVED.slot) {
+        return;
+    }
+
+    for (size_t i = 0; i < node->param_count; ++i) {
+        if (!is_const(CHILD(node->params, i))) {
+            return;
+        }
+    }
+
+    Value_t callable = get_value(f->builtins, node->fname);
+    if (callable.type != V_CALLABLE) {
+        return;
+    }
+
+    struct EvalFunc* ef = callable.data;
+    if (!ef->pure || ef->param_count != node->param_count) {
+        return;
+    }
+
+    Value_t* args = malloc(node->param_count * sizeof(Value_t));
+    for (size_t i = 0; i < node->param_count; ++i) {
+        args[i] = eval(CHILD(node->params, i), NULL);
+    }
+    Value_t result = ef->func(node->param_count, args);
+    free(args);
+
+    store_value(idx, result);
+}
+
+void fold(struct Folder* f, NodeIdx_t idx);
+
+void fold_list(struct Folder* f, NodeIdx_t list, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        fold(f, LIST(list)[i]);
+    }
+}
+
+// Children are folded before their parent. Folding may grow the tree, so
+// node pointers are fetched again after every recursive call.
+void fold(struct Folder* f, NodeIdx_t idx) {
+    Node_t* node = NODE(idx);
+
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            break;
+        case AST_BINOP: {
+            NodeIdx_t rhs = node->rhs;
+            fold(f, node->lhs);
+            fold(f, rhs);
+
+            node = NODE(idx);
+            if (can_fold_binop(node)) {
+                store_value(idx, eval(node, NULL));
+                break;
+            }
+
+            NodeIdx_t operand = identity_operand(node);
+            if (operand != NO_NODE) {
+                *node = *NODE(operand);
+            }
+        } break;
+        case AST_UNOP:
+            fold(f, node->node);
+            node = NODE(idx);
+            if (can_fold_unop(node)) {
+                store_value(idx, eval(node, NULL));
+            }
+            break;
+        case AST_ASSIGNMENT: {
+            NodeIdx_t rvalue = node->rvalue;
+            fold(f, node->ident);
+            fold(f, rvalue);
+        } break;
+        case AST_PROGRAM:
+        case AST_BLOCK:
+        case AST_CASES:
+            fold_list(f, node->stmnts, node->stmnt_count);
+            break;
+        case AST_ITEMS:
+            fold_list(f, node->items, node->item_count);
+            break;
+        case AST_FCALL:
+            fold_list(f, node->params, node->param_count);
+            fold_fcall(f, idx);
+            break;
+        case AST_FDEF:
+            fold(f, node->fbody);
+            break;
+        case AST_IDX:
+            fold(f, node->iexpr);
+            break;
+        case AST_FOR: {
+            NodeIdx_t lbody = node->lbody;
+            fold(f, node->lexpr);
+            fold(f, lbody);
+        } break;
+        case AST_RANGE: {
+            NodeIdx_t rstop = node->rstop;
+            NodeIdx_t rcount = node->rcount;
+            NodeIdx_t rstep = node->rstep;
+            fold(f, node->rstart);
+            fold(f, rstop);
+            if (rcount) {
+                fold(f, rcount);
+            }
+            if (rstep) {
+                fold(f, rstep);
+            }
+        } break;
+        case AST_CMD:
+            fold_list(f, node->cargs, node->carg_count);
+            break;
+        case AST_CASE: {
+            NodeIdx_t pred = node->pred;
+            fold(f, node->cexpr);
+            fold(f, pred);
+        } break;
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+}
+
+bool loads_plugins(Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            return false;
+        case AST_BINOP:
+            return loads_plugins(NODE(node->lhs)) || loads_plugins(NODE(node->rhs));
+        case AST_UNOP:
+            return loads_plugins(NODE(node->node));
+        case AST_ASSIGNMENT:
+            return loads_plugins(NODE(node->ident)) || loads_plugins(NODE(node->rvalue));
+        case AST_PROGRAM:
+        case AST_BLOCK:
+        case AST_CASES:
+            for (size_t i = 0; i < node->stmnt_count; ++i) {
+                if (loads_plugins(CHILD(node->stmnts, i))) {
+                    return true;
+                }
+            }
+            return false;
+        case AST_ITEMS:
+            for (size_t i = 0; i < node->item_count; ++i) {
+                if (loads_plugins(CHILD(node->items, i))) {
+                    return true;
+                }
+            }
+            return false;
+        case AST_FCALL:
+            for (size_t i = 0; i < node->param_count; ++i) {
+                if (loads_plugins(CHILD(node->params, i))) {
+                    return true;
+                }
+            }
+            return false;
+        case AST_FDEF:
+            return loads_plugins(NODE(node->fbody));
+        case AST_IDX:
+            return loads_plugins(NODE(node->iexpr));
+        case AST_FOR:
+            return loads_plugins(NODE(node->lexpr)) || loads_plugins(NODE(node->lbody));
+        case AST_RANGE:
+            return loads_plugins(NODE(node->rstart)) || loads_plugins(NODE(node->rstop)) ||
+                   (node->rcount && loads_plugins(NODE(node->rcount))) ||
+                   (node->rstep && loads_plugins(NODE(node->rstep)));
+        case AST_CMD:
+            return strcmp(node->cmd, "load") == 0;
+        case AST_CASE:
+            return loads_plugins(NODE(node->cexpr)) || loads_plugins(NODE(node->pred));
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+}
+
+// Calls of small functions are replaced by their bodies, with the arguments
+// in place of the parameters, so that folding and fusion see through them.
+// Only a body that is one expression, binding no names of its own, is
+// inlined, and only where the function is known: its name is bound by one
+// definition and nothing else, and that definition has surely run.
+
+#define INLINE_BUDGET 32  // nodes in a body that may be inlined
+#define INLINE_DEPTH 4    // inlined calls in inlined bodies
+
+bool inline_on = true;
+
+void optimize_use_inlining(bool on) {
+    inline_on = on;
+}
+
+// What binds a name that a definition binds.
+struct Binding {
+    struct Scope* scope;
+    int slot;
+    NodeIdx_t fdef;
+    size_t defs;
+    bool assigned;  // by anything but a definition
+    bool defined;   // by a definition that has run where the walk is
+};
+
+struct Inliner {
+    Context_t* builtins;
+    size_t size;
+    size_t capacity;
+    struct Binding* data;
+    size_t temps;  // temporaries made, for their names
+};
+
+// The inlined calls around the one being inlined.
+struct InlineStack {
+    struct Binding* binding;
+    struct InlineStack* outer;
+};
+
+// What an inlined body refers to: the trees that stand in for the
+// parameters, and how many scopes the call site lies below the one the
+// function was defined in.
+struct Expansion {
+    NodeIdx_t* args;
+    int depth;
+};
+
+struct Scope* scope_up(struct Scope* scope, int depth) {
+    for (int i = 0; i < depth; ++i) {
+        scope = scope->parent;
+    }
+    return scope;
+}
+
+// The binding of ref, seen from scope, or NULL for a name no binding was
+// recorded for. add records it.
+struct Binding* binding(struct Inliner* in, struct Scope* scope, struct SlotRef ref, bool add) {
+    if (ref.slot < 0) {
+        return NULL;
+    }
+    scope = scope_up(scope, ref.depth);
+    for (size_t i = 0; i < in->size; ++i) {
+        if (in->data[i].scope == scope && in->data[i].slot == ref.slot) {
+            return in->data + i;
+        }
+    }
+    if (!add) {
+        return NULL;
+    }
+
+    if (in->size == in->capacity) {
+        in->capacity = in->capacity ? 2 * in->capacity : 16;
+        in->data = realloc(in->data, in->capacity * sizeof(struct Binding));
+    }
+    struct Binding b = {.scope = scope, .slot = ref.slot};
+    in->data[in->size] = b;
+    return in->data + in->size++;
+}
+
+void find_bindings(struct Inliner* in, struct Scope* scope, Node_t* node);
+
+void find_bindings_list(struct Inliner* in, struct Scope* scope, NodeIdx_t list, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        find_bindings(in, scope, CHILD(list, i));
+    }
+}
+
+void find_bindings(struct Inliner* in, struct Scope* scope, Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            break;
+        case AST_BINOP:
+            find_bindings(in, scope, NODE(node->lhs));
+            find_bindings(in, scope, NODE(node->rhs));
+            break;
+        case AST_UNOP:
+            find_bindings(in, scope, NODE(node->node));
+            break;
+        case AST_ASSIGNMENT: {
+            Node_t* ident = NODE(node->ident);
+            struct SlotRef ref = ident->type == AST_IDENTIFIER ? ident->ref : ident->lref;
+            struct Binding* b = binding(in, scope, ref, true);
+            if (b != NULL) {
+                b->assigned = true;
+            }
+            find_bindings(in, scope, ident);
+            find_bindings(in, scope, NODE(node->rvalue));
+        } break;
+        case AST_PROGRAM:
+        case AST_BLOCK:
+        case AST_CASES:
+            find_bindings_list(in, scope, node->stmnts, node->stmnt_count);
+            break;
+        case AST_ITEMS:
+            find_bindings_list(in, scope, node->items, node->item_count);
+            break;
+        case AST_FCALL:
+            find_bindings_list(in, scope, node->params, node->param_count);
+            break;
+        case AST_FDEF: {
+            struct Binding* b = binding(in, scope, NODE(node->fsig)->fref, true);
+            if (b != NULL) {
+                b->fdef = (NodeIdx_t)(node - ast.cells);
+                b->defs++;
+            }
+            find_bindings(in, node->fscope, NODE(node->fbody));
+        } break;
+        case AST_IDX:
+            find_bindings(in, scope, NODE(node->iexpr));
+            break;
+        case AST_FOR: {
+            struct Binding* b = binding(in, scope, node->vref, true);
+            if (b != NULL) {
+                b->assigned = true;
+            }
+            find_bindings(in, scope, NODE(node->lexpr));
+            find_bindings(in, scope, NODE(node->lbody));
+        } break;
+        case AST_RANGE:
+            find_bindings(in, scope, NODE(node->rstart));
+            find_bindings(in, scope, NODE(node->rstop));
+            if (node->rcount) {
+                find_bindings(in, scope, NODE(node->rcount));
+            }
+            if (node->rstep) {
+                find_bindings(in, scope, NODE(node->rstep));
+            }
+            break;
+        case AST_CMD:
+            find_bindings_list(in, scope, node->cargs, node->carg_count);
+            break;
+        case AST_CASE:
+            find_bindings(in, scope, NODE(node->cexpr));
+            find_bindings(in, scope, NODE(node->pred));
+            break;
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+}
+
+size_t inline_size(Node_t* node);
+
+size_t inline_size_list(NodeIdx_t list, size_t count) {
+    size_t size = 0;
+    for (size_t i = 0; i < count && size <= INLINE_BUDGET; ++i) {
+        size += inline_size(CHILD(list, i));
+    }
+    return size;
+}
+
+// The number of nodes in a body, or more than the budget for a body that
+// binds names or runs commands, which it cannot do in the scope of the
+// call site.
+size_t inline_size(Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            return 1;
+        case AST_BINOP:
+            return 1 + inline_size(NODE(node->lhs)) + inline_size(NODE(node->rhs));
+        case AST_UNOP:
+            return 1 + inline_size(NODE(node->node));
+        case AST_BLOCK:
+        case AST_CASES:
+            return 1 + inline_size_list(node->stmnts, node->stmnt_count);
+        case AST_ITEMS:
+            return 1 + inline_size_list(node->items, node->item_count);
+        case AST_FCALL:
+            return 1 + inline_size_list(node->params, node->param_count);
+        case AST_IDX:
+            return 1 + inline_size(NODE(node->iexpr));
+        case AST_RANGE:
+            return 1 + inline_size(NODE(node->rstart)) + inline_size(NODE(node->rstop)) +
+                   (node->rcount ? inline_size(NODE(node->rcount)) : 0) +
+                   (node->rstep ? inline_size(NODE(node->rstep)) : 0);
+        case AST_CASE:
+            return 1 + inline_size(NODE(node->cexpr)) + inline_size(NODE(node->pred));
+        default:
+            return INLINE_BUDGET + 1;
+    }
+}
+
+// Calls b1(...) and b2(...) in a body that inline_size accepted, and the
+// names it refers to, are visited by this walk.
+struct BodyWalk {
+    struct Inliner* in;
+    struct Scope* scope;  // of the body
+    struct Binding* self;
+    struct Scope* site;   // of the call site
+    int depth;            // scopes from the call site up to the definition
+    size_t param_count;
+    size_t* uses;
+    bool* indexed;
+};
+
+// A name the body takes from outside of the function means the same at
+// the call site if no scope in between binds it. A name of the function's
+// own scope must be a parameter.
+bool body_name(struct BodyWalk* w, const char* name, struct SlotRef ref, bool indexed) {
+    if (ref.slot >= 0 && ref.depth == 0) {
+        if ((size_t)ref.slot >= w->param_count) {
+            return false;
+        }
+        w->uses[ref.slot] += !indexed;
+        w->indexed[ref.slot] |= indexed;
+        return true;
+    }
+    for (int i = 0; i < w->depth; ++i) {
+        if (scope_find(scope_up(w->site, i), name) >= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool walk_body(struct BodyWalk* w, Node_t* node);
+
+bool walk_body_list(struct BodyWalk* w, NodeIdx_t list, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!walk_body(w, CHILD(list, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Counts the uses of the parameters, and fails for a body that calls the
+// function itself or refers to a name the call site would capture.
+bool walk_body(struct BodyWalk* w, Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return true;
+        case AST_IDENTIFIER:
+            return body_name(w, node->name, node->ref, false);
+        case AST_BINOP:
+            return walk_body(w, NODE(node->lhs)) && walk_body(w, NODE(node->rhs));
+        case AST_UNOP:
+            return walk_body(w, NODE(node->node));
+        case AST_BLOCK:
+        case AST_CASES:
+            return walk_body_list(w, node->stmnts, node->stmnt_count);
+        case AST_ITEMS:
+            return walk_body_list(w, node->items, node->item_count);
+        case AST_FCALL:
+            return binding(w->in, w->scope, node->fref, false) != w->self && (node->fref.depth > 0 || node->fref.slot < 0) &&
+                   body_name(w, node->fname, node->fref, false) &&
+                   walk_body_list(w, node->params, node->param_count);
+        case AST_IDX:
+            return body_name(w, node->lname, node->lref, true) && walk_body(w, NODE(node->iexpr));
+        case AST_RANGE:
+            return walk_body(w, NODE(node->rstart)) && walk_body(w, NODE(node->rstop)) &&
+                   (!node->rcount || walk_body(w, NODE(node->rcount))) &&
+                   (!node->rstep || walk_body(w, NODE(node->rstep)));
+        case AST_CASE:
+            return walk_body(w, NODE(node->cexpr)) && walk_body(w, NODE(node->pred));
+        default:
+            return false;
+    }
+}
+
+// Whether evaluating node may do more than compute a value: assign, run a
+// command, define a function, or call one that is not a pure builtin.
+bool has_effects(struct Inliner* in, Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            return false;
+        case AST_BINOP:
+            return has_effects(in, NODE(node->lhs)) || has_effects(in, NODE(node->rhs));
+        case AST_UNOP:
+            return has_effects(in, NODE(node->node));
+        case AST_ITEMS:
+            for (size_t i = 0; i < node->item_count; ++i) {
+                if (has_effects(in, CHILD(node->items, i))) {
+                    return true;
+                }
+            }
+            return false;
+        case AST_FCALL: {
+            Value_t callable = node->fref.slot < 0 ? get_value(in->builtins, node->fname) : NIL;
+            if (callable.type != V_CALLABLE || !((struct EvalFunc*)callable.data)->pure) {
+                return true;
+            }
+            for (size_t i = 0; i < node->param_count; ++i) {
+                if (has_effects(in, CHILD(node->params, i))) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        case AST_IDX:
+            return has_effects(in, NODE(node->iexpr));
+        case AST_RANGE:
+            return has_effects(in, NODE(node->rstart)) || has_effects(in, NODE(node->rstop)) ||
+                   (node->rcount && has_effects(in, NODE(node->rcount))) ||
+                   (node->rstep && has_effects(in, NODE(node->rstep)));
+        default:
+            return true;
+    }
+}
+
+struct SlotRef shift_ref(struct Expansion* e, struct SlotRef ref) {
+    if (e != NULL && ref.slot >= 0) {
+        ref.depth += e->depth - 1;
+    }
+    return ref;
+}
+
+NodeIdx_t copy_tree(struct Expansion* e, NodeIdx_t src);
+
+NodeIdx_t copy_list(struct Expansion* e, NodeIdx_t list, size_t count) {
+    NodeIdx_t* items = malloc(count * sizeof(NodeIdx_t));
+    for (size_t i = 0; i < count; ++i) {
+        items[i] = copy_tree(e, LIST(list)[i]);
+    }
+    NodeIdx_t copy = list_new(count, items);
+    free(items);
+    return copy;
+}
+
+// Copies a tree that walk_body accepted, or an argument without effects.
+// With e, the copy is of a body moved to the call site: the parameters
+// become copies of the arguments and the other names are seen from there.
+NodeIdx_t copy_tree(struct Expansion* e, NodeIdx_t src) {
+    Node_t node = *NODE(src);
+    bool param = e != NULL && node.type == AST_IDENTIFIER && node.ref.depth == 0 && node.ref.slot >= 0;
+    if (param) {
+        return copy_tree(NULL, e->args[node.ref.slot]);
+    }
+
+    switch (node.type) {
+        case AST_LITERAL:
+            break;
+        case AST_IDENTIFIER:
+            node.ref = shift_ref(e, node.ref);
+            break;
+        case AST_BINOP:
+            node.lhs = copy_tree(e, node.lhs);
+            node.rhs = copy_tree(e, node.rhs);
+            break;
+        case AST_UNOP:
+            node.node = copy_tree(e, node.node);
+            break;
+        case AST_BLOCK:
+        case AST_CASES:
+            node.stmnts = copy_list(e, node.stmnts, node.stmnt_count);
+            break;
+        case AST_ITEMS:
+            node.items = copy_list(e, node.items, node.item_count);
+            break;
+        case AST_FCALL:
+            node.fref = shift_ref(e, node.fref);
+            node.params = copy_list(e, node.params, node.param_count);
+            break;
+        case AST_IDX:
+            // an indexed parameter stands for a variable
+            if (e != NULL && node.lref.depth == 0 && node.lref.slot >= 0) {
+                Node_t* arg = NODE(e->args[node.lref.slot]);
+                node.lname = arg->name;
+                node.lref = arg->ref;
+            } else {
+                node.lref = shift_ref(e, node.lref);
+            }
+            node.iexpr = copy_tree(e, node.iexpr);
+            break;
+        case AST_RANGE:
+            node.rstart = copy_tree(e, node.rstart);
+            node.rstop = copy_tree(e, node.rstop);
+            node.rcount = node.rcount ? copy_tree(e, node.rcount) : NO_NODE;
+            node.rstep = node.rstep ? copy_tree(e, node.rstep) : NO_NODE;
+            break;
+        case AST_CASE:
+            node.cexpr = copy_tree(e, node.cexpr);
+            node.pred = copy_tree(e, node.pred);
+            break;
+        default:
+            error("cannot copy AST node type: %s\n", node_type_to_str(node.type));
+    }
+
+    NodeIdx_t dst = node_new(node.type);
+    *NODE(dst) = node;
+    return dst;
+}
+
+// A variable of the call site's scope to hold an argument. Its name cannot
+// be written in a program, so it captures nothing.
+NodeIdx_t inline_temp(struct Inliner* in, struct Scope* scope, const char* param) {
+    char name[64];
+    snprintf(name, sizeof(name), "$%.40s%zu", param, ++in->temps);
+    const char* sym = intern(name);
+    scope_declare(scope, sym);
+
+    NodeIdx_t temp = node_new(AST_IDENTIFIER);
+    NODE(temp)->name = sym;
+    NODE(temp)->ref = (struct SlotRef){.depth = 0, .slot = scope_find(scope, sym)};
+    return temp;
+}
+
+void inline_node(struct Inliner* in, struct Scope* scope, NodeIdx_t idx, struct InlineStack* stack, size_t depth);
+
+// Replaces the call at idx with the body of its function, if it is known
+// and small. Every argument is evaluated into a temporary first, in order,
+// as the call would, so that its errors stay; only a number, or a variable
+// the body uses when no argument has effects, goes into the body as it is.
+bool inline_call(struct Inliner* in, struct Scope* scope, NodeIdx_t idx, struct InlineStack* stack, size_t depth) {
+    Node_t* call = NODE(idx);
+    struct Binding* b = binding(in, scope, call->fref, false);
+    if (b == NULL || b->defs != 1 || b->assigned || !b->defined || depth >= INLINE_DEPTH) {
+        return false;
+    }
+    for (struct InlineStack* s = stack; s != NULL; s = s->outer) {
+        if (s->binding == b) {
+            return false;
+        }
+    }
+
+    Node_t* fdef = NODE(b->fdef);
+    Node_t* sig = NODE(fdef->fsig);
+    size_t n = call->param_count;
+    if (sig->param_count != n || inline_size(NODE(fdef->fbody)) > INLINE_BUDGET) {
+        return false;
+    }
+
+    size_t* uses = calloc(n + 1, sizeof(size_t));
+    bool* indexed = calloc(n + 1, sizeof(bool));
+    struct BodyWalk w = {
+        .in = in,
+        .scope = fdef->fscope,
+        .self = b,
+        .site = scope,
+        .depth = call->fref.depth,
+        .param_count = n,
+        .uses = uses,
+        .indexed = indexed,
+    };
+    if (!walk_body(&w, NODE(fdef->fbody))) {
+        free(uses);
+        free(indexed);
+        return false;
+    }
+
+    bool effects = false;
+    for (size_t i = 0; i < n; ++i) {
+        effects |= has_effects(in, CHILD(call->params, i));
+    }
+
+    NodeIdx_t* args = malloc((n + 1) * sizeof(NodeIdx_t));
+    NodeIdx_t* stmnts = malloc((n + 1) * sizeof(NodeIdx_t));
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        NodeIdx_t arg = LIST(NODE(idx)->params)[i];
+        enum NodeType type = NODE(arg)->type;
+        bool as_is = (is_number(NODE(arg)) && !indexed[i]) ||
+                     (type == AST_IDENTIFIER && !effects && (uses[i] > 0 || indexed[i]));
+        if (as_is) {
+            args[i] = arg;
+            continue;
+        }
+
+        NodeIdx_t temp = inline_temp(in, scope, CHILD(NODE(NODE(b->fdef)->fsig)->params, i)->name);
+        NodeIdx_t assign = node_new(AST_ASSIGNMENT);
+        NODE(assign)->ident = temp;
+        NODE(assign)->rvalue = arg;
+        NODE(assign)->assign_op = TOK_EQ;
+        stmnts[count++] = assign;
+        args[i] = temp;
+    }
+
+    struct Expansion e = {.args = args, .depth = NODE(idx)->fref.depth};
+    NodeIdx_t body = copy_tree(&e, NODE(b->fdef)->fbody);
+    if (count > 0) {
+        stmnts[count++] = body;
+        body = node_new(AST_BLOCK);
+        NODE(body)->stmnt_count = count;
+        NODE(body)->stmnts = list_new(count, stmnts);
+    }
+    *NODE(idx) = *NODE(body);
+
+    free(uses);
+    free(indexed);
+    free(args);
+    free(stmnts);
+
+    struct InlineStack inner = {.binding = b, .outer = stack};
+    inline_node(in, scope, idx, &inner, depth + 1);
+    return true;
+}
+
+void inline_list(struct Inliner* in, struct Scope* scope, NodeIdx_t list, size_t count, struct InlineStack* stack,
+                 size_t depth) {
+    for (size_t i = 0; i < count; ++i) {
+        inline_node(in, scope, LIST(list)[i], stack, depth);
+    }
+}
+
+// Inlines the calls in a program or block. A definition that is one of its
+// statements has run for the statements after it, to the end of the list;
+// one nested in a case or a loop body may not have.
+void inline_stmnts(struct Inliner* in, struct Scope* scope, NodeIdx_t idx, struct InlineStack* stack, size_t depth) {
+    size_t count = NODE(idx)->stmnt_count;
+    struct Binding** ran = malloc((count + 1) * sizeof(struct Binding*));
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        NodeIdx_t stmnt = LIST(NODE(idx)->stmnts)[i];
+        inline_node(in, scope, stmnt, stack, depth);
+        if (NODE(stmnt)->type != AST_FDEF) {
+            continue;
+        }
+        struct Binding* b = binding(in, scope, NODE(NODE(stmnt)->fsig)->fref, false);
+        if (b != NULL && !b->defined) {
+            b->defined = true;
+            ran[n++] = b;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        ran[i]->defined = false;
+    }
+    free(ran);
+}
+
+// Inlines the calls in the tree at idx, arguments before the call. The tree
+// grows as it goes, so node pointers are fetched again after every
+// recursive call.
+void inline_node(struct Inliner* in, struct Scope* scope, NodeIdx_t idx, struct InlineStack* stack, size_t depth) {
+    Node_t* node = NODE(idx);
+
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            break;
+        case AST_BINOP: {
+            NodeIdx_t rhs = node->rhs;
+            inline_node(in, scope, node->lhs, stack, depth);
+            inline_node(in, scope, rhs, stack, depth);
+        } break;
+        case AST_UNOP:
+            inline_node(in, scope, node->node, stack, depth);
+            break;
+        case AST_ASSIGNMENT: {
+            NodeIdx_t rvalue = node->rvalue;
+            inline_node(in, scope, node->ident, stack, depth);
+            inline_node(in, scope, rvalue, stack, depth);
+        } break;
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            inline_stmnts(in, scope, idx, stack, depth);
+            break;
+        case AST_CASES:
+            inline_list(in, scope, node->stmnts, node->stmnt_count, stack, depth);
+            break;
+        case AST_ITEMS:
+            inline_list(in, scope, node->items, node->item_count, stack, depth);
+            break;
+        case AST_FCALL:
+            inline_list(in, scope, node->params, node->param_count, stack, depth);
+            inline_call(in, scope, idx, stack, depth);
+            break;
+        case AST_FDEF:
+            inline_node(in, node->fscope, node->fbody, stack, depth);
+            break;
+        case AST_IDX:
+            inline_node(in, scope, node->iexpr, stack, depth);
+            break;
+        case AST_FOR: {
+            NodeIdx_t lbody = node->lbody;
+            inline_node(in, scope, node->lexpr, stack, depth);
+            inline_node(in, scope, lbody, stack, depth);
+        } break;
+        case AST_RANGE: {
+            NodeIdx_t rstop = node->rstop;
+            NodeIdx_t rcount = node->rcount;
+            NodeIdx_t rstep = node->rstep;
+            inline_node(in, scope, node->rstart, stack, depth);
+            inline_node(in, scope, rstop, stack, depth);
+            if (rcount) {
+                inline_node(in, scope, rcount, stack, depth);
+            }
+            if (rstep) {
+                inline_node(in, scope, rstep, stack, depth);
+            }
+        } break;
+        case AST_CMD:
+            inline_list(in, scope, node->cargs, node->carg_count, stack, depth);
+            break;
+        case AST_CASE: {
+            NodeIdx_t pred = node->pred;
+            inline_node(in, scope, node->cexpr, stack, depth);
+            inline_node(in, scope, pred, stack, depth);
+        } break;
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+}
+
+void inline_calls(NodeIdx_t root, struct Scope* globals, Context_t* builtins) {
+    struct Inliner in = {.builtins = builtins};
+    find_bindings(&in, globals, NODE(root));
+    inline_node(&in, globals, root, NULL, 0);
+    free(in.data);
+}
+
+void optimize(NodeIdx_t root, struct Scope* globals, struct Context* builtins) {
+    struct Folder f = {
+        .builtins = builtins,
+        .plugins = loads_plugins(NODE(root)),
+    };
+    // a plugin may bind any name
+    if (inline_on && !f.plugins) {
+        inline_calls(root, globals, builtins);
+    }
+    // the lists that folding evaluates are only copied into the tree
+    size_t mark = temps_mark();
+    fold(&f, root);
+    temps_drain(mark);
+
+    if (!f.plugins) {
+        infer_types(root, globals);
+    }
+}
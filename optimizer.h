@@ -0,0 +1,21 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "evaler.h"
+#include "parser.h"
+
+// Rewrites the resolved tree in place: calls of small functions are replaced
+// by their bodies, operators over literal numbers and lists of numbers, and
+// calls of pure builtins on them, become literals, and arithmetic identities
+// on integers are dropped. Then expressions that can only be ints or floats
+// are marked for evaluation without type checks. Nodes may be appended to
+// the tree, so callers must not hold node pointers across the call. Inlining
+// may add slots to the scopes, so contexts for them are made afterwards.
+void optimize(NodeIdx_t root, struct Scope* globals, struct Context* builtins);
+
+// Switches inlining of function calls on or off.
+void optimize_use_inlining(bool on);
+
+#endif
+
+// vim: ft=c
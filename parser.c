@@ -40,6 +40,7 @@ end: ';' | 'eol'
 #include <string.h>
 #include "lexer.h"
 #include "utils.h"
+#include "writer.h"
 
 typedef struct AstNode Node_t;
 
@@ -62,8 +63,8 @@ size_t node_count = 0;
                      tok_type_to_str((tt3)), tok_type_to_str(parser->tok->type));                           \
     }
 
-void draw_ast(Node_t* root) {
-    Node_t** queue = malloc(node_count * sizeof(Node_t*));
+void draw_ast(NodeIdx_t root) {
+    NodeIdx_t* queue = malloc(node_count * sizeof(NodeIdx_t));
 
     size_t i = 0;
     queue[i++] = root;
@@ -71,115 +72,129 @@ void draw_ast(Node_t* root) {
     FILE* out = fopen("ast.dot", "w");
     fprintf(out, "graph {\n");
 
+    NodeIdx_t k;
     Node_t* n;
     while (i > 0) {
-        n = queue[--i];
+        k = queue[--i];
+        n = NODE(k);
         switch (n->type) {
-            case AST_LITERAL:
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, ast_value_to_str(&n->value));
-                break;
+            case AST_LITERAL: {
+                char* label = ast_value_to_str(&n->value);
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, label);
+                free(label);
+            } break;
             case AST_BINOP: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, binop_type_to_str(n->binop_type));
-                fprintf(out, "v_%p -- v_%p\n", n, n->lhs);
-                fprintf(out, "v_%p -- v_%p\n", n, n->rhs);
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, binop_type_to_str(n->binop_type));
+                fprintf(out, "v_%u -- v_%u\n", k, n->lhs);
+                fprintf(out, "v_%u -- v_%u\n", k, n->rhs);
                 queue[i++] = n->lhs;
                 queue[i++] = n->rhs;
             } break;
             case AST_UNOP: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, unop_type_to_str(n->unop_type));
-                fprintf(out, "v_%p -- v_%p\n", n, n->node);
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, unop_type_to_str(n->unop_type));
+                fprintf(out, "v_%u -- v_%u\n", k, n->node);
                 queue[i++] = n->node;
             } break;
             case AST_IDENTIFIER: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, n->name);
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, n->name);
             } break;
             case AST_ASSIGNMENT: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, "=");
-                fprintf(out, "v_%p -- v_%p\n", n, n->ident);
-                fprintf(out, "v_%p -- v_%p\n", n, n->rvalue);
+                if (n->assign_op == TOK_EQ) {
+                    fprintf(out, "v_%u[label=\"=\"]\n", k);
+                } else {
+                    fprintf(out, "v_%u[label=\"%s=\"]\n", k, binop_type_to_str(n->assign_op));
+                }
+                fprintf(out, "v_%u -- v_%u\n", k, n->ident);
+                fprintf(out, "v_%u -- v_%u\n", k, n->rvalue);
                 queue[i++] = n->ident;
                 queue[i++] = n->rvalue;
             } break;
             case AST_PROGRAM: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, "program");
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, "program");
                 for (size_t j = 0; j < n->stmnt_count; ++j) {
-                    fprintf(out, "v_%p -- v_%p\n", n, n->stmnts[j]);
-                    queue[i++] = n->stmnts[j];
+                    fprintf(out, "v_%u -- v_%u\n", k, LIST(n->stmnts)[j]);
+                    queue[i++] = LIST(n->stmnts)[j];
                 }
             } break;
             case AST_ITEMS: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, "items");
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, "items");
                 for (size_t j = 0; j < n->item_count; ++j) {
-                    fprintf(out, "v_%p -- v_%p\n", n, n->items[j]);
-                    queue[i++] = n->items[j];
+                    fprintf(out, "v_%u -- v_%u\n", k, LIST(n->items)[j]);
+                    queue[i++] = LIST(n->items)[j];
                 }
             } break;
             case AST_FCALL: {
-                fprintf(out, "v_%p[label=\"%s()\"]\n", n, n->fname);
+                fprintf(out, "v_%u[label=\"%s()\"]\n", k, n->fname);
                 for (size_t j = 0; j < n->param_count; ++j) {
-                    fprintf(out, "v_%p -- v_%p\n", n, n->params[j]);
-                    queue[i++] = n->params[j];
+                    fprintf(out, "v_%u -- v_%u\n", k, LIST(n->params)[j]);
+                    queue[i++] = LIST(n->params)[j];
                 }
             } break;
             case AST_FDEF: {
-                fprintf(out, "v_%p[label=\"%s(", n, n->fname);
-                for (size_t j = 0; j < n->param_count; ++j) {
+                Node_t* sig = NODE(n->fsig);
+                fprintf(out, "v_%u[label=\"%s(", k, sig->fname);
+                for (size_t j = 0; j < sig->param_count; ++j) {
                     if (j > 0) {
                         fprintf(out, ", ");
                     }
-                    fprintf(out, "%s", n->params[j]->name);
+                    fprintf(out, "%s", CHILD(sig->params, j)->name);
                 }
                 fprintf(out, ")\"]\n");
-                fprintf(out, "v_%p -- v_%p\n", n, n->fbody);
+                fprintf(out, "v_%u -- v_%u\n", k, n->fbody);
                 queue[i++] = n->fbody;
             } break;
+            case AST_IDX: {
+                fprintf(out, "v_%u[label=\"%s[]\"]\n", k, n->lname);
+                fprintf(out, "v_%u -- v_%u\n", k, n->iexpr);
+                queue[i++] = n->iexpr;
+            } break;
             case AST_BLOCK: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, "block");
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, "block");
                 for (size_t j = 0; j < n->stmnt_count; ++j) {
-                    fprintf(out, "v_%p -- v_%p\n", n, n->stmnts[j]);
-                    queue[i++] = n->stmnts[j];
+                    fprintf(out, "v_%u -- v_%u\n", k, LIST(n->stmnts)[j]);
+                    queue[i++] = LIST(n->stmnts)[j];
                 }
             } break;
             case AST_FOR: {
-                fprintf(out, "v_%p[label=\"%s %s\"]\n", n, "for", n->lvar);
-                fprintf(out, "v_%p -- v_%p [label=\"%s\"]\n", n, n->lexpr, "in");
-                fprintf(out, "v_%p -- v_%p\n", n, n->lbody);
+                fprintf(out, "v_%u[label=\"%s %s\"]\n", k, "for", n->lvar);
+                fprintf(out, "v_%u -- v_%u [label=\"%s\"]\n", k, n->lexpr, "in");
+                fprintf(out, "v_%u -- v_%u\n", k, n->lbody);
                 queue[i++] = n->lexpr;
                 queue[i++] = n->lbody;
             } break;
             case AST_RANGE: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, "range");
-                fprintf(out, "v_%p -- v_%p [label=\"%s\"]\n", n, n->rstart, "start");
-                fprintf(out, "v_%p -- v_%p [label=\"%s\"]\n", n, n->rstop, "stop");
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, "range");
+                fprintf(out, "v_%u -- v_%u [label=\"%s\"]\n", k, n->rstart, "start");
+                fprintf(out, "v_%u -- v_%u [label=\"%s\"]\n", k, n->rstop, "stop");
                 queue[i++] = n->rstart;
                 queue[i++] = n->rstop;
                 if (n->rcount) {
-                    fprintf(out, "v_%p -- v_%p [label=\"%s\"]\n", n, n->rcount, "count");
+                    fprintf(out, "v_%u -- v_%u [label=\"%s\"]\n", k, n->rcount, "count");
                     queue[i++] = n->rcount;
                 } else if (n->rstep) {
-                    fprintf(out, "v_%p -- v_%p [label=\"%s\"]\n", n, n->rstep, "step");
+                    fprintf(out, "v_%u -- v_%u [label=\"%s\"]\n", k, n->rstep, "step");
                     queue[i++] = n->rstep;
                 }
             } break;
             case AST_CMD: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, n->cmd);
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, n->cmd);
                 for (size_t j = 0; j < n->carg_count; ++j) {
-                    fprintf(out, "v_%p -- v_%p\n", n, n->cargs[j]);
-                    queue[i++] = n->cargs[j];
+                    fprintf(out, "v_%u -- v_%u\n", k, LIST(n->cargs)[j]);
+                    queue[i++] = LIST(n->cargs)[j];
                 }
             } break;
             case AST_CASE: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, "case");
-                fprintf(out, "v_%p -- v_%p\n", n, n->cexpr);
-                fprintf(out, "v_%p -- v_%p [label=\"%s\"]\n", n, n->pred, "if");
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, "case");
+                fprintf(out, "v_%u -- v_%u\n", k, n->cexpr);
+                fprintf(out, "v_%u -- v_%u [label=\"%s\"]\n", k, n->pred, "if");
                 queue[i++] = n->cexpr;
                 queue[i++] = n->pred;
             } break;
             case AST_CASES: {
-                fprintf(out, "v_%p[label=\"%s\"]\n", n, "cases");
+                fprintf(out, "v_%u[label=\"%s\"]\n", k, "cases");
                 for (size_t j = 0; j < n->stmnt_count; ++j) {
-                    fprintf(out, "v_%p -- v_%p\n", n, n->stmnts[j]);
-                    queue[i++] = n->stmnts[j];
+                    fprintf(out, "v_%u -- v_%u\n", k, LIST(n->stmnts)[j]);
+                    queue[i++] = LIST(n->stmnts)[j];
                 }
             } break;
             default:
@@ -189,6 +204,7 @@ void draw_ast(Node_t* root) {
 
     fprintf(out, "}\n");
     fclose(out);
+    free(queue);
 
     system("dot -Tsvg -oast.svg ast.dot");
 }
@@ -210,46 +226,11 @@ const char* value_type_to_str(enum ValueType value_type) {
     return nc_value_type_to_str(value_type);
 }
 
-const char* ast_value_to_str(struct AstValue* value) {
-    StringBuilder sb = {};
-
-    switch (value->type) {
-        case V_NIL:
-            sb_append(&sb, "nil");
-            break;
-        case V_INT: {
-            char* buf = malloc(256 * sizeof(char));
-            sprintf(buf, "%lld", value->int_value);
-            sb_append(&sb, buf);
-        } break;
-        case V_FLOAT: {
-            char* buf = malloc(256 * sizeof(char));
-            sprintf(buf, "%f", value->float_value);
-            sb_append(&sb, buf);
-        } break;
-        case V_STRING: {
-            sb_append(&sb, value->string_value);
-        } break;
-        case V_LIST: {
-            sb_append(&sb, "[");
-            for (size_t i = 0; i < value->list_size; ++i) {
-                if (i > 0) {
-                    sb_append(&sb, ", ");
-                }
-                sb_append(&sb, ast_value_to_str(value->list_value + i));
-            }
-            sb_append(&sb, "]");
-        } break;
-        case V_RANGE: {
-            sb_append(&sb, ast_value_to_str(&value->range_value->start));
-            sb_append(&sb, "..");
-            sb_append(&sb, ast_value_to_str(&value->range_value->stop));
-        } break;
-        default:
-            error("%s: unknown value type: %s\n", __PRETTY_FUNCTION__, value_type_to_str(value->type));
-    }
-
-    return sb_string(&sb);
+char* ast_value_to_str(struct AstValue* value) {
+    struct Writer writer = writer_new(NULL);
+    writer_value(&writer, *value);
+    writer_put(&writer, "", 1);
+    return writer.data;
 }
 
 const char* binop_type_to_str(enum TokenType binop_type) {
@@ -302,28 +283,120 @@ const char* unop_type_to_str(enum TokenType unop_type) {
     }
 }
 
-struct AstNode* node_new() {
+struct Ast ast = {0};
+
+NodeIdx_t ast_alloc(size_t cells) {
+    if (ast.capacity == 0) {
+        ast.capacity = 1024;
+        ast.cells = malloc(ast.capacity * sizeof(Node_t));
+        ast.size = 1;  // index 0 is NO_NODE
+    }
+
+    if (ast.size + cells > UINT32_MAX) {
+        error("program too large\n");
+    }
+
+    while (ast.size + cells > ast.capacity) {
+        ast.capacity *= 2;
+        ast.cells = realloc(ast.cells, ast.capacity * sizeof(Node_t));
+    }
+
+    NodeIdx_t idx = (NodeIdx_t)ast.size;
+    ast.size += cells;
+    return idx;
+}
+
+NodeIdx_t node_new(enum NodeType type) {
     node_count++;
-    return malloc(sizeof(struct AstNode));
+    NodeIdx_t idx = ast_alloc(1);
+    memset(NODE(idx), 0, sizeof(Node_t));
+    NODE(idx)->type = type;
+    return idx;
+}
+
+#define LINKS_PER_CELL (sizeof(Node_t) / sizeof(NodeIdx_t))
+
+NodeIdx_t list_new(size_t count, const NodeIdx_t* items) {
+    if (count == 0) {
+        return NO_NODE;
+    }
+
+    NodeIdx_t idx = ast_alloc((count + LINKS_PER_CELL - 1) / LINKS_PER_CELL);
+    memcpy(LIST(idx), items, count * sizeof(NodeIdx_t));
+    return idx;
+}
+
+size_t ast_bytes() {
+    return ast.size * sizeof(Node_t);
 }
 
-void parse(struct Parser* parser, struct AstNode* root) {
-    parse_program(parser, root);
+void ast_free() {
+    free(ast.cells);
+    ast.cells = NULL;
+    ast.size = 0;
+    ast.capacity = 0;
+    node_count = 0;
 }
 
-void parse_program(struct Parser* parser, struct AstNode* node) {
+// Children collected while their parent is being parsed.
+struct NodeList {
+    size_t size;
+    size_t capacity;
+    NodeIdx_t* data;
+};
+
+void nl_append(struct NodeList* list, NodeIdx_t node) {
+    if (list->size >= list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 8;
+        list->data = realloc(list->data, list->capacity * sizeof(NodeIdx_t));
+    }
+    list->data[list->size++] = node;
+}
+
+NodeIdx_t nl_finish(struct NodeList* list) {
+    NodeIdx_t idx = list_new(list->size, list->data);
+    free(list->data);
+    return idx;
+}
+
+NodeIdx_t binop_new(enum TokenType op, NodeIdx_t lhs, NodeIdx_t rhs) {
+    NodeIdx_t idx = node_new(AST_BINOP);
+    Node_t* node = NODE(idx);
+    node->binop_type = op;
+    node->lhs = lhs;
+    node->rhs = rhs;
+    return idx;
+}
+
+NodeIdx_t items_new(struct NodeList* list) {
+    uint32_t count = list->size;
+    NodeIdx_t items = nl_finish(list);
+
+    NodeIdx_t idx = node_new(AST_ITEMS);
+    NODE(idx)->item_count = count;
+    NODE(idx)->items = items;
+    return idx;
+}
+
+NodeIdx_t literal_new(struct AstValue value) {
+    NodeIdx_t idx = node_new(AST_LITERAL);
+    NODE(idx)->value = value;
+    return idx;
+}
+
+NodeIdx_t parse(struct Parser* parser) {
+    return parse_program(parser);
+}
+
+NodeIdx_t parse_program(struct Parser* parser) {
     while (parser->tok->type == TOK_EOL) {
         parser->tok++;
     }
-    node->type = AST_PROGRAM;
 
-    PtrArr arr = {};
-    struct AstNode* tmp;
+    struct NodeList list = {};
 
     while (parser->tok->type != TOK_EOF) {
-        tmp = node_new();
-        parse_stmnt(parser, tmp);
-        ptrarr_append(&arr, tmp);
+        nl_append(&list, parse_stmnt(parser));
 
         if (parser->tok->type != TOK_EOF) {
             expect2(TOK_SEMICOLON, TOK_EOL);
@@ -334,316 +407,400 @@ void parse_program(struct Parser* parser, struct AstNode* node) {
         }
     }
 
-    node->stmnt_count = arr.size;
-    node->stmnts = (struct AstNode**)arr.data;
+    uint32_t count = list.size;
+    NodeIdx_t stmnts = nl_finish(&list);
+
+    NodeIdx_t idx = node_new(AST_PROGRAM);
+    NODE(idx)->stmnt_count = count;
+    NODE(idx)->stmnts = stmnts;
 
     while (parser->tok->type == TOK_EOL) {
         parser->tok++;
     }
+
+    return idx;
+}
+
+NodeIdx_t for_new(const char* lvar, NodeIdx_t lexpr, NodeIdx_t lbody) {
+    NodeIdx_t idx = node_new(AST_FOR);
+    Node_t* node = NODE(idx);
+    node->lvar = lvar;
+    node->vref = UNRESOLVED;
+    node->lexpr = lexpr;
+    node->lbody = lbody;
+    return idx;
 }
 
-void parse_stmnt(struct Parser* parser, struct AstNode* node) {
+// `table x in xs, e1, e2, ...` is one AST_FOR over xs whose body holds the
+// columns e1, e2, ..., followed by the heading of every column: x, then the
+// source text of each expression.
+void parse_table(struct Parser* parser, struct NodeList* args) {
+    expect(TOK_IDENTIFIER);
+    const char* lvar = parser->tok->sym;
+    parser->tok++;
+
+    expect(KW_in);
+    parser->tok++;
+
+    NodeIdx_t lexpr = parse_expr(parser);
+
+    struct NodeList columns = {};
+    struct NodeList headings = {};
+    struct AstValue heading = {.type = V_STRING, .string_value = lvar};
+    nl_append(&headings, literal_new(heading));
+    while (parser->tok->type == TOK_COMMA) {
+        parser->tok++;
+
+        const struct Token* first = parser->tok;
+        nl_append(&columns, parse_expr(parser));
+        const struct Token* last = parser->tok - 1;
+
+        heading.string_value = strndup(parser->source + first->offset, last->offset + last->length - first->offset);
+        nl_append(&headings, literal_new(heading));
+    }
+
+    nl_append(args, for_new(lvar, lexpr, items_new(&columns)));
+    nl_append(args, items_new(&headings));
+}
+
+NodeIdx_t parse_stmnt(struct Parser* parser) {
     if (parser->tok->type == KW_for) {
-        node->type = AST_FOR;
         parser->tok++;
 
         expect(TOK_IDENTIFIER);
-        node->lvar = parser->tok->value;
+        const char* lvar = parser->tok->sym;
         parser->tok++;
 
         expect(KW_in);
         parser->tok++;
 
-        node->lexpr = node_new();
-        parse_expr(parser, node->lexpr);
+        NodeIdx_t lexpr = parse_expr(parser);
 
         if (parser->tok->type == TOK_EOL) {
             parser->tok++;
         }
 
-        node->lbody = node_new();
-        parse_stmnt(parser, node->lbody);
+        NodeIdx_t lbody = parse_stmnt(parser);
+
+        return for_new(lvar, lexpr, lbody);
     } else if (parser->tok->type == TOK_CMD) {
-        node->type = AST_CMD;
-        node->cmd = parser->tok->value;
-        node->carg_count = 0;
+        const char* cmd = parser->tok->sym;
         parser->tok++;
 
-        PtrArr arr = {};
-        struct AstNode* tmp;
-        while (parser->tok->type != TOK_EOL && parser->tok->type != TOK_EOF && parser->tok->type != TOK_SEMICOLON) {
-            tmp = node_new();
-            parse_expr(parser, tmp);
-            ptrarr_append(&arr, tmp);
+        struct NodeList list = {};
+        if (strcmp(cmd, "table") == 0) {
+            parse_table(parser, &list);
         }
+        while (parser->tok->type != TOK_EOL && parser->tok->type != TOK_EOF && parser->tok->type != TOK_SEMICOLON &&
+               parser->tok->type != TOK_RBRACE) {
+            NodeIdx_t arg = parse_expr(parser);
 
-        node->cargs = (struct AstNode**)arr.data;
-        node->carg_count = arr.size;
+            // `expr for x in xs` hands the command expr for every x
+            if (parser->tok->type == KW_for) {
+                parser->tok++;
+
+                expect(TOK_IDENTIFIER);
+                const char* lvar = parser->tok->sym;
+                parser->tok++;
+
+                expect(KW_in);
+                parser->tok++;
+
+                arg = for_new(lvar, parse_expr(parser), arg);
+            }
+
+            nl_append(&list, arg);
+        }
+
+        uint32_t count = list.size;
+        NodeIdx_t cargs = nl_finish(&list);
+
+        NodeIdx_t idx = node_new(AST_CMD);
+        Node_t* node = NODE(idx);
+        node->cmd = cmd;
+        node->carg_count = count;
+        node->cargs = cargs;
+        return idx;
     } else {
-        parse_expr(parser, node);
+        NodeIdx_t expr = parse_expr(parser);
 
         if (parser->tok->type == KW_if) {
             parser->tok++;
-            struct AstNode* tmp = node_new();
-            *tmp = *node;
-            node->type = AST_CASE;
-            node->cexpr = tmp;
-            node->pred = node_new();
-            parse_expr(parser, node->pred);
+            NodeIdx_t pred = parse_expr(parser);
+
+            NodeIdx_t idx = node_new(AST_CASE);
+            NODE(idx)->cexpr = expr;
+            NODE(idx)->pred = pred;
+            return idx;
         }
+
+        return expr;
     }
 }
 
-void parse_expr(struct Parser* parser, struct AstNode* node) {
-    return parse_disj(parser, node);
+NodeIdx_t parse_expr(struct Parser* parser) {
+    return parse_disj(parser);
 }
 
-void parse_disj(struct Parser* parser, struct AstNode* node) {
-    parse_conj(parser, node);
+NodeIdx_t parse_disj(struct Parser* parser) {
+    NodeIdx_t lhs = parse_conj(parser);
 
     if (parser->tok->type == TOK_PIPE) {
-        struct AstNode* rhs = node_new();
-        *rhs = *node;
-        node->type = AST_BINOP;
-        node->lhs = rhs;
-        node->rhs = node_new();
-        node->binop_type = parser->tok->type;
+        enum TokenType op = parser->tok->type;
         parser->tok++;
-        parse_conj(parser, node->rhs);
+        NodeIdx_t rhs = parse_conj(parser);
+        return binop_new(op, lhs, rhs);
     }
+
+    return lhs;
 }
 
-void parse_conj(struct Parser* parser, struct AstNode* node) {
-    parse_comp(parser, node);
+NodeIdx_t parse_conj(struct Parser* parser) {
+    NodeIdx_t lhs = parse_comp(parser);
 
     if (parser->tok->type == TOK_AMP) {
-        struct AstNode* rhs = node_new();
-        *rhs = *node;
-        node->type = AST_BINOP;
-        node->lhs = rhs;
-        node->rhs = node_new();
-        node->binop_type = parser->tok->type;
+        enum TokenType op = parser->tok->type;
         parser->tok++;
-        parse_comp(parser, node->rhs);
+        NodeIdx_t rhs = parse_comp(parser);
+        return binop_new(op, lhs, rhs);
     }
+
+    return lhs;
 }
 
-void parse_comp(struct Parser* parser, struct AstNode* node) {
-    parse_range(parser, node);
+NodeIdx_t parse_comp(struct Parser* parser) {
+    NodeIdx_t lhs = parse_range(parser);
 
     if (parser->tok->type == TOK_LT || parser->tok->type == TOK_GT || parser->tok->type == TOK_LEQ ||
         parser->tok->type == TOK_GEQ || parser->tok->type == TOK_EEQ || parser->tok->type == TOK_NEQ) {
-        struct AstNode* rhs = node_new();
-        *rhs = *node;
-        node->type = AST_BINOP;
-        node->lhs = rhs;
-        node->rhs = node_new();
-        node->binop_type = parser->tok->type;
+        enum TokenType op = parser->tok->type;
         parser->tok++;
-        parse_range(parser, node->rhs);
+        NodeIdx_t rhs = parse_range(parser);
+        return binop_new(op, lhs, rhs);
     }
+
+    return lhs;
 }
 
-void parse_range(struct Parser* parser, struct AstNode* node) {
-    parse_sum(parser, node);
+NodeIdx_t parse_range(struct Parser* parser) {
+    NodeIdx_t start = parse_sum(parser);
 
-    if (parser->tok->type == TOK_DOTDOT) {
-        struct AstNode* start = node_new();
-        *start = *node;
+    if (parser->tok->type != TOK_DOTDOT) {
+        return start;
+    }
 
-        node->type = AST_RANGE;
-        node->rstart = start;
-        node->rcount = NULL;
-        node->rstep = NULL;
+    parser->tok++;
+    NodeIdx_t stop = parse_sum(parser);
+    NodeIdx_t count = NO_NODE;
+    NodeIdx_t step = NO_NODE;
 
+    if (parser->tok->type == TOK_DOTDOT) {
         parser->tok++;
-        node->rstop = node_new();
-        parse_sum(parser, node->rstop);
-
-        if (parser->tok->type == TOK_DOTDOT) {
+        if (parser->tok->type == TOK_PLUS) {
             parser->tok++;
-            struct AstNode* tmp = node_new();
-            if (parser->tok->type == TOK_PLUS) {
-                parser->tok++;
-                node->rstep = tmp;
-            } else {
-                node->rcount = tmp;
-            }
-            parse_sum(parser, tmp);
+            step = parse_sum(parser);
+        } else {
+            count = parse_sum(parser);
         }
     }
+
+    NodeIdx_t idx = node_new(AST_RANGE);
+    Node_t* node = NODE(idx);
+    node->rstart = start;
+    node->rstop = stop;
+    node->rcount = count;
+    node->rstep = step;
+    return idx;
 }
 
-void parse_sum(struct Parser* parser, struct AstNode* node) {
-    parse_term(parser, node);
+NodeIdx_t parse_sum(struct Parser* parser) {
+    NodeIdx_t lhs = parse_term(parser);
 
     while (parser->tok->type == TOK_PLUS || parser->tok->type == TOK_MINUS) {
         enum TokenType op = parser->tok->type;
         parser->tok++;
 
-        struct AstNode* rhs = node_new();
-        parse_term(parser, rhs);
+        NodeIdx_t rhs = parse_term(parser);
+        lhs = binop_new(op, lhs, rhs);
+    }
 
-        struct AstNode* lhs = node_new();
-        *lhs = *node;
+    return lhs;
+}
+
+NodeIdx_t parse_term(struct Parser* parser) {
+    NodeIdx_t lhs = parse_factor(parser);
 
-        node->type = AST_BINOP;
-        node->binop_type = op;
-        node->lhs = lhs;
-        node->rhs = rhs;
+    while (parser->tok->type == TOK_STAR || parser->tok->type == TOK_FSLASH || parser->tok->type == TOK_PERC) {
+        enum TokenType op = parser->tok->type;
+        parser->tok++;
+
+        NodeIdx_t rhs = parse_factor(parser);
+        lhs = binop_new(op, lhs, rhs);
     }
+
+    return lhs;
 }
 
-void parse_term(struct Parser* parser, struct AstNode* node) {
-    parse_factor(parser, node);
+NodeIdx_t parse_factor(struct Parser* parser) {
+    if (parser->tok->type == TOK_MINUS || parser->tok->type == TOK_HASH || parser->tok->type == TOK_BANG) {
+        enum TokenType op = parser->tok->type;
+        parser->tok++;
+        NodeIdx_t operand = parse_factor(parser);
+
+        NodeIdx_t idx = node_new(AST_UNOP);
+        NODE(idx)->unop_type = op;
+        NODE(idx)->node = operand;
+        return idx;
+    }
 
-    while (parser->tok->type == TOK_STAR || parser->tok->type == TOK_FSLASH || parser->tok->type == TOK_PERC) {
+    NodeIdx_t lhs = parse_atom(parser);
+
+    if (parser->tok->type == TOK_POWER) {
         enum TokenType op = parser->tok->type;
         parser->tok++;
+        NodeIdx_t rhs = parse_factor(parser);
+        return binop_new(op, lhs, rhs);
+    }
 
-        struct AstNode* rhs = node_new();
-        parse_factor(parser, rhs);
+    return lhs;
+}
 
-        struct AstNode* lhs = node_new();
-        *lhs = *node;
+NodeIdx_t assignment_new(NodeIdx_t ident, NodeIdx_t rvalue, enum TokenType op) {
+    NodeIdx_t idx = node_new(AST_ASSIGNMENT);
+    NODE(idx)->ident = ident;
+    NODE(idx)->rvalue = rvalue;
+    NODE(idx)->assign_op = op;
+    return idx;
+}
 
-        node->type = AST_BINOP;
-        node->binop_type = op;
-        node->lhs = lhs;
-        node->rhs = rhs;
+// The operator an assignment token applies before storing: TOK_EQ for =,
+// TOK_PLUS for += and so on, and TOK_EOF for any other token.
+enum TokenType assign_op(enum TokenType type) {
+    switch (type) {
+        case TOK_EQ:
+            return TOK_EQ;
+        case TOK_PLUSEQ:
+            return TOK_PLUS;
+        case TOK_MINUSEQ:
+            return TOK_MINUS;
+        case TOK_STAREQ:
+            return TOK_STAR;
+        case TOK_FSLASHEQ:
+            return TOK_FSLASH;
+        default:
+            return TOK_EOF;
     }
 }
 
-void parse_factor(struct Parser* parser, struct AstNode* node) {
-    if (parser->tok->type == TOK_MINUS || parser->tok->type == TOK_HASH || parser->tok->type == TOK_BANG) {
-        node->type = AST_UNOP;
-        node->unop_type = parser->tok->type;
+// Parses the rest of an assignment to lvalue if one follows.
+NodeIdx_t parse_assignment_tail(struct Parser* parser, NodeIdx_t lvalue) {
+    enum TokenType op = assign_op(parser->tok->type);
+    if (op == TOK_EOF) {
+        return lvalue;
+    }
+    parser->tok++;
+    NodeIdx_t rvalue = parse_expr(parser);
+    return assignment_new(lvalue, rvalue, op);
+}
+
+void parse_item_list(struct Parser* parser, struct NodeList* list) {
+    nl_append(list, parse_expr(parser));
+
+    while (parser->tok->type == TOK_COMMA) {
         parser->tok++;
-        node->node = node_new();
-        parse_factor(parser, node->node);
-    } else {
-        parse_atom(parser, node);
-
-        if (parser->tok->type == TOK_POWER) {
-            struct AstNode* lhs = node_new();
-            *lhs = *node;
-            node->type = AST_BINOP;
-            node->binop_type = parser->tok->type;
-            node->lhs = lhs;
-            parser->tok++;
-            node->rhs = node_new();
-            parse_factor(parser, node->rhs);
-        }
+        nl_append(list, parse_expr(parser));
     }
 }
 
-void parse_atom_ident_tail(struct Parser* parser, struct AstNode* node) {
+NodeIdx_t parse_atom_ident_tail(struct Parser* parser, const char* name) {
     switch (parser->tok->type) {
-        case TOK_EQ: {
-            Node_t* lhs = node_new();
-            *lhs = *node;
-            node->ident = lhs;
-            node->type = AST_ASSIGNMENT;
-            parser->tok++;
-            node->rvalue = node_new();
-            parse_expr(parser, node->rvalue);
-        } break;
         case TOK_LPAREN: {
             parser->tok++;
 
-            node->type = AST_FCALL;
-            node->fname = node->name;
-
+            struct NodeList list = {};
             if (parser->tok->type != TOK_RPAREN) {
-                struct AstNode* tmp = node_new();
-                tmp->item_count = 0;
-                parse_items(parser, tmp);
-                node->params = tmp->items;
-                node->param_count = tmp->item_count;
+                parse_item_list(parser, &list);
             }
 
             expect(TOK_RPAREN);
             parser->tok++;
 
-            if (parser->tok->type == TOK_EQ) {
-                parser->tok++;
+            uint32_t count = list.size;
+            NodeIdx_t params = nl_finish(&list);
 
-                node->type = AST_FDEF;
-                for (size_t ip = 0; ip < node->param_count; ++ip) {
-                    if (node->params[ip]->type != AST_IDENTIFIER) {
-                        syntax_error("expected identifier but got %s\n", node_type_to_str(node->params[ip]->type));
-                    }
+            NodeIdx_t call = node_new(AST_FCALL);
+            Node_t* node = NODE(call);
+            node->fname = name;
+            node->fref = UNRESOLVED;
+            node->param_count = count;
+            node->params = params;
+
+            if (parser->tok->type != TOK_EQ) {
+                return call;
+            }
+            parser->tok++;
+
+            for (size_t ip = 0; ip < count; ++ip) {
+                if (CHILD(params, ip)->type != AST_IDENTIFIER) {
+                    syntax_error("expected identifier but got %s\n", node_type_to_str(CHILD(params, ip)->type));
                 }
-                node->fbody = node_new();
-                parse_expr(parser, node->fbody);
             }
-        } break;
+            NodeIdx_t body = parse_expr(parser);
+
+            NodeIdx_t idx = node_new(AST_FDEF);
+            NODE(idx)->fsig = call;
+            NODE(idx)->fbody = body;
+            NODE(idx)->fscope = NULL;
+            return idx;
+        }
         case TOK_LBRACKET: {
             parser->tok++;
 
-            node->type = AST_IDX;
-            node->lname = node->name;
-            node->iexpr = node_new();
-
-            parse_expr(parser, node->iexpr);
+            NodeIdx_t iexpr = parse_expr(parser);
             expect(TOK_RBRACKET);
             parser->tok++;
 
-            if (parser->tok->type == TOK_EQ) {
-                parser->tok++;
+            NodeIdx_t idx = node_new(AST_IDX);
+            Node_t* node = NODE(idx);
+            node->lname = name;
+            node->lref = UNRESOLVED;
+            node->iexpr = iexpr;
 
-                struct AstNode* tmp = node_new();
-                *tmp = *node;
-                node->type = AST_ASSIGNMENT;
-                node->ident = tmp;
-                node->rvalue = node_new();
-                parse_expr(parser, node->rvalue);
-            }
-        } break;
-        default:
-            break;
+            return parse_assignment_tail(parser, idx);
+        }
+        default: {
+            NodeIdx_t idx = node_new(AST_IDENTIFIER);
+            NODE(idx)->name = name;
+            NODE(idx)->ref = UNRESOLVED;
+
+            return parse_assignment_tail(parser, idx);
+        }
     }
 }
 
-void parse_items(struct Parser* parser, struct AstNode* node) {
-    node->type = AST_ITEMS;
-
-    PtrArr arr = {};
-
-    struct AstNode* tmp = node_new();
-    parse_expr(parser, tmp);
-    ptrarr_append(&arr, tmp);
-
-    while (parser->tok->type == TOK_COMMA) {
-        parser->tok++;
-        tmp = node_new();
-        parse_expr(parser, tmp);
-        ptrarr_append(&arr, tmp);
-    }
-    node->items = (struct AstNode**)arr.data;
-    node->item_count = arr.size;
+NodeIdx_t parse_items(struct Parser* parser) {
+    struct NodeList list = {};
+    parse_item_list(parser, &list);
+    return items_new(&list);
 }
 
-void parse_block(struct Parser* parser, struct AstNode* node) {
+NodeIdx_t parse_block(struct Parser* parser) {
     expect(TOK_LBRACE);
     parser->tok++;
-    node->type = AST_BLOCK;
+    enum NodeType type = AST_BLOCK;
 
     while (parser->tok->type == TOK_EOL) {
         parser->tok++;
     }
 
-    PtrArr arr = {};
-
-    struct AstNode* tmp;
+    struct NodeList list = {};
 
     while (parser->tok->type != TOK_RBRACE) {
-        tmp = node_new();
-        parse_stmnt(parser, tmp);
-        ptrarr_append(&arr, tmp);
+        NodeIdx_t stmnt = parse_stmnt(parser);
+        nl_append(&list, stmnt);
 
-        if (arr.size == 1 && tmp->type == AST_CASE) {
-            node->type = AST_CASES;
+        if (list.size == 1 && NODE(stmnt)->type == AST_CASE) {
+            type = AST_CASES;
         }
 
         expect3(TOK_RBRACE, TOK_SEMICOLON, TOK_EOL);
@@ -653,8 +810,12 @@ void parse_block(struct Parser* parser, struct AstNode* node) {
         }
     }
 
-    node->stmnts = (struct AstNode**)arr.data;
-    node->stmnt_count = arr.size;
+    uint32_t count = list.size;
+    NodeIdx_t stmnts = nl_finish(&list);
+
+    NodeIdx_t idx = node_new(type);
+    NODE(idx)->stmnt_count = count;
+    NODE(idx)->stmnts = stmnts;
 
     while (parser->tok->type == TOK_EOL) {
         parser->tok++;
@@ -662,61 +823,75 @@ void parse_block(struct Parser* parser, struct AstNode* node) {
 
     expect(TOK_RBRACE);
     parser->tok++;
+
+    return idx;
+}
+
+// Copies the text of a number token so that it can be handed to atoll/atof.
+const char* tok_text(struct Parser* parser, char* buf, size_t size) {
+    struct Token* tok = parser->tok;
+    if (tok->length >= size) {
+        syntax_error("number literal too long: %.*s\n", (int)tok->length, parser->source + tok->offset);
+    }
+    memcpy(buf, parser->source + tok->offset, tok->length);
+    buf[tok->length] = '\0';
+    return buf;
 }
 
-void parse_atom(struct Parser* parser, struct AstNode* node) {
+NodeIdx_t parse_atom(struct Parser* parser) {
+    char buf[64];
+    struct AstValue value = {.type = V_NIL};
+
     switch (parser->tok->type) {
         case TOK_IDENTIFIER: {
-            node->type = AST_IDENTIFIER;
-            node->name = parser->tok->value;
+            const char* name = parser->tok->sym;
             parser->tok++;
-            parse_atom_ident_tail(parser, node);
-        } break;
+            return parse_atom_ident_tail(parser, name);
+        }
         case TOK_LPAREN: {
             parser->tok++;
-            parse_expr(parser, node);
+            NodeIdx_t expr = parse_expr(parser);
             expect(TOK_RPAREN);
             parser->tok++;
-        } break;
+            return expr;
+        }
         case TOK_LBRACKET: {
             parser->tok++;
+            struct NodeList list = {};
             if (parser->tok->type != TOK_RBRACKET) {
-                parse_items(parser, node);
-            } else {
-                node->type = AST_ITEMS;
-                node->item_count = 0;
+                parse_item_list(parser, &list);
             }
             expect(TOK_RBRACKET);
             parser->tok++;
-        } break;
+            return items_new(&list);
+        }
         case TOK_INTEGER: {
-            node->type = AST_LITERAL;
-            node->value.type = V_INT;
-            node->value.int_value = atoll(parser->tok->value);
+            value.type = V_INT;
+            value.int_value = atoll(tok_text(parser, buf, sizeof(buf)));
             parser->tok++;
-        } break;
+            return literal_new(value);
+        }
         case TOK_FLOAT: {
-            node->type = AST_LITERAL;
-            node->value.type = V_FLOAT;
-            node->value.float_value = atof(parser->tok->value);
+            value.type = V_FLOAT;
+            value.float_value = atof(tok_text(parser, buf, sizeof(buf)));
             parser->tok++;
-        } break;
+            return literal_new(value);
+        }
         case TOK_STRING: {
-            node->type = AST_LITERAL;
-            node->value.type = V_STRING;
-            node->value.string_value = parser->tok->value;
+            value.type = V_STRING;
+            value.string_value = strndup(parser->source + parser->tok->offset, parser->tok->length);
             parser->tok++;
-        } break;
+            return literal_new(value);
+        }
         case KW_Inf: {
-            node->type = AST_LITERAL;
-            node->value.type = V_INF;
-            node->value.int_value = 1;
+            value.type = V_INF;
+            value.int_value = 1;
             parser->tok++;
-        } break;
-        case TOK_LBRACE: {
-            parse_block(parser, node);
-        } break;
+            return literal_new(value);
+        }
+        case TOK_LBRACE:
+            return parse_block(parser);
         default:
-            syntax_error("unexpected token: %s\n", tok_to_str(*parser->tok));
+            syntax_error("unexpected token: %s\n", tok_to_str(parser->source, *parser->tok));
     };
 }
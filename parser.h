@@ -2,6 +2,7 @@
 #define PARSER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "token.h"
 #include "nc.h"
 
@@ -30,6 +31,42 @@ enum NodeType {
 #undef X
 };
 
+struct Scope;
+
+// Lexical address of a name, filled in by the resolver: the number of
+// contexts to walk up and the slot within that context. Names bound at
+// runtime (builtins, plugins) have a negative slot and are looked up by name.
+struct SlotRef {
+    int depth;
+    int slot;
+};
+
+#define UNRESOLVED ((struct SlotRef){.depth = 0, .slot = -1})
+
+// What type inference (infer.c) proved an expression evaluates to. Nodes
+// proven to be an int or a float are evaluated without checking tags.
+enum NumType {
+    NUM_ANY,
+    NUM_INT,
+    NUM_FLOAT,
+};
+
+// The operands an operator node has seen while it was evaluated: none yet,
+// only two ints, only two floats, or anything else, which it keeps to once
+// it saw it (see eval_binop).
+enum Operands {
+    OPERANDS_UNSEEN,
+    OPERANDS_INTS,
+    OPERANDS_FLOATS,
+    OPERANDS_OTHER,
+};
+
+// Nodes live in one growable array of cells (see struct Ast) and refer to
+// their children by index. Index 0 is never a node and marks an absent child.
+typedef uint32_t NodeIdx_t;
+
+#define NO_NODE ((NodeIdx_t)0)
+
 struct AstNode {
     enum NodeType type;
     union {
@@ -39,112 +76,153 @@ struct AstNode {
         // AST_BINOP
         struct {
             enum TokenType binop_type;
-            struct AstNode* lhs;
-            struct AstNode* rhs;
+            NodeIdx_t lhs;
+            NodeIdx_t rhs;
+            bool binop_scalar;  // the last value was not a list (see evaler.c)
+            enum NumType binop_num;
+            enum Operands binop_seen;
         };
 
         // AST_UNOP
         struct {
             enum TokenType unop_type;
-            struct AstNode* node;
+            NodeIdx_t node;
+            bool unop_scalar;  // the last value was not a list (see evaler.c)
+            enum NumType unop_num;
         };
 
         // AST_IDENTIFIER
         struct {
             const char* name;
+            struct SlotRef ref;
+            enum NumType ref_num;  // of the variable where it is read
         };
 
         // AST_ASSIGNMENT
         struct {
-            struct AstNode* ident;
-            struct AstNode* rvalue;
+            NodeIdx_t ident;
+            NodeIdx_t rvalue;
+            enum TokenType assign_op;  // TOK_EQ, or the operator of +=, -=, *= and /=
+            enum NumType assign_num;   // of an update of a variable proven a number
         };
 
         // AST_PROGRAM / AST_BLOCK / AST_CASES
         struct {
-            size_t stmnt_count;
-            struct AstNode** stmnts;
+            uint32_t stmnt_count;
+            NodeIdx_t stmnts;  // list
         };
 
         // AST_ITEMS
         struct {
-            size_t item_count;
-            struct AstNode** items;
+            uint32_t item_count;
+            NodeIdx_t items;  // list
         };
 
-        // AST_FCALL / AST_FDEF
+        // AST_FCALL
         struct {
             const char* fname;
-            size_t param_count;
-            struct AstNode** params;
+            struct SlotRef fref;
+            uint32_t param_count;
+            NodeIdx_t params;  // list
+        };
 
-            // AST_FDEF
-            struct AstNode* fbody;
+        // AST_FDEF
+        struct {
+            NodeIdx_t fsig;  // AST_FCALL with the name and parameters
+            NodeIdx_t fbody;
+            struct Scope* fscope;
         };
 
         // AST_IDX
         struct {
             const char* lname;
-            struct AstNode* iexpr;
+            struct SlotRef lref;
+            NodeIdx_t iexpr;
         };
 
         // AST_FOR
         struct {
             const char* lvar;
-            struct AstNode* lexpr;
-            struct AstNode* lbody;
+            struct SlotRef vref;
+            NodeIdx_t lexpr;
+            NodeIdx_t lbody;
         };
 
         // AST_RANGE
         struct {
-            struct AstNode* rstart;
-            struct AstNode* rstop;
-            struct AstNode* rcount;
-            struct AstNode* rstep;
+            NodeIdx_t rstart;
+            NodeIdx_t rstop;
+            NodeIdx_t rcount;
+            NodeIdx_t rstep;
         };
 
         // AST_CMD
         struct {
             const char* cmd;
-            size_t carg_count;
-            struct AstNode** cargs;
+            uint32_t carg_count;
+            NodeIdx_t cargs;  // list
         };
 
         // AST_CASE
         struct {
-            struct AstNode* cexpr;
-            struct AstNode* pred;
+            NodeIdx_t cexpr;
+            NodeIdx_t pred;
         };
     };
 };
 
+_Static_assert(sizeof(struct AstNode) <= 32, "AST nodes should fit in half a cache line");
+
+// The arena holding the whole tree. Child lists are stored inline as runs of
+// cells packed with node indices. Cells only move while nodes are added, so
+// node pointers stay valid once the parser and the passes over the tree are
+// done; ast_free releases everything at once.
+struct Ast {
+    size_t size;
+    size_t capacity;
+    struct AstNode* cells;
+};
+
+extern struct Ast ast;
+extern size_t node_count;
+
+#define NODE(i) (ast.cells + (i))
+#define LIST(i) ((NodeIdx_t*)(ast.cells + (i)))
+#define CHILD(list, j) NODE(LIST(list)[(j)])
+
+NodeIdx_t node_new(enum NodeType type);
+NodeIdx_t list_new(size_t count, const NodeIdx_t* items);
+size_t ast_bytes();
+void ast_free();
+
 struct Parser {
+    const char* source;
     struct Token* tokens;
     struct Token* tok;
 };
 
-void draw_ast(struct AstNode* root);
-const char* ast_value_to_str(struct AstValue* value);
+void draw_ast(NodeIdx_t root);
+// The text print gives the value, in a new string that the caller frees.
+char* ast_value_to_str(struct AstValue* value);
 const char* node_type_to_str(enum NodeType node_type);
 const char* binop_type_to_str(enum TokenType binop_type);
 const char* unop_type_to_str(enum TokenType unop_type);
 const char* value_type_to_str(enum ValueType value_type);
 
-void parse(struct Parser* parser, struct AstNode* node);
-
-void parse_program(struct Parser* parser, struct AstNode* node);
-void parse_stmnt(struct Parser* parser, struct AstNode* node);
-void parse_expr(struct Parser* parser, struct AstNode* node);
-void parse_disj(struct Parser* parser, struct AstNode* node);
-void parse_conj(struct Parser* parser, struct AstNode* node);
-void parse_neg(struct Parser* parser, struct AstNode* node);
-void parse_comp(struct Parser* parser, struct AstNode* node);
-void parse_range(struct Parser* parser, struct AstNode* node);
-void parse_sum(struct Parser* parser, struct AstNode* node);
-void parse_term(struct Parser* parser, struct AstNode* node);
-void parse_factor(struct Parser* parser, struct AstNode* node);
-void parse_atom(struct Parser* parser, struct AstNode* node);
-void parse_items(struct Parser* parser, struct AstNode* node);
+NodeIdx_t parse(struct Parser* parser);
+
+NodeIdx_t parse_program(struct Parser* parser);
+NodeIdx_t parse_stmnt(struct Parser* parser);
+NodeIdx_t parse_expr(struct Parser* parser);
+NodeIdx_t parse_disj(struct Parser* parser);
+NodeIdx_t parse_conj(struct Parser* parser);
+NodeIdx_t parse_comp(struct Parser* parser);
+NodeIdx_t parse_range(struct Parser* parser);
+NodeIdx_t parse_sum(struct Parser* parser);
+NodeIdx_t parse_term(struct Parser* parser);
+NodeIdx_t parse_factor(struct Parser* parser);
+NodeIdx_t parse_atom(struct Parser* parser);
+NodeIdx_t parse_items(struct Parser* parser);
 
 #endif
 
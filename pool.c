@@ -0,0 +1,151 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "nc_error.h"
+
+// One job at a time: its tasks are handed out through an atomic counter,
+// and every worker takes part in every job, so the caller knows it is done
+// once all of them have checked back in.
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;  // a new job, or quit
+    pthread_cond_t idle;  // a worker finished its part of the job
+    pthread_t* workers;
+    size_t worker_count;
+    size_t generation;
+    size_t busy;
+    bool quit;
+
+    void (*task)(void* arg, size_t i);
+    void* arg;
+    size_t count;
+    atomic_size_t next;
+};
+
+struct Pool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+size_t thread_count = 0;
+
+// set while the thread runs tasks, which then run any job of their own
+// themselves instead of waiting on the pool they are part of
+_Thread_local bool in_job = false;
+
+void pool_work(void) {
+    in_job = true;
+    for (size_t i = atomic_fetch_add(&pool.next, 1); i < pool.count; i = atomic_fetch_add(&pool.next, 1)) {
+        pool.task(pool.arg, i);
+    }
+    in_job = false;
+}
+
+void* pool_worker(void* unused) {
+    (void)unused;
+    size_t seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen && !pool.quit) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        if (pool.quit) {
+            break;
+        }
+        seen = pool.generation;
+
+        pthread_mutex_unlock(&pool.lock);
+        pool_work();
+        pthread_mutex_lock(&pool.lock);
+
+        if (--pool.busy == 0) {
+            pthread_cond_signal(&pool.idle);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+void pool_stop(void) {
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (size_t i = 0; i < pool.worker_count; ++i) {
+        pthread_join(pool.workers[i], NULL);
+    }
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.worker_count = 0;
+    pool.quit = false;
+}
+
+void pool_start(size_t workers) {
+    pool.workers = malloc(workers * sizeof(pthread_t));
+    pool.generation = 0;
+    for (size_t i = 0; i < workers; ++i) {
+        if (pthread_create(&pool.workers[i], NULL, pool_worker, NULL) != 0) {
+            error("could not start worker thread\n");
+        }
+    }
+    pool.worker_count = workers;
+}
+
+void pool_set_threads(size_t threads) {
+    threads = threads > 0 ? threads : 1;
+    if (pool.worker_count > 0 && pool.worker_count != threads - 1) {
+        pool_stop();
+    }
+    thread_count = threads;
+}
+
+size_t pool_threads(void) {
+    if (thread_count > 0) {
+        return thread_count;
+    }
+
+    const char* env = getenv("NC_THREADS");
+    long n = env != NULL ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = n > 0 ? (size_t)n : 1;
+    return thread_count;
+}
+
+void pool_run(size_t count, void (*task)(void* arg, size_t i), void* arg) {
+    size_t threads = pool_threads();
+    if (threads == 1 || count == 1 || in_job) {
+        for (size_t i = 0; i < count; ++i) {
+            task(arg, i);
+        }
+        return;
+    }
+
+    if (pool.worker_count == 0) {
+        pool_start(threads - 1);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.task = task;
+    pool.arg = arg;
+    pool.count = count;
+    atomic_store(&pool.next, 0);
+    pool.busy = pool.worker_count;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    pool_work();
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy > 0) {
+        pthread_cond_wait(&pool.idle, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
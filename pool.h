@@ -0,0 +1,20 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Worker threads for data-parallel loops. The number of threads, counting
+// the caller of pool_run, is taken from the NC_THREADS environment variable
+// unless pool_set_threads chose one, and defaults to the number of CPUs.
+// The workers are started by the first pool_run that needs them.
+void pool_set_threads(size_t threads);
+size_t pool_threads(void);
+
+// Calls task(arg, i) for every i below count, spread over the workers and
+// the calling thread, and returns once every call has returned. Called
+// from inside a task, it makes every call on the calling thread.
+void pool_run(size_t count, void (*task)(void* arg, size_t i), void* arg);
+
+#endif
+
+// vim: ft=c
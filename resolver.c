@@ -0,0 +1,223 @@
+#include "resolver.h"
+#include <stdlib.h>
+
+typedef struct AstNode Node_t;
+typedef struct Scope Scope_t;
+
+Scope_t* scope_new(Scope_t* parent) {
+    Scope_t* scope = calloc(1, sizeof(Scope_t));
+    scope->parent = parent;
+    scope->index = map_new();
+    return scope;
+}
+
+int scope_find(Scope_t* scope, const char* sym) {
+    if (scope == NULL) {
+        return -1;
+    }
+
+    struct AstValue* slot = map_get(&scope->index, sym);
+    return slot != NULL ? (int)slot->int_value : -1;
+}
+
+void scope_declare(Scope_t* scope, const char* name) {
+    if (scope_find(scope, name) >= 0) {
+        return;
+    }
+
+    struct AstValue slot = NC_INT((long long)scope->slot_count);
+    *map_put(&scope->index, name) = slot;
+
+    if (scope->slot_count >= scope->slot_capacity) {
+        scope->slot_capacity = scope->slot_capacity ? 2 * scope->slot_capacity : 8;
+        scope->names = realloc(scope->names, scope->slot_capacity * sizeof(const char*));
+    }
+    scope->names[scope->slot_count++] = name;
+}
+
+struct SlotRef scope_lookup(Scope_t* scope, const char* name) {
+    int depth = 0;
+    for (Scope_t* s = scope; s != NULL; s = s->parent, ++depth) {
+        int slot = scope_find(s, name);
+        if (slot >= 0) {
+            struct SlotRef ref = {.depth = depth, .slot = slot};
+            return ref;
+        }
+    }
+
+    return UNRESOLVED;
+}
+
+// Assignments always bind in the innermost context, so every name assigned
+// anywhere in a scope (outside of nested function bodies) gets a slot there.
+void declare_bindings(Scope_t* scope, Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            break;
+        case AST_BINOP:
+            declare_bindings(scope, NODE(node->lhs));
+            declare_bindings(scope, NODE(node->rhs));
+            break;
+        case AST_UNOP:
+            declare_bindings(scope, NODE(node->node));
+            break;
+        case AST_ASSIGNMENT:
+            if (NODE(node->ident)->type == AST_IDENTIFIER) {
+                scope_declare(scope, NODE(node->ident)->name);
+            } else {
+                declare_bindings(scope, NODE(node->ident));
+            }
+            declare_bindings(scope, NODE(node->rvalue));
+            break;
+        case AST_PROGRAM:
+        case AST_BLOCK:
+        case AST_CASES:
+            for (size_t i = 0; i < node->stmnt_count; ++i) {
+                declare_bindings(scope, CHILD(node->stmnts, i));
+            }
+            break;
+        case AST_ITEMS:
+            for (size_t i = 0; i < node->item_count; ++i) {
+                declare_bindings(scope, CHILD(node->items, i));
+            }
+            break;
+        case AST_FCALL:
+            for (size_t i = 0; i < node->param_count; ++i) {
+                declare_bindings(scope, CHILD(node->params, i));
+            }
+            break;
+        case AST_FDEF:
+            scope_declare(scope, NODE(node->fsig)->fname);
+            break;
+        case AST_IDX:
+            declare_bindings(scope, NODE(node->iexpr));
+            break;
+        case AST_FOR:
+            scope_declare(scope, node->lvar);
+            declare_bindings(scope, NODE(node->lexpr));
+            declare_bindings(scope, NODE(node->lbody));
+            break;
+        case AST_RANGE:
+            declare_bindings(scope, NODE(node->rstart));
+            declare_bindings(scope, NODE(node->rstop));
+            if (node->rcount) {
+                declare_bindings(scope, NODE(node->rcount));
+            }
+            if (node->rstep) {
+                declare_bindings(scope, NODE(node->rstep));
+            }
+            break;
+        case AST_CMD:
+            for (size_t i = 0; i < node->carg_count; ++i) {
+                declare_bindings(scope, CHILD(node->cargs, i));
+            }
+            break;
+        case AST_CASE:
+            declare_bindings(scope, NODE(node->cexpr));
+            declare_bindings(scope, NODE(node->pred));
+            break;
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+}
+
+void resolve_node(Scope_t* scope, Node_t* node);
+
+void resolve_fdef(Scope_t* scope, Node_t* node) {
+    Node_t* sig = NODE(node->fsig);
+    sig->fref = scope_lookup(scope, sig->fname);
+
+    // the parser made sure the parameters are identifiers
+    Scope_t* inner = scope_new(scope);
+    for (size_t i = 0; i < sig->param_count; ++i) {
+        scope_declare(inner, CHILD(sig->params, i)->name);
+    }
+    declare_bindings(inner, NODE(node->fbody));
+
+    for (size_t i = 0; i < sig->param_count; ++i) {
+        resolve_node(inner, CHILD(sig->params, i));
+    }
+    resolve_node(inner, NODE(node->fbody));
+
+    node->fscope = inner;
+}
+
+void resolve_node(Scope_t* scope, Node_t* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            break;
+        case AST_IDENTIFIER:
+            node->ref = scope_lookup(scope, node->name);
+            break;
+        case AST_BINOP:
+            resolve_node(scope, NODE(node->lhs));
+            resolve_node(scope, NODE(node->rhs));
+            break;
+        case AST_UNOP:
+            resolve_node(scope, NODE(node->node));
+            break;
+        case AST_ASSIGNMENT:
+            resolve_node(scope, NODE(node->ident));
+            resolve_node(scope, NODE(node->rvalue));
+            break;
+        case AST_PROGRAM:
+        case AST_BLOCK:
+        case AST_CASES:
+            for (size_t i = 0; i < node->stmnt_count; ++i) {
+                resolve_node(scope, CHILD(node->stmnts, i));
+            }
+            break;
+        case AST_ITEMS:
+            for (size_t i = 0; i < node->item_count; ++i) {
+                resolve_node(scope, CHILD(node->items, i));
+            }
+            break;
+        case AST_FCALL:
+            node->fref = scope_lookup(scope, node->fname);
+            for (size_t i = 0; i < node->param_count; ++i) {
+                resolve_node(scope, CHILD(node->params, i));
+            }
+            break;
+        case AST_FDEF:
+            resolve_fdef(scope, node);
+            break;
+        case AST_IDX:
+            node->lref = scope_lookup(scope, node->lname);
+            resolve_node(scope, NODE(node->iexpr));
+            break;
+        case AST_FOR:
+            node->vref = scope_lookup(scope, node->lvar);
+            resolve_node(scope, NODE(node->lexpr));
+            resolve_node(scope, NODE(node->lbody));
+            break;
+        case AST_RANGE:
+            resolve_node(scope, NODE(node->rstart));
+            resolve_node(scope, NODE(node->rstop));
+            if (node->rcount) {
+                resolve_node(scope, NODE(node->rcount));
+            }
+            if (node->rstep) {
+                resolve_node(scope, NODE(node->rstep));
+            }
+            break;
+        case AST_CMD:
+            for (size_t i = 0; i < node->carg_count; ++i) {
+                resolve_node(scope, CHILD(node->cargs, i));
+            }
+            break;
+        case AST_CASE:
+            resolve_node(scope, NODE(node->cexpr));
+            resolve_node(scope, NODE(node->pred));
+            break;
+        default:
+            error("unknown AST node type: %s\n", node_type_to_str(node->type));
+    }
+}
+
+Scope_t* resolve(Node_t* root) {
+    Scope_t* globals = scope_new(NULL);
+    declare_bindings(globals, root);
+    resolve_node(globals, root);
+    return globals;
+}
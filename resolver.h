@@ -0,0 +1,26 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "map.h"
+#include "parser.h"
+
+// The names bound in the program or in a function body. Every context that
+// runs code of the scope holds one value slot per name; for functions the
+// parameters come first. Names are interned; index maps each to its slot.
+struct Scope {
+    struct Scope* parent;
+    size_t slot_count;
+    size_t slot_capacity;
+    const char** names;
+    struct Map index;
+};
+
+struct Scope* scope_new(struct Scope* parent);
+int scope_find(struct Scope* scope, const char* sym);
+void scope_declare(struct Scope* scope, const char* name);
+
+struct Scope* resolve(struct AstNode* root);
+
+#endif
+
+// vim: ft=c
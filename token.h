@@ -1,6 +1,7 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #define KEYWORDS \
@@ -16,7 +17,8 @@
     X(sum)       \
     X(prod)      \
     X(load)      \
-    X(dump)
+    X(dump)      \
+    X(memo)
 
 #define TOKEN_TYPES   \
     X(TOK_WS)         \
@@ -44,6 +46,10 @@
     X(TOK_LT)         \
     X(TOK_GT)         \
     X(TOK_EQ)         \
+    X(TOK_PLUSEQ)     \
+    X(TOK_MINUSEQ)    \
+    X(TOK_STAREQ)     \
+    X(TOK_FSLASHEQ)   \
     X(TOK_HASH)       \
     X(TOK_BANG)       \
     X(TOK_INTEGER)    \
@@ -71,9 +77,20 @@
 enum TokenType { TOKEN_TYPES };
 #undef X
 
+// Keywords and commands are looked up in a perfect hash table generated at
+// build time by tools/gen_keywords.c, which picks a seed for which no two of
+// them share an index.
+#define KW_TABLE_BITS 5
+#define KW_HASH_STEP(h, c) (((h) ^ (uint8_t)(c)) * 16777619u)
+#define KW_INDEX(h) (((h) ^ ((h) >> 16)) & ((1u << KW_TABLE_BITS) - 1))
+
+// Tokens refer to their text by position in the source; for strings the span
+// excludes the quotes. Identifiers and commands also carry the interned name.
 struct Token {
     enum TokenType type;
-    const char* value;
+    uint32_t offset;
+    uint32_t length;
+    const char* sym;
 };
 
 #endif
@@ -0,0 +1,220 @@
+// Times the packed-list kernels of array.c under every kernel set this CPU
+// supports and prints their throughput in elements per nanosecond, then the
+// largest error of the math kernels against libm in units in the last place.
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "array.h"
+#include "heap.h"
+
+#define ELEMS 4096
+#define ROUNDS 2000
+#define SAMPLES (1 << 20)
+
+struct Case {
+    const char* name;
+    enum ArrayOp op;
+    bool ints;
+    bool scalar;  // rhs is a number instead of a list
+};
+
+const struct Case cases[] = {
+    {"[f64] + [f64]", ARRAY_ADD, false, false}, {"[f64] * f64", ARRAY_MUL, false, true},
+    {"[f64] / [f64]", ARRAY_DIV, false, false}, {"[f64] < [f64]", ARRAY_LT, false, false},
+    {"[f64] % f64", ARRAY_MOD, false, true},    {"[i64] + [i64]", ARRAY_ADD, true, false},
+    {"[i64] * i64", ARRAY_MUL, true, true},     {"[i64] == [i64]", ARRAY_EEQ, true, false},
+};
+
+// arguments are drawn from [lo, hi], or from [2^lo, 2^hi] if exponential
+struct MathCase {
+    const char* name;
+    enum ArrayFunc f;
+    double lo;
+    double hi;
+    bool exponential;
+};
+
+const struct MathCase math_cases[] = {
+    {"sin", ARRAY_SIN, -100.0, 100.0, false},    {"cos", ARRAY_COS, -100.0, 100.0, false},
+    {"tan", ARRAY_TAN, -100.0, 100.0, false},    {"asin", ARRAY_ASIN, -1.0, 1.0, false},
+    {"acos", ARRAY_ACOS, -1.0, 1.0, false},      {"atan", ARRAY_ATAN, -1000.0, 1000.0, false},
+    {"exp", ARRAY_EXP, -745.0, 709.0, false},    {"log", ARRAY_LOG, -1074.0, 1023.0, true},
+    {"sqrt", ARRAY_SQRT, -1074.0, 1023.0, true},
+};
+
+const char* isa_names[] = {
+#define X(x) #x,
+    ARRAY_ISAS
+#undef X
+};
+
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+#define MATH_CASE_COUNT (sizeof(math_cases) / sizeof(math_cases[0]))
+#define ISA_COUNT (sizeof(isa_names) / sizeof(isa_names[0]))
+
+double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double elems_per_ns(const struct Case* c, struct AstValue lhs, struct AstValue rhs) {
+    struct AstValue result;
+    double start = now();
+    for (int i = 0; i < ROUNDS; ++i) {
+        array_binop(c->op, lhs, rhs, &result);
+        value_release(result);
+    }
+    return (double)ELEMS * ROUNDS / (now() - start);
+}
+
+double math_elems_per_ns(const struct MathCase* c, struct AstValue arg) {
+    struct AstValue result;
+    double start = now();
+    for (int i = 0; i < ROUNDS; ++i) {
+        array_func(c->f, arg, &result);
+        value_release(result);
+    }
+    return (double)arg.list_size * ROUNDS / (now() - start);
+}
+
+// distance between two doubles in representable values between them
+double ulps(double got, double want) {
+    if (isnan(got) && isnan(want)) {
+        return 0.0;
+    }
+    if (isnan(got) || isnan(want)) {
+        return INFINITY;
+    }
+
+    int64_t a;
+    int64_t b;
+    memcpy(&a, &got, sizeof(a));
+    memcpy(&b, &want, sizeof(b));
+    a = a < 0 ? INT64_MIN - a : a;
+    b = b < 0 ? INT64_MIN - b : b;
+    return a > b ? (double)(a - b) : (double)(b - a);
+}
+
+double max_ulps(const struct MathCase* c, struct AstValue arg, double (*libm)(double)) {
+    struct AstValue result;
+    array_func(c->f, arg, &result);
+
+    double worst = 0.0;
+    for (size_t i = 0; i < arg.list_size; ++i) {
+        worst = fmax(worst, ulps(result.float_array[i], libm(arg.float_array[i])));
+    }
+    value_release(result);
+    return worst;
+}
+
+void print_header(const char* title, bool libm) {
+    printf("%-16s", title);
+    if (libm) {
+        printf("%10s", "libm");
+    }
+    for (size_t j = 0; j < ISA_COUNT; ++j) {
+        printf("%10s", isa_names[j]);
+    }
+    printf("\n");
+}
+
+void bench_math(void) {
+    double (*const libm[ARRAY_FUNC_COUNT])(double) = {
+#define X(x, f) [x] = f,
+        ARRAY_FUNCS
+#undef X
+    };
+
+    double* samples = malloc(SAMPLES * sizeof(double));
+    double errors[MATH_CASE_COUNT][ISA_COUNT];
+
+    printf("\n");
+    print_header("elements/ns", true);
+    for (size_t i = 0; i < MATH_CASE_COUNT; ++i) {
+        const struct MathCase* c = &math_cases[i];
+        uint64_t state = 88172645463325252ull;
+        for (size_t k = 0; k < SAMPLES; ++k) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            double u = c->lo + (c->hi - c->lo) * (double)(state >> 11) * 0x1p-53;
+            samples[k] = c->exponential ? exp2(u) : u;
+        }
+        struct AstValue arg = {.type = V_FLOAT_ARRAY, .list_size = SAMPLES, .float_array = samples};
+        struct AstValue timed = arg;
+        timed.list_size = ELEMS;
+
+        printf("%-16s", c->name);
+        array_use_libm(true);
+        printf("%10.3f", math_elems_per_ns(c, timed));
+        array_use_libm(false);
+        for (size_t j = 0; j < ISA_COUNT; ++j) {
+            errors[i][j] = -1.0;
+            if (array_use_isa(isa_names[j])) {
+                printf("%10.3f", math_elems_per_ns(c, timed));
+                errors[i][j] = max_ulps(c, arg, libm[c->f]);
+            } else {
+                printf("%10s", "-");
+            }
+        }
+        printf("\n");
+    }
+
+    printf("\n");
+    print_header("max ulp vs libm", false);
+    for (size_t i = 0; i < MATH_CASE_COUNT; ++i) {
+        printf("%-16s", math_cases[i].name);
+        for (size_t j = 0; j < ISA_COUNT; ++j) {
+            if (errors[i][j] < 0.0) {
+                printf("%10s", "-");
+            } else {
+                printf("%10.0f", errors[i][j]);
+            }
+        }
+        printf("\n");
+    }
+
+    free(samples);
+}
+
+int main(void) {
+    long long* ints = malloc(ELEMS * sizeof(long long));
+    double* floats = malloc(ELEMS * sizeof(double));
+    for (size_t i = 0; i < ELEMS; ++i) {
+        ints[i] = (long long)i + 1;
+        floats[i] = (double)i + 0.5;
+    }
+
+    print_header("elements/ns", false);
+    for (size_t i = 0; i < CASE_COUNT; ++i) {
+        const struct Case* c = &cases[i];
+        struct AstValue lhs = c->ints ? (struct AstValue){.type = V_INT_ARRAY, .int_array = ints}
+                                      : (struct AstValue){.type = V_FLOAT_ARRAY, .float_array = floats};
+        lhs.list_size = ELEMS;
+        struct AstValue rhs = lhs;
+        if (c->scalar) {
+            rhs = c->ints ? (struct AstValue){.type = V_INT, .int_value = 3}
+                          : (struct AstValue){.type = V_FLOAT, .float_value = 1.5};
+        }
+
+        printf("%-16s", c->name);
+        for (size_t j = 0; j < ISA_COUNT; ++j) {
+            if (array_use_isa(isa_names[j])) {
+                printf("%10.3f", elems_per_ns(c, lhs, rhs));
+            } else {
+                printf("%10s", "-");
+            }
+        }
+        printf("\n");
+    }
+
+    free(ints);
+    free(floats);
+
+    bench_math();
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Times list operations over lists much larger than the caches with 1 to N
+// threads, N being the first argument or the number of CPUs, and prints
+// their throughput in elements per nanosecond. Every result is compared
+// with the one of a single thread, which it must match bit for bit.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "array.h"
+#include "heap.h"
+#include "pool.h"
+
+#define ELEMS (1 << 23)
+#define ROUNDS 10
+
+// x + 2 * sqrt(y) < x * y, as the evaluator would collect it
+#define FUSED_COUNT 8
+
+enum Kind { ADD, MUL, SIN, EXP, FUSED };
+
+const char* names[] = {"[f64] + [f64]", "[f64] * f64", "sin [f64]", "exp [f64]", "fused"};
+
+#define KIND_COUNT (sizeof(names) / sizeof(names[0]))
+
+struct AstValue x;
+struct AstValue y;
+
+double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct AstValue run(enum Kind kind) {
+    struct AstValue result = {0};
+    struct AstValue two = {.type = V_FLOAT, .float_value = 2.0};
+    struct FuseNode fused[FUSED_COUNT] = {
+        {.kind = FUSE_LEAF, .value = x},
+        {.kind = FUSE_LEAF, .value = two},
+        {.kind = FUSE_LEAF, .value = y},
+        {.kind = FUSE_FUNC, .func = ARRAY_SQRT, .lhs = 2},
+        {.kind = FUSE_BINOP, .op = ARRAY_MUL, .lhs = 1, .rhs = 3},
+        {.kind = FUSE_BINOP, .op = ARRAY_ADD, .lhs = 0, .rhs = 4},
+        {.kind = FUSE_BINOP, .op = ARRAY_MUL, .lhs = 0, .rhs = 2},
+        {.kind = FUSE_BINOP, .op = ARRAY_LT, .lhs = 5, .rhs = 6},
+    };
+
+    switch (kind) {
+        case ADD:
+            array_binop(ARRAY_ADD, x, y, &result);
+            break;
+        case MUL:
+            array_binop(ARRAY_MUL, x, two, &result);
+            break;
+        case SIN:
+            array_func(ARRAY_SIN, x, &result);
+            break;
+        case EXP:
+            array_func(ARRAY_EXP, y, &result);
+            break;
+        case FUSED:
+            array_fused(fused, FUSED_COUNT, &result);
+            break;
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+
+    x = (struct AstValue){.type = V_FLOAT_ARRAY, .list_size = ELEMS, .float_array = malloc(ELEMS * sizeof(double))};
+    y = (struct AstValue){.type = V_FLOAT_ARRAY, .list_size = ELEMS, .float_array = malloc(ELEMS * sizeof(double))};
+    for (size_t i = 0; i < ELEMS; ++i) {
+        x.float_array[i] = (double)i * 0.001 - 100.0;
+        y.float_array[i] = (double)(i % 1000) * 0.01;
+    }
+
+    struct AstValue serial[KIND_COUNT];
+    pool_set_threads(1);
+    for (size_t k = 0; k < KIND_COUNT; ++k) {
+        serial[k] = run(k);
+    }
+
+    printf("%-16s", "elements/ns");
+    for (size_t t = 1; t <= max_threads; ++t) {
+        printf("%8zu", t);
+    }
+    printf("\n");
+
+    bool same = true;
+    for (size_t k = 0; k < KIND_COUNT; ++k) {
+        printf("%-16s", names[k]);
+        for (size_t t = 1; t <= max_threads; ++t) {
+            pool_set_threads(t);
+            double start = now();
+            for (int r = 0; r < ROUNDS; ++r) {
+                struct AstValue result = run(k);
+                same = same && memcmp(result.float_array, serial[k].float_array, ELEMS * sizeof(double)) == 0;
+                value_release(result);
+            }
+            printf("%8.3f", (double)ELEMS * ROUNDS / (now() - start));
+        }
+        printf("\n");
+    }
+
+    printf("results %s the single thread's\n", same ? "match" : "DIFFER from");
+    pool_set_threads(1);
+    return same ? 0 : 1;
+}
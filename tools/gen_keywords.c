@@ -0,0 +1,72 @@
+// Writes keywords.h: a collision-free table for the KEYWORDS and COMMANDS
+// of token.h, indexed with KW_HASH_STEP/KW_INDEX and the seed found here.
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "token.h"
+
+struct Word {
+    const char* name;
+    const char* type;
+};
+
+const struct Word words[] = {
+#define X(x) {#x, "KW_" #x},
+    KEYWORDS
+#undef X
+#define X(x) {#x, "TOK_CMD"},
+    COMMANDS
+#undef X
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+#define TABLE_SIZE (1u << KW_TABLE_BITS)
+
+uint32_t word_index(uint32_t seed, const char* name) {
+    uint32_t h = seed;
+    for (const char* c = name; *c; ++c) {
+        h = KW_HASH_STEP(h, *c);
+    }
+    return KW_INDEX(h);
+}
+
+bool try_seed(uint32_t seed, int table[]) {
+    for (size_t i = 0; i < TABLE_SIZE; ++i) {
+        table[i] = -1;
+    }
+
+    for (size_t i = 0; i < WORD_COUNT; ++i) {
+        uint32_t idx = word_index(seed, words[i].name);
+        if (table[idx] >= 0) {
+            return false;
+        }
+        table[idx] = (int)i;
+    }
+
+    return true;
+}
+
+int main() {
+    int table[TABLE_SIZE];
+    uint32_t seed = 2166136261u;
+
+    for (uint32_t tries = 0; !try_seed(seed, table); ++tries, ++seed) {
+        if (tries > (1u << 24)) {
+            fprintf(stderr, "gen_keywords: no perfect seed found, increase KW_TABLE_BITS\n");
+            return 1;
+        }
+    }
+
+    printf("// generated by tools/gen_keywords.c, do not edit\n");
+    printf("#define KW_SEED %uu\n\n", seed);
+    printf("const struct Keyword keywords[%u] = {\n", TABLE_SIZE);
+    for (size_t i = 0; i < TABLE_SIZE; ++i) {
+        if (table[i] >= 0) {
+            const struct Word* w = words + table[i];
+            printf("    [%zu] = {\"%s\", %zu, %s},\n", i, w->name, strlen(w->name), w->type);
+        }
+    }
+    printf("};\n");
+
+    return 0;
+}
@@ -14,7 +14,7 @@ void sb_append(StringBuilder* sb, const char* str) {
 
     if (cap != sb->capacity) {
         sb->capacity = cap;
-        sb->data = realloc(sb->data, sb->capacity);
+        sb->data = realloc(sb->data, sb->capacity * sizeof(const char*));
     }
 
     sb->data[sb->size++] = str;
@@ -74,3 +74,18 @@ void ptrarr_append(PtrArr* a, void* data) {
 
     a->data[a->size++] = data;
 }
+
+// FNV-1a
+size_t hash_str_n(const char* str, size_t len) {
+    size_t hash = 14695981039346656037ULL;
+    const unsigned char* p = (const unsigned char*)str;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+size_t hash_str(const char* str) {
+    return hash_str_n(str, strlen(str));
+}
@@ -35,6 +35,9 @@ typedef struct {
 
 void ptrarr_append(PtrArr* array, void* data);
 
+size_t hash_str(const char* str);
+size_t hash_str_n(const char* str, size_t len);
+
 #define UNDEF_SIZE (size_t)(-1)
 
 #endif
@@ -0,0 +1,602 @@
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "heap.h"
+#include "memo.h"
+#include "utils.h"
+
+typedef struct Context Context_t;
+typedef struct Chunk Chunk_t;
+typedef struct Instr Instr_t;
+typedef struct EvalFunc EvalFunc_t;
+typedef struct RangeValue Range_t;
+
+#if defined(__GNUC__)
+#define VM_THREADED
+#endif
+
+enum ForMode {
+    FOR_SINGLE,
+    FOR_LIST,
+    FOR_INT_RANGE,
+    FOR_FLOAT_RANGE,
+};
+
+// A call of a scripted function: its context and where the caller resumes.
+struct VmFrame {
+    Context_t context;
+    Chunk_t* chunk;
+    Context_t* caller;
+    Value_t* regs;
+    Instr_t* ip;
+    size_t mark;
+    size_t kept;
+    size_t stores;      // outer_stores at the call
+    struct Memo* memo;  // where the result goes, if the call missed in it
+    struct MemoTicket ticket;
+};
+
+// Scripted functions run in the loop of vm_exec instead of nesting on the C
+// stack, so recursion only runs out of these frames or of the frame stack.
+// The frames never move, as contexts of functions defined in a call point
+// into them.
+#define VM_MAX_FRAMES (1 << 16)
+
+struct VmFrame* vm_frames = NULL;
+size_t vm_depth = 0;
+
+// Loads every promoted variable into its home register. Each register holds
+// a pin on its list, or the temporary that made it, so that a list one
+// register alone refers to can be written in place; a register that already
+// holds the list keeps the pin it has.
+void vm_reload(Chunk_t* chunk, Value_t* regs, Context_t* context) {
+    for (size_t i = 0; i < chunk->var_count; ++i) {
+        struct Var* var = chunk->vars + i;
+        Value_t value = get_ref(context, var->ref, var->name);
+        if (value_block(value) != value_block(regs[i])) {
+            value_pin(&value);
+        }
+        regs[i] = value;
+    }
+}
+
+// Whether the list in the home register of variable i may be written in
+// place: the register and the variable's slot are all that refer to it.
+static inline bool vm_owned(Chunk_t* chunk, Value_t* regs, Context_t* context, size_t i) {
+    struct Var* var = chunk->vars + i;
+    return list_owned(regs[i], ref_home(context, var->ref, var->name), 1);
+}
+
+// Applies an arithmetic instruction in place where it writes the list it
+// reads from the home register of a variable, as x += y does.
+static inline bool vm_update(Chunk_t* chunk, Value_t* regs, Context_t* context, const Instr_t* ip,
+                             Value_t (*func)(Value_t, Value_t), Value_t rhs) {
+    return ip->a == ip->b && ip->a < chunk->var_count && is_array(regs[ip->a]) &&
+           vm_owned(chunk, regs, context, ip->a) && list_update(regs[ip->a], func, rhs);
+}
+
+// Writes the promoted variables the chunk assigns back to the context.
+void vm_flush(Chunk_t* chunk, Value_t* regs, Context_t* context) {
+    for (size_t i = 0; i < chunk->var_count; ++i) {
+        struct Var* var = chunk->vars + i;
+        if (var->assigned) {
+            set_ref(context, var->ref, var->name, regs[i]);
+        }
+    }
+}
+
+static inline EvalFunc_t* vm_callable(Context_t* context, struct SlotRef ref, const char* fname) {
+    Value_t callable = get_ref(context, ref, fname);
+    if (callable.type != V_CALLABLE) {
+        eval_error("could not find function: %s\n", fname);
+    }
+    return callable.data;
+}
+
+static inline Value_t vm_builtin(EvalFunc_t* f, size_t nargs, Value_t* args) {
+    size_t mark = temps_mark();
+    Value_t result = f->func(nargs, args);
+    // a builtin may hand back one of its arguments
+    if (temps_mark() == mark) {
+        value_pin(&result);
+        return result;
+    }
+    return temps_keep(mark, result);
+}
+
+// Sets up the callee's context, with the arguments the caller has in its
+// registers.
+static inline void vm_context(Context_t* context, EvalFunc_t* f, const char* fname, size_t nargs, Value_t* args) {
+    if (nargs != f->param_count) {
+        eval_error("%s: expected %zu arguments but got: %zu\n", fname, f->param_count, nargs);
+    }
+    for (size_t i = 0; i < nargs; ++i) {
+        value_retain(args[i]);
+    }
+    context_push(context, f->context, f->scope, nargs, args);
+}
+
+static inline Chunk_t* vm_chunk(EvalFunc_t* f) {
+    if (f->chunk == NULL) {
+        f->chunk = compile(f->body, true);
+    }
+    return f->chunk;
+}
+
+static inline void vm_forprep(Value_t* it, uint16_t elem) {
+    enum ForMode mode = FOR_SINGLE;
+    long long counter = 0;
+
+    if (is_list(*it)) {
+        mode = FOR_LIST;
+    } else if (it->type == V_RANGE) {
+        mode = it->range_value->start.type == V_INT ? FOR_INT_RANGE : FOR_FLOAT_RANGE;
+    }
+
+    it[1].type = V_INT;
+    it[1].int_value = mode;
+    it[2].type = V_INT;
+    it[2].int_value = counter;
+    it[3].type = V_INT;
+    it[3].int_value = elem;
+}
+
+// Advances the loop state starting at it, returns false once exhausted.
+static inline bool vm_fornext(Value_t* regs, Value_t* it) {
+    long long* counter = &it[2].int_value;
+    Value_t* elem = regs + it[3].int_value;
+
+    switch (it[1].int_value) {
+        case FOR_INT_RANGE: {
+            const Range_t* range = it->range_value;
+            if ((size_t)*counter >= range->length) {
+                return false;
+            }
+            elem->type = V_INT;
+            elem->int_value = range->start.int_value + *counter * range->step.int_value;
+            ++*counter;
+        } break;
+        case FOR_FLOAT_RANGE: {
+            const Range_t* range = it->range_value;
+            if ((size_t)*counter >= range->length) {
+                return false;
+            }
+            *elem = range_get(range, (*counter)++);
+        } break;
+        case FOR_LIST: {
+            if ((size_t)*counter >= it->list_size) {
+                return false;
+            }
+            *elem = list_get(*it, (*counter)++);
+            value_pin(elem);
+        } break;
+        case FOR_SINGLE: {
+            if (*counter > 0) {
+                return false;
+            }
+            *elem = it[0];
+            *counter = 1;
+        } break;
+        default:
+            unreachable_code();
+    }
+
+    return true;
+}
+
+#define R(x) regs[(x)]
+#define RK(x) (((x) & RK_CONST) ? &consts[(x) & RK_MAX] : &regs[(x)])
+
+#ifdef VM_THREADED
+#define CASE(x) L_##x:
+#define DISPATCH() goto* labels[ip->op]
+#else
+#define CASE(x) case x:
+#define DISPATCH() goto dispatch
+#endif
+
+#define NEXT() \
+    ++ip;      \
+    DISPATCH()
+
+#define JUMP()                          \
+    ip = code + INSTR_TARGET(*ip); \
+    DISPATCH()
+
+// Results are stored field by field: copying a whole Value_t through a
+// temporary makes the next instruction's narrower loads miss store forwarding.
+#define SET_INT(dst, x)         \
+    do {                        \
+        long long tmp_ = (x);   \
+        (dst).type = V_INT;     \
+        (dst).int_value = tmp_; \
+    } while (0)
+
+#define SET_FLOAT(dst, x)         \
+    do {                          \
+        double tmp_ = (x);        \
+        (dst).type = V_FLOAT;     \
+        (dst).float_value = tmp_; \
+    } while (0)
+
+#define ARITH(op, func)                                                      \
+    {                                                                        \
+        Value_t* lhs = RK(ip->b);                                            \
+        Value_t* rhs = RK(ip->c);                                            \
+        if (lhs->type == V_INT && rhs->type == V_INT) {                      \
+            SET_INT(R(ip->a), lhs->int_value op rhs->int_value);             \
+        } else if (lhs->type == V_FLOAT && rhs->type == V_FLOAT) {           \
+            SET_FLOAT(R(ip->a), lhs->float_value op rhs->float_value);       \
+        } else if (lhs->type == V_FLOAT && rhs->type == V_INT) {             \
+            SET_FLOAT(R(ip->a), lhs->float_value op rhs->int_value);         \
+        } else if (lhs->type == V_INT && rhs->type == V_FLOAT) {             \
+            SET_FLOAT(R(ip->a), lhs->int_value op rhs->float_value);         \
+        } else if (!vm_update(chunk, regs, context, ip, func, *rhs)) {        \
+            R(ip->a) = broadcast_func2(func, *lhs, *rhs);                    \
+        }                                                                    \
+        NEXT();                                                              \
+    }
+
+#define COMPARE(op, func)                                                       \
+    {                                                                           \
+        Value_t* lhs = RK(ip->b);                                               \
+        Value_t* rhs = RK(ip->c);                                               \
+        if (lhs->type == V_INT && rhs->type == V_INT) {                         \
+            SET_INT(R(ip->a), lhs->int_value op rhs->int_value);                \
+        } else if (lhs->type == V_FLOAT && rhs->type == V_FLOAT) {              \
+            SET_INT(R(ip->a), lhs->float_value op rhs->float_value);            \
+        } else {                                                                \
+            R(ip->a) = broadcast_func2(func, *lhs, *rhs);                       \
+        }                                                                       \
+        NEXT();                                                                 \
+    }
+
+#define GENERIC2(func)                                          \
+    {                                                           \
+        R(ip->a) = broadcast_func2(func, *RK(ip->b), *RK(ip->c)); \
+        NEXT();                                                 \
+    }
+
+#define is_nonempty_list(v) (is_list(v) && (v).list_size > 0)
+
+Value_t vm_exec(Chunk_t* chunk, Context_t* context) {
+    size_t depth = vm_depth;
+    EvalFunc_t* f;
+    Value_t* regs;
+    size_t mark;
+    size_t kept;
+    Instr_t* code;
+    Value_t* consts;
+    const char** names;
+    struct SlotRef* refs;
+    Instr_t* ip;
+
+#ifdef VM_THREADED
+    static void* labels[] = {
+#define X(x) &&L_##x,
+        OPCODES
+#undef X
+    };
+#endif
+
+enter:
+    regs = frame_alloc(chunk->reg_count);
+    // Temporaries are drained as loops go round, keeping those that a
+    // register still holds, so registers must not hold stale values.
+    mark = temps_mark();
+    kept = mark;
+    for (size_t i = 0; i < chunk->reg_count; ++i) {
+        regs[i].type = V_NIL;
+    }
+
+    code = chunk->code;
+    consts = chunk->consts;
+    names = chunk->names;
+    refs = chunk->refs;
+    ip = code;
+
+    vm_reload(chunk, regs, context);
+
+#ifdef VM_THREADED
+    DISPATCH();
+#else
+dispatch:
+    switch (ip->op) {
+#endif
+
+    CASE(OP_NOP) {
+        NEXT();
+    }
+
+    CASE(OP_LOADK) {
+        R(ip->a) = consts[ip->b];
+        NEXT();
+    }
+
+    CASE(OP_LOADNIL) {
+        R(ip->a) = NIL;
+        NEXT();
+    }
+
+    CASE(OP_MOVE) {
+        R(ip->a) = *RK(ip->b);
+        value_pin(&R(ip->a));
+        NEXT();
+    }
+
+    CASE(OP_GETVAR) {
+        R(ip->a) = get_ref(context, refs[ip->b], names[ip->b]);
+        value_pin(&R(ip->a));
+        NEXT();
+    }
+
+    CASE(OP_SETVAR) {
+        set_ref(context, refs[ip->b], names[ip->b], R(ip->a));
+        NEXT();
+    }
+
+    CASE(OP_CHECKVAR) {
+        if (R(ip->a).type == V_NIL) {
+            eval_error("did not find name in current context: %s\n", chunk->vars[ip->a].name);
+        }
+        NEXT();
+    }
+
+    CASE(OP_ADD) ARITH(+, op_plus)
+    CASE(OP_SUB) ARITH(-, op_minus)
+    CASE(OP_MUL) ARITH(*, op_times)
+
+    CASE(OP_DIV) ARITH(/, op_divide)
+    CASE(OP_POW) GENERIC2(op_power)
+
+    CASE(OP_MOD) {
+        Value_t* lhs = RK(ip->b);
+        Value_t* rhs = RK(ip->c);
+        if (lhs->type == V_INT && rhs->type == V_INT) {
+            SET_INT(R(ip->a), lhs->int_value % rhs->int_value);
+        } else {
+            R(ip->a) = broadcast_func2(op_mod, *lhs, *rhs);
+        }
+        NEXT();
+    }
+
+    CASE(OP_LT) COMPARE(<, op_lt)
+    CASE(OP_GT) COMPARE(>, op_gt)
+    CASE(OP_LEQ) COMPARE(<=, op_leq)
+    CASE(OP_GEQ) COMPARE(>=, op_geq)
+    CASE(OP_EEQ) COMPARE(==, op_eeq)
+    CASE(OP_NEQ) COMPARE(!=, op_neq)
+
+    CASE(OP_TESTOR) {
+        Value_t lhs = R(ip->a);
+        if (!is_nonempty_list(lhs) && is_truthy(lhs)) {
+            R(ip->a) = TRUE;
+            JUMP();
+        }
+        NEXT();
+    }
+
+    CASE(OP_TESTAND) {
+        Value_t lhs = R(ip->a);
+        if (!is_nonempty_list(lhs) && !is_truthy(lhs)) {
+            R(ip->a) = FALSE;
+            JUMP();
+        }
+        NEXT();
+    }
+
+    CASE(OP_OR) {
+        Value_t lhs = *RK(ip->b);
+        Value_t rhs = *RK(ip->c);
+        if (is_nonempty_list(lhs) || is_nonempty_list(rhs)) {
+            R(ip->a) = broadcast_func2(op_or, lhs, rhs);
+        } else {
+            R(ip->a) = is_truthy(rhs) ? TRUE : FALSE;
+        }
+        NEXT();
+    }
+
+    CASE(OP_AND) {
+        Value_t lhs = *RK(ip->b);
+        Value_t rhs = *RK(ip->c);
+        if (is_nonempty_list(lhs) || is_nonempty_list(rhs)) {
+            R(ip->a) = broadcast_func2(op_and, lhs, rhs);
+        } else {
+            R(ip->a) = is_truthy(rhs) ? TRUE : FALSE;
+        }
+        NEXT();
+    }
+
+    CASE(OP_NEG) {
+        Value_t* src = RK(ip->b);
+        if (src->type == V_INT) {
+            SET_INT(R(ip->a), -src->int_value);
+        } else if (src->type == V_FLOAT) {
+            SET_FLOAT(R(ip->a), -src->float_value);
+        } else {
+            R(ip->a) = broadcast_func1(op_unary_minus, *src);
+        }
+        NEXT();
+    }
+
+    CASE(OP_NOT) {
+        R(ip->a) = broadcast_func1(op_unary_not, *RK(ip->b));
+        NEXT();
+    }
+
+    CASE(OP_LEN) {
+        R(ip->a) = op_length(*RK(ip->b));
+        NEXT();
+    }
+
+    CASE(OP_GETIDX) {
+        R(ip->a) = index_value(R(ip->b), *RK(ip->c), chunk->vars[ip->b].name);
+        NEXT();
+    }
+
+    CASE(OP_SETIDX) {
+        if (R(ip->a).type == V_NIL) {
+            eval_error("did not find name in current context: %s\n", chunk->vars[ip->a].name);
+        }
+        list_assign(&R(ip->a), *RK(ip->b), *RK(ip->c), vm_owned(chunk, regs, context, ip->a));
+        NEXT();
+    }
+
+    CASE(OP_NEWLIST) {
+        struct ListBuilder builder = list_builder(ip->c);
+        for (uint16_t i = 0; i < ip->c; ++i) {
+            list_push(&builder, R(ip->b + i));
+        }
+        R(ip->a) = list_build(&builder);
+        NEXT();
+    }
+
+    CASE(OP_CALL) {
+        f = vm_callable(context, refs[ip->b], names[ip->b]);
+    call:
+        if (f->func != NULL) {
+            R(ip->a) = vm_builtin(f, ip->c, &R(ip->a));
+            NEXT();
+        }
+        struct Memo* memo = ip->c == f->param_count ? func_memo(f) : NULL;
+        struct MemoTicket ticket = {.index = SIZE_MAX};
+        if (memo != NULL && memo_lookup(memo, &R(ip->a), &R(ip->a), &ticket)) {
+            NEXT();
+        }
+        if (vm_depth == VM_MAX_FRAMES) {
+            eval_error("stack overflow\n");
+        }
+
+        // the callee may read our variables through its parent context
+        vm_flush(chunk, regs, context);
+
+        struct VmFrame* frame = vm_frames + vm_depth++;
+        vm_context(&frame->context, f, names[ip->b], ip->c, &R(ip->a));
+        frame->chunk = chunk;
+        frame->caller = context;
+        frame->regs = regs;
+        frame->ip = ip;
+        frame->mark = mark;
+        frame->kept = kept;
+        frame->stores = outer_stores;
+        frame->memo = memo;
+        frame->ticket = ticket;
+
+        chunk = vm_chunk(f);
+        context = &frame->context;
+        goto enter;
+    }
+
+    // A call whose value the chunk returns takes over the frame of the
+    // chunk, so that recursion through tail calls runs in constant space.
+    CASE(OP_TAILCALL) {
+        f = vm_callable(context, refs[ip->b], names[ip->b]);
+        if (f->func != NULL || vm_depth == depth || !frame_replaceable(context, f, ip->c, &R(ip->a))) {
+            goto call;
+        }
+
+        vm_flush(chunk, regs, context);
+
+        // the temporaries keep the arguments while the slots under them are
+        // popped, and once the arguments have moved down into new slots
+        context_pop(context);
+        vm_context(context, f, names[ip->b], ip->c, &R(ip->a));
+        temps_drain(mark);
+
+        chunk = vm_chunk(f);
+        goto enter;
+    }
+
+    CASE(OP_JMP) {
+        JUMP();
+    }
+
+    CASE(OP_JMPF) {
+        if (!is_truthy(R(ip->a))) {
+            JUMP();
+        }
+        NEXT();
+    }
+
+    CASE(OP_JMPNN) {
+        if (R(ip->a).type != V_NIL) {
+            JUMP();
+        }
+        NEXT();
+    }
+
+    CASE(OP_FORPREP) {
+        vm_forprep(&R(ip->a), ip->b);
+        NEXT();
+    }
+
+    CASE(OP_FORLOOP) {
+        if (vm_fornext(regs, &R(ip->a))) {
+            if (temps_mark() > kept) {
+                temps_keep_all(mark, regs, chunk->reg_count);
+                kept = temps_mark();
+            }
+            JUMP();
+        }
+        NEXT();
+    }
+
+    CASE(OP_EVAL) {
+        vm_flush(chunk, regs, context);
+        Value_t result = eval(chunk->nodes[INSTR_TARGET(*ip)], context);
+        vm_reload(chunk, regs, context);
+        R(ip->a) = result;
+        NEXT();
+    }
+
+    CASE(OP_RET) {
+        // an element written in a list of an enclosing scope lives there
+        vm_flush(chunk, regs, context);
+        Value_t result = temps_keep(mark, R(ip->a));
+        if (vm_depth == depth) {
+            frame_free(regs);
+            return result;
+        }
+
+        // popping the slots pops the registers above them
+        frame_result(context, result);
+        context_pop(context);
+        struct VmFrame* frame = vm_frames + --vm_depth;
+        chunk = frame->chunk;
+        context = frame->caller;
+        regs = frame->regs;
+        ip = frame->ip;
+        mark = frame->mark;
+        kept = frame->kept;
+        if (frame->memo != NULL) {
+            memo_store(frame->memo, frame->ticket, result);
+        }
+        code = chunk->code;
+        consts = chunk->consts;
+        names = chunk->names;
+        refs = chunk->refs;
+
+        // the callee may have stored a copy into one of our variables by
+        // writing an element
+        if (outer_stores != frame->stores) {
+            vm_reload(chunk, regs, context);
+        }
+        R(ip->a) = result;
+        NEXT();
+    }
+
+#ifndef VM_THREADED
+    default:
+        error("unknown opcode: %s\n", opcode_to_str(ip->op));
+    }
+#endif
+}
+
+Value_t vm_run(Chunk_t* chunk, Context_t* context) {
+    if (vm_frames == NULL) {
+        vm_frames = malloc(VM_MAX_FRAMES * sizeof(struct VmFrame));
+    }
+
+    return vm_exec(chunk, context);
+}
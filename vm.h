@@ -0,0 +1,11 @@
+#ifndef VM_H
+#define VM_H
+
+#include "compiler.h"
+#include "evaler.h"
+
+struct AstValue vm_run(struct Chunk* chunk, struct Context* context);
+
+#endif
+
+// vim: ft=c
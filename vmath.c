@@ -0,0 +1,267 @@
+// lets the selects below compute both sides, which is what makes the loops
+// vectorize; nc never looks at floating point exception flags
+#pragma GCC optimize("no-trapping-math")
+
+#include "vmath.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Everything below stays in double or in unsigned bit patterns, and selects
+// by bit masks: SSE2 and AVX2 cannot convert or compare 64-bit integers in
+// vector registers, and a loop that does so is not vectorized at all.
+
+#define SHIFT 0x1.8p52  // adding it rounds to an integer, found in the low bits
+
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define LOG2E 1.44269504088896338700e+00
+#define SQRT2 1.41421356237309514547e+00
+
+#define TWO_OVER_PI 6.36619772367581382433e-01
+#define PIO2_1 1.57079632673412561417e+00
+#define PIO2_2 6.07710050630396597660e-11
+#define PIO2_3 2.02226624871116645580e-21
+#define TRIG_LIMIT 0x1p20
+
+#define PIO4_HI 7.85398163397448278999e-01
+#define PIO4_LO 3.06161699786838301793e-17
+#define PIO2_HI 1.57079632679489655800e+00
+#define PIO2_LO 6.12323399573676603587e-17
+#define TAN_PI8 4.14213562373095034e-01
+#define TAN_3PI8 2.41421356237309492343e+00
+
+static inline uint64_t bits(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+static inline double from_bits(uint64_t u) {
+    double x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+// all ones if the lowest bit of n is set
+static inline uint64_t odd_mask(uint64_t n) {
+    return -(n & 1);
+}
+
+static inline double select(uint64_t mask, double a, double b) {
+    return from_bits((bits(a) & mask) | (bits(b) & ~mask));
+}
+
+// 2^k for an integer valued k in [-1022, 1023]
+static inline double pow2(double k) {
+    return from_bits((bits(k + SHIFT) - bits(SHIFT) + 1023) << 52);
+}
+
+// e^x = 2^k e^r with |r| <= ln2/2, and e^r from its Taylor series to r^13.
+// 2^k is applied in two halves so that subnormal results come out right.
+static inline double vm_exp(double x) {
+    double xc = x > 710.0 ? 710.0 : x < -746.0 ? -746.0 : x;
+    double k = xc * LOG2E + SHIFT - SHIFT;
+    double r = xc - k * LN2_HI - k * LN2_LO;
+
+    double p = 1.0 / 6227020800.0;
+    p = p * r + 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+
+    double k1 = k * 0.5 + SHIFT - SHIFT;
+    return p * pow2(k1) * pow2(k - k1);
+}
+
+// log x = k ln2 + log(1 + f) with 1 + f in [sqrt(2)/2, sqrt(2)), and
+// log(1 + f) = 2 atanh(s), s = f / (2 + f), arranged as in fdlibm.
+static inline double vm_log(double x) {
+    double scaled = x * 0x1p52;
+    double sub = x < 0x1p-1022 ? 52.0 : 0.0;
+    uint64_t u = bits(x < 0x1p-1022 ? scaled : x);
+
+    double k = from_bits(bits(SHIFT) | (u >> 52)) - SHIFT - 1023.0 - sub;
+    double m = from_bits((u & 0x000fffffffffffff) | 0x3ff0000000000000);
+    double half = m * 0.5;
+    k = m > SQRT2 ? k + 1.0 : k;
+    m = m > SQRT2 ? half : m;
+
+    double f = m - 1.0;
+    double s = f / (2.0 + f);
+    double z = s * s;
+    double R = 2.0 / 21.0;
+    R = R * z + 2.0 / 19.0;
+    R = R * z + 2.0 / 17.0;
+    R = R * z + 2.0 / 15.0;
+    R = R * z + 2.0 / 13.0;
+    R = R * z + 2.0 / 11.0;
+    R = R * z + 2.0 / 9.0;
+    R = R * z + 2.0 / 7.0;
+    R = R * z + 2.0 / 5.0;
+    R = R * z + 2.0 / 3.0;
+    R = R * z;
+    double hfsq = 0.5 * f * f;
+    double result = k * LN2_HI - ((hfsq - (s * (hfsq + R) + k * LN2_LO)) - f);
+
+    return x > 0.0 && x < INFINITY ? result : x == 0.0 ? -INFINITY : x < 0.0 ? -NAN : x;
+}
+
+// x = n pi/2 + r with |r| <= pi/4, three parts of pi/2 keeping r exact
+// enough for |n| < 2^20
+static inline double reduce(double x, uint64_t* n) {
+    double kd = x * TWO_OVER_PI + SHIFT;
+    *n = bits(kd);
+    kd -= SHIFT;
+    return ((x - kd * PIO2_1) - kd * PIO2_2) - kd * PIO2_3;
+}
+
+// fdlibm's __kernel_sin and __kernel_cos, for |r| <= pi/4
+static inline double sin_poly(double r) {
+    double z = r * r;
+    double p = 1.58969099521155010221e-10;
+    p = p * z - 2.50507602534068634195e-08;
+    p = p * z + 2.75573137070700676789e-06;
+    p = p * z - 1.98412698298579493134e-04;
+    p = p * z + 8.33333333332248946124e-03;
+    p = p * z - 1.66666666666666324348e-01;
+    return r + r * z * p;
+}
+
+static inline double cos_poly(double r) {
+    double z = r * r;
+    double p = -1.13596475577881948265e-11;
+    p = p * z + 2.08757232129817482790e-09;
+    p = p * z - 2.75573143513906633035e-07;
+    p = p * z + 2.48015872894767294178e-05;
+    p = p * z - 1.38888888888741095749e-03;
+    p = p * z + 4.16666666666666019037e-02;
+    double hz = 0.5 * z;
+    double w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + z * z * p);
+}
+
+// quadrant n: sin, cos, -sin, -cos
+static inline double vm_sin(double x) {
+    uint64_t n;
+    double r = reduce(x, &n);
+    double v = select(odd_mask(n), cos_poly(r), sin_poly(r));
+    return from_bits(bits(v) ^ ((n & 2) << 62));
+}
+
+static inline double vm_cos(double x) {
+    uint64_t n;
+    double r = reduce(x, &n);
+    n += 1;
+    double v = select(odd_mask(n), cos_poly(r), sin_poly(r));
+    return from_bits(bits(v) ^ ((n & 2) << 62));
+}
+
+// tan is sin/cos in even quadrants and -cos/sin in odd ones
+static inline double vm_tan(double x) {
+    uint64_t n;
+    double r = reduce(x, &n);
+    double s = sin_poly(r);
+    double c = cos_poly(r);
+    uint64_t odd = odd_mask(n);
+    double v = select(odd, c, s) / select(odd, s, c);
+    return from_bits(bits(v) ^ ((n & 1) << 63));
+}
+
+// atan |x| = base + atan t, with t = |x|, (|x| - 1) / (|x| + 1) or -1/|x|
+// so that |t| <= tan(pi/8), and atan t from fdlibm's polynomial
+static inline double vm_atan(double x) {
+    double a = fabs(x);
+    double inv = -1.0 / a;
+    double shifted = (a - 1.0) / (a + 1.0);
+    double t = a > TAN_3PI8 ? inv : a > TAN_PI8 ? shifted : a;
+    double hi = a > TAN_3PI8 ? PIO2_HI : a > TAN_PI8 ? PIO4_HI : 0.0;
+    double lo = a > TAN_3PI8 ? PIO2_LO : a > TAN_PI8 ? PIO4_LO : 0.0;
+
+    double z = t * t;
+    double p = 1.62858201153657823623e-02;
+    p = p * z - 3.65315727442169155270e-02;
+    p = p * z + 4.97687799461593236017e-02;
+    p = p * z - 5.83357013379057348645e-02;
+    p = p * z + 6.66107313738753120669e-02;
+    p = p * z - 7.69187620504482999495e-02;
+    p = p * z + 9.09088713343650656196e-02;
+    p = p * z - 1.11111104054623557880e-01;
+    p = p * z + 1.42857142725034663711e-01;
+    p = p * z - 1.99999999998764832476e-01;
+    p = p * z + 3.33333333333329318027e-01;
+    p = p * z;
+
+    return copysign(hi - ((t * p - lo) - t), x);
+}
+
+// asin x = atan(x / sqrt(1 - x^2)), which reaches +-pi/2 through +-inf.
+// The NaNs are those of libm: negative for log, positive here.
+static inline double vm_asin(double x) {
+    double r = vm_atan(x / sqrt((1.0 - x) * (1.0 + x)));
+    return fabs(x) > 1.0 ? NAN : r;
+}
+
+// acos x = 2 atan(sqrt((1 - x) / (1 + x))), which reaches pi through inf
+static inline double vm_acos(double x) {
+    double r = 2.0 * vm_atan(sqrt((1.0 - x) / (1.0 + x)));
+    return fabs(x) > 1.0 ? NAN : r;
+}
+
+static inline double vm_sqrt(double x) {
+    return sqrt(x);
+}
+
+static inline bool needs_libm_sin(double x) {
+    return !(fabs(x) < TRIG_LIMIT) && x == x;
+}
+
+// One loop per function and kernel set. Beyond TRIG_LIMIT the reduction
+// above runs out of bits of pi/2, so those arguments are redone with libm.
+#define MATH_KERNEL(attr, prefix, f)                                                \
+    attr void prefix##_vmath_##f(size_t n, const double* restrict x, double* restrict out) { \
+        for (size_t i = 0; i < n; ++i) {                                            \
+            out[i] = vm_##f(x[i]);                                                  \
+        }                                                                           \
+    }
+
+#define TRIG_KERNEL(attr, prefix, f)                                                \
+    attr void prefix##_vmath_##f(size_t n, const double* restrict x, double* restrict out) { \
+        for (size_t i = 0; i < n; ++i) {                                            \
+            out[i] = vm_##f(x[i]);                                                  \
+        }                                                                           \
+        for (size_t i = 0; i < n; ++i) {                                            \
+            if (needs_libm_sin(x[i])) {                                             \
+                out[i] = f(x[i]);                                                   \
+            }                                                                       \
+        }                                                                           \
+    }
+
+#define MATH_KERNELS(attr, prefix)      \
+    TRIG_KERNEL(attr, prefix, sin)      \
+    TRIG_KERNEL(attr, prefix, cos)      \
+    TRIG_KERNEL(attr, prefix, tan)      \
+    MATH_KERNEL(attr, prefix, asin)     \
+    MATH_KERNEL(attr, prefix, acos)     \
+    MATH_KERNEL(attr, prefix, atan)     \
+    MATH_KERNEL(attr, prefix, exp)      \
+    MATH_KERNEL(attr, prefix, log)      \
+    MATH_KERNEL(attr, prefix, sqrt)
+
+MATH_KERNELS(, c)
+
+#if defined(__x86_64__) || defined(__i386__)
+MATH_KERNELS(__attribute__((target("sse2"))), sse2)
+MATH_KERNELS(__attribute__((target("avx2"))), avx2)
+MATH_KERNELS(__attribute__((target("avx512f,avx512dq"))), avx512)
+#endif
@@ -0,0 +1,43 @@
+#ifndef VMATH_H
+#define VMATH_H
+
+#include <stddef.h>
+
+// Branch-free polynomial versions of the math builtins over arrays of
+// doubles, written so that the compiler vectorizes them for each kernel set
+// of array.c. Largest error against libm, in units in the last place, as
+// measured over millions of arguments (`make bench-simd` repeats this):
+//
+//   sin, cos   1 ulp for |x| <= 100, 2 ulp below 2^20
+//   tan        3 ulp for |x| <= 100, 4 ulp below 2^20
+//   asin       3 ulp
+//   acos       2 ulp
+//   atan, exp, log
+//              1 ulp, including subnormal arguments and results
+//   sqrt       exact (the square root instruction)
+//
+// sin, cos and tan hand arguments of 2^20 and more to libm.
+#define VMATH_FUNCS \
+    X(sin)          \
+    X(cos)          \
+    X(tan)          \
+    X(asin)         \
+    X(acos)         \
+    X(atan)         \
+    X(exp)          \
+    X(log)          \
+    X(sqrt)
+
+typedef void (*MathKernel_t)(size_t n, const double* x, double* out);
+
+#define X(f)                                                       \
+    void c_vmath_##f(size_t n, const double* x, double* out);      \
+    void sse2_vmath_##f(size_t n, const double* x, double* out);   \
+    void avx2_vmath_##f(size_t n, const double* x, double* out);   \
+    void avx512_vmath_##f(size_t n, const double* x, double* out);
+VMATH_FUNCS
+#undef X
+
+#endif
+
+// vim: ft=c
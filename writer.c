@@ -0,0 +1,152 @@
+// fileno
+#define _POSIX_C_SOURCE 200809L
+
+#include "writer.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fmt.h"
+#include "parser.h"
+
+#define WRITER_BLOCK (1 << 16)
+
+struct Writer writer_new(FILE* out) {
+    struct Writer writer = {.out = out, .data = malloc(WRITER_BLOCK), .capacity = WRITER_BLOCK};
+    return writer;
+}
+
+// Room for n more bytes, made by writing out the buffer or growing it.
+void writer_reserve(struct Writer* writer, size_t n) {
+    if (writer->size + n <= writer->capacity) {
+        return;
+    }
+
+    if (writer->out != NULL) {
+        writer_flush(writer);
+        if (n <= writer->capacity) {
+            return;
+        }
+    }
+
+    while (writer->size + n > writer->capacity) {
+        writer->capacity *= 2;
+    }
+    writer->data = realloc(writer->data, writer->capacity);
+}
+
+void writer_put(struct Writer* writer, const char* str, size_t n) {
+    writer_reserve(writer, n);
+    memcpy(writer->data + writer->size, str, n);
+    writer->size += n;
+}
+
+void writer_fill(struct Writer* writer, char c, size_t n) {
+    writer_reserve(writer, n);
+    memset(writer->data + writer->size, c, n);
+    writer->size += n;
+}
+
+void writer_int(struct Writer* writer, long long n) {
+    writer_reserve(writer, FMT_MAX);
+    writer->size += fmt_int(n, writer->data + writer->size);
+}
+
+void writer_float(struct Writer* writer, double x) {
+    writer_reserve(writer, FMT_MAX);
+    writer->size += fmt_float(x, writer->data + writer->size);
+}
+
+void writer_value(struct Writer* writer, struct AstValue value) {
+    switch (value.type) {
+        case V_NIL:
+            writer_put(writer, "nil", 3);
+            break;
+        case V_INT:
+            writer_int(writer, value.int_value);
+            break;
+        case V_FLOAT:
+            writer_float(writer, value.float_value);
+            break;
+        case V_STRING:
+            writer_put(writer, value.string_value, strlen(value.string_value));
+            break;
+        case V_INF:
+            writer_put(writer, "Inf", 3);
+            break;
+        case V_INT_ARRAY:
+            writer_put(writer, "[", 1);
+            for (size_t i = 0; i < value.list_size; ++i) {
+                writer_put(writer, ", ", i > 0 ? 2 : 0);
+                writer_int(writer, value.int_array[i]);
+            }
+            writer_put(writer, "]", 1);
+            break;
+        case V_FLOAT_ARRAY:
+            writer_put(writer, "[", 1);
+            for (size_t i = 0; i < value.list_size; ++i) {
+                writer_put(writer, ", ", i > 0 ? 2 : 0);
+                writer_float(writer, value.float_array[i]);
+            }
+            writer_put(writer, "]", 1);
+            break;
+        case V_LIST:
+            writer_put(writer, "[", 1);
+            for (size_t i = 0; i < value.list_size; ++i) {
+                writer_put(writer, ", ", i > 0 ? 2 : 0);
+                writer_value(writer, value.list_value[i]);
+            }
+            writer_put(writer, "]", 1);
+            break;
+        case V_RANGE:
+            writer_value(writer, value.range_value->start);
+            writer_put(writer, "..", 2);
+            writer_value(writer, value.range_value->stop);
+            break;
+        default:
+            error("%s: unknown value type: %s\n", __PRETTY_FUNCTION__, value_type_to_str(value.type));
+    }
+}
+
+void writer_flush(struct Writer* writer) {
+    if (writer->out != NULL && writer->size > 0) {
+        fwrite(writer->data, 1, writer->size, writer->out);
+        writer->size = 0;
+    }
+}
+
+void writer_free(struct Writer* writer) {
+    writer_flush(writer);
+    free(writer->data);
+    writer->data = NULL;
+    writer->size = 0;
+    writer->capacity = 0;
+}
+
+struct Writer std_out;
+bool std_out_tty;
+pthread_mutex_t std_out_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t std_out_once = PTHREAD_ONCE_INIT;
+
+void flush_stdout(void) {
+    writer_flush(&std_out);
+}
+
+void init_stdout(void) {
+    std_out = writer_new(stdout);
+    std_out_tty = isatty(fileno(stdout));
+    atexit(flush_stdout);
+}
+
+struct Writer* writer_acquire_stdout(void) {
+    pthread_once(&std_out_once, init_stdout);
+    pthread_mutex_lock(&std_out_lock);
+    return &std_out;
+}
+
+void writer_release_stdout(struct Writer* writer) {
+    if (std_out_tty) {
+        writer_flush(writer);
+    }
+    pthread_mutex_unlock(&std_out_lock);
+}
@@ -0,0 +1,35 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+#include "nc.h"
+
+// Text built up in one growing buffer, which is either kept in memory or
+// handed to a stream in large blocks instead of a call per value.
+struct Writer {
+    FILE* out;  // NULL to keep everything in memory
+    char* data;
+    size_t size;
+    size_t capacity;
+};
+
+struct Writer writer_new(FILE* out);
+void writer_put(struct Writer* writer, const char* str, size_t n);
+void writer_fill(struct Writer* writer, char c, size_t n);
+void writer_int(struct Writer* writer, long long n);
+void writer_float(struct Writer* writer, double x);
+// The same text print gives the value, formatted in place.
+void writer_value(struct Writer* writer, struct AstValue value);
+// Writes out what is buffered, if there is a stream.
+void writer_flush(struct Writer* writer);
+void writer_free(struct Writer* writer);
+
+// The writer of print and table for standard output, written out when full,
+// at exit and, on a terminal, whenever it is released. Only one thread
+// holds it at a time.
+struct Writer* writer_acquire_stdout(void);
+void writer_release_stdout(struct Writer* writer);
+
+#endif
+
+// vim: ft=c